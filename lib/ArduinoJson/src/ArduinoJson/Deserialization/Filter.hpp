@@ -0,0 +1,78 @@
+// ArduinoJson - arduinojson.org
+// Copyright Benoit Blanchon 2014-2020
+// MIT License
+
+#pragma once
+
+#include <ArduinoJson/Array/ArrayRef.hpp>
+#include <ArduinoJson/Object/ObjectRef.hpp>
+#include <ArduinoJson/Variant/VariantRef.hpp>
+
+namespace ARDUINOJSON_NAMESPACE {
+
+// Projection of the input driven by a template document:
+// - true keeps the value and everything below it,
+// - an object keeps only the listed members ("*" matches any other key),
+// - an array applies its first element to every element of the input array,
+// - anything else (missing, false, null) skips the value without allocating.
+class Filter {
+ public:
+  explicit Filter(VariantConstRef v) : _variant(v) {}
+
+  bool allow() const {
+    return allowObject() || allowArray();
+  }
+
+  bool allowArray() const {
+    return allowValue() || _variant.is<ArrayRef>();
+  }
+
+  bool allowObject() const {
+    return allowValue() || _variant.is<ObjectRef>();
+  }
+
+  bool allowValue() const {
+    return _variant.is<bool>() && _variant.as<bool>();
+  }
+
+  template <typename TKey>
+  Filter operator[](const TKey &key) const {
+    if (allowValue())  // "true" means "allow recursively"
+      return *this;
+    VariantConstRef member = _variant[key];
+    return Filter(member.isNull() ? _variant["*"] : member);
+  }
+
+  Filter operator[](size_t) const {
+    if (allowValue()) return *this;
+    return Filter(_variant[0]);
+  }
+
+ private:
+  VariantConstRef _variant;
+};
+
+struct AllowAllFilter {
+  bool allow() const {
+    return true;
+  }
+
+  bool allowArray() const {
+    return true;
+  }
+
+  bool allowObject() const {
+    return true;
+  }
+
+  bool allowValue() const {
+    return true;
+  }
+
+  template <typename TKey>
+  AllowAllFilter operator[](const TKey &) const {
+    return AllowAllFilter();
+  }
+};
+
+}  // namespace ARDUINOJSON_NAMESPACE
@@ -74,6 +74,12 @@ class MemoryPool {
     checkInvariants();
   }
 
+  // Releases s, which must be the last string that was frozen
+  void reclaimLastString(const char* s) {
+    _left = const_cast<char*>(s);
+    checkInvariants();
+  }
+
   void clear() {
     _left = _begin;
     _right = _end;
@@ -26,10 +26,42 @@ class MsgPackDeserializer {
         _stringStorage(stringStorage),
         _nestingLimit(nestingLimit) {}
 
-  DeserializationError parse(VariantData &variant) {
+  template <typename TFilter>
+  DeserializationError parse(VariantData &variant, TFilter filter) {
+    return parseVariant(variant, filter);
+  }
+
+ private:
+  // Prevent VS warning "assignment operator could not be generated"
+  MsgPackDeserializer &operator=(const MsgPackDeserializer &);
+
+  template <typename TFilter>
+  DeserializationError parseVariant(VariantData &variant, TFilter filter) {
     uint8_t code;
     if (!readByte(code)) return DeserializationError::IncompleteInput;
 
+    if (isArray(code)) {
+      if (!filter.allowArray()) return skipValue(code);
+    } else if (isObject(code)) {
+      if (!filter.allowObject()) return skipValue(code);
+    } else if (!filter.allowValue()) {
+      return skipValue(code);
+    }
+
+    return parseValue(variant, code, filter);
+  }
+
+  static bool isArray(uint8_t code) {
+    return (code & 0xf0) == 0x90 || code == 0xdc || code == 0xdd;
+  }
+
+  static bool isObject(uint8_t code) {
+    return (code & 0xf0) == 0x80 || code == 0xde || code == 0xdf;
+  }
+
+  template <typename TFilter>
+  DeserializationError parseValue(VariantData &variant, uint8_t code,
+                                  TFilter filter) {
     if ((code & 0x80) == 0) {
       variant.setUnsignedInteger(code);
       return DeserializationError::Ok;
@@ -46,11 +78,11 @@ class MsgPackDeserializer {
     }
 
     if ((code & 0xf0) == 0x90) {
-      return readArray(variant.toArray(), code & 0x0F);
+      return readArray(variant.toArray(), code & 0x0F, filter);
     }
 
     if ((code & 0xf0) == 0x80) {
-      return readObject(variant.toObject(), code & 0x0F);
+      return readObject(variant.toObject(), code & 0x0F, filter);
     }
 
     switch (code) {
@@ -114,25 +146,148 @@ class MsgPackDeserializer {
         return readString<uint32_t>(variant);
 
       case 0xdc:
-        return readArray<uint16_t>(variant.toArray());
+        return readArray<uint16_t>(variant.toArray(), filter);
 
       case 0xdd:
-        return readArray<uint32_t>(variant.toArray());
+        return readArray<uint32_t>(variant.toArray(), filter);
 
       case 0xde:
-        return readObject<uint16_t>(variant.toObject());
+        return readObject<uint16_t>(variant.toObject(), filter);
 
       case 0xdf:
-        return readObject<uint32_t>(variant.toObject());
+        return readObject<uint32_t>(variant.toObject(), filter);
 
       default:
         return DeserializationError::NotSupported;
     }
   }
 
- private:
-  // Prevent VS warning "assignment operator could not be generated"
-  MsgPackDeserializer &operator=(const MsgPackDeserializer &);
+  DeserializationError skipVariant() {
+    uint8_t code;
+    if (!readByte(code)) return DeserializationError::IncompleteInput;
+    return skipValue(code);
+  }
+
+  // Skips the value that starts with code, without allocating anything
+  DeserializationError skipValue(uint8_t code) {
+    if ((code & 0x80) == 0 || (code & 0xe0) == 0xe0) {
+      return DeserializationError::Ok;
+    }
+
+    if ((code & 0xe0) == 0xa0) {
+      return skipBytes(code & 0x1f);
+    }
+
+    if ((code & 0xf0) == 0x90) {
+      return skipArray(code & 0x0F);
+    }
+
+    if ((code & 0xf0) == 0x80) {
+      return skipObject(code & 0x0F);
+    }
+
+    switch (code) {
+      case 0xc0:
+      case 0xc2:
+      case 0xc3:
+        return DeserializationError::Ok;
+
+      case 0xcc:
+      case 0xd0:
+        return skipBytes(1);
+
+      case 0xcd:
+      case 0xd1:
+        return skipBytes(2);
+
+      case 0xce:
+      case 0xd2:
+      case 0xca:
+        return skipBytes(4);
+
+      case 0xcf:
+      case 0xd3:
+      case 0xcb:
+        return skipBytes(8);
+
+      case 0xd9:
+        return skipString<uint8_t>();
+
+      case 0xda:
+        return skipString<uint16_t>();
+
+      case 0xdb:
+        return skipString<uint32_t>();
+
+      case 0xdc:
+        return skipArray<uint16_t>();
+
+      case 0xdd:
+        return skipArray<uint32_t>();
+
+      case 0xde:
+        return skipObject<uint16_t>();
+
+      case 0xdf:
+        return skipObject<uint32_t>();
+
+      default:
+        return DeserializationError::NotSupported;
+    }
+  }
+
+  DeserializationError skipBytes(size_t n) {
+    for (; n; --n) {
+      uint8_t c;
+      if (!readByte(c)) return DeserializationError::IncompleteInput;
+    }
+    return DeserializationError::Ok;
+  }
+
+  template <typename TSize>
+  DeserializationError skipString() {
+    TSize size;
+    if (!readInteger(size)) return DeserializationError::IncompleteInput;
+    return skipBytes(size);
+  }
+
+  template <typename TSize>
+  DeserializationError skipArray() {
+    TSize size;
+    if (!readInteger(size)) return DeserializationError::IncompleteInput;
+    return skipArray(size);
+  }
+
+  DeserializationError skipArray(size_t n) {
+    if (_nestingLimit == 0) return DeserializationError::TooDeep;
+    --_nestingLimit;
+    for (; n; --n) {
+      DeserializationError err = skipVariant();
+      if (err) return err;
+    }
+    ++_nestingLimit;
+    return DeserializationError::Ok;
+  }
+
+  template <typename TSize>
+  DeserializationError skipObject() {
+    TSize size;
+    if (!readInteger(size)) return DeserializationError::IncompleteInput;
+    return skipObject(size);
+  }
+
+  DeserializationError skipObject(size_t n) {
+    if (_nestingLimit == 0) return DeserializationError::TooDeep;
+    --_nestingLimit;
+    for (; n; --n) {
+      DeserializationError err = skipVariant();  // key
+      if (err) return err;
+      err = skipVariant();  // value
+      if (err) return err;
+    }
+    ++_nestingLimit;
+    return DeserializationError::Ok;
+  }
 
   bool readByte(uint8_t &value) {
     int c = _reader.read();
@@ -239,47 +394,65 @@ class MsgPackDeserializer {
     return DeserializationError::Ok;
   }
 
-  template <typename TSize>
-  DeserializationError readArray(CollectionData &array) {
+  template <typename TSize, typename TFilter>
+  DeserializationError readArray(CollectionData &array, TFilter filter) {
     TSize size;
     if (!readInteger(size)) return DeserializationError::IncompleteInput;
-    return readArray(array, size);
+    return readArray(array, size, filter);
   }
 
-  DeserializationError readArray(CollectionData &array, size_t n) {
+  template <typename TFilter>
+  DeserializationError readArray(CollectionData &array, size_t n,
+                                 TFilter filter) {
     if (_nestingLimit == 0) return DeserializationError::TooDeep;
     --_nestingLimit;
+    TFilter memberFilter = filter[size_t(0)];
     for (; n; --n) {
-      VariantData *value = array.add(_pool);
-      if (!value) return DeserializationError::NoMemory;
-
-      DeserializationError err = parse(*value);
+      DeserializationError err;
+      if (memberFilter.allow()) {
+        VariantData *value = array.add(_pool);
+        if (!value) return DeserializationError::NoMemory;
+
+        err = parseVariant(*value, memberFilter);
+      } else {
+        err = skipVariant();
+      }
       if (err) return err;
     }
     ++_nestingLimit;
     return DeserializationError::Ok;
   }
 
-  template <typename TSize>
-  DeserializationError readObject(CollectionData &object) {
+  template <typename TSize, typename TFilter>
+  DeserializationError readObject(CollectionData &object, TFilter filter) {
     TSize size;
     if (!readInteger(size)) return DeserializationError::IncompleteInput;
-    return readObject(object, size);
+    return readObject(object, size, filter);
   }
 
-  DeserializationError readObject(CollectionData &object, size_t n) {
+  template <typename TFilter>
+  DeserializationError readObject(CollectionData &object, size_t n,
+                                  TFilter filter) {
     if (_nestingLimit == 0) return DeserializationError::TooDeep;
     --_nestingLimit;
     for (; n; --n) {
-      VariantSlot *slot = object.addSlot(_pool);
-      if (!slot) return DeserializationError::NoMemory;
-
       const char *key;
       DeserializationError err = parseKey(key);
       if (err) return err;
-      slot->setOwnedKey(make_not_null(key));
 
-      err = parse(*slot->data());
+      TFilter memberFilter = filter[key];
+
+      if (memberFilter.allow()) {
+        VariantSlot *slot = object.addSlot(_pool);
+        if (!slot) return DeserializationError::NoMemory;
+
+        slot->setOwnedKey(make_not_null(key));
+
+        err = parseVariant(*slot->data(), memberFilter);
+      } else {
+        _stringStorage.reclaim(key);
+        err = skipVariant();
+      }
       if (err) return err;
     }
     ++_nestingLimit;
@@ -313,31 +486,71 @@ class MsgPackDeserializer {
   uint8_t _nestingLimit;
 };
 
+//
+// deserializeMsgPack(JsonDocument&, const std::string&, ...)
+// deserializeMsgPack(JsonDocument&, const String&, ...)
 template <typename TInput>
 DeserializationError deserializeMsgPack(
     JsonDocument &doc, const TInput &input,
     NestingLimit nestingLimit = NestingLimit()) {
-  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit);
+  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit,
+                                          AllowAllFilter());
 }
-
+template <typename TInput>
+DeserializationError deserializeMsgPack(
+    JsonDocument &doc, const TInput &input, Filter filter,
+    NestingLimit nestingLimit = NestingLimit()) {
+  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit, filter);
+}
+//
+// deserializeMsgPack(JsonDocument&, char*, ...)
+// deserializeMsgPack(JsonDocument&, const char*, ...)
+// deserializeMsgPack(JsonDocument&, const __FlashStringHelper*, ...)
 template <typename TInput>
 DeserializationError deserializeMsgPack(
     JsonDocument &doc, TInput *input,
     NestingLimit nestingLimit = NestingLimit()) {
-  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit);
+  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit,
+                                          AllowAllFilter());
 }
-
+template <typename TInput>
+DeserializationError deserializeMsgPack(
+    JsonDocument &doc, TInput *input, Filter filter,
+    NestingLimit nestingLimit = NestingLimit()) {
+  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit, filter);
+}
+//
+// deserializeMsgPack(JsonDocument&, char*, size_t, ...)
+// deserializeMsgPack(JsonDocument&, const char*, size_t, ...)
+// deserializeMsgPack(JsonDocument&, const __FlashStringHelper*, size_t, ...)
 template <typename TInput>
 DeserializationError deserializeMsgPack(
     JsonDocument &doc, TInput *input, size_t inputSize,
     NestingLimit nestingLimit = NestingLimit()) {
-  return deserialize<MsgPackDeserializer>(doc, input, inputSize, nestingLimit);
+  return deserialize<MsgPackDeserializer>(doc, input, inputSize, nestingLimit,
+                                          AllowAllFilter());
 }
-
+template <typename TInput>
+DeserializationError deserializeMsgPack(
+    JsonDocument &doc, TInput *input, size_t inputSize, Filter filter,
+    NestingLimit nestingLimit = NestingLimit()) {
+  return deserialize<MsgPackDeserializer>(doc, input, inputSize, nestingLimit,
+                                          filter);
+}
+//
+// deserializeMsgPack(JsonDocument&, std::istream&, ...)
+// deserializeMsgPack(JsonDocument&, Stream&, ...)
 template <typename TInput>
 DeserializationError deserializeMsgPack(
     JsonDocument &doc, TInput &input,
     NestingLimit nestingLimit = NestingLimit()) {
-  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit);
+  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit,
+                                          AllowAllFilter());
+}
+template <typename TInput>
+DeserializationError deserializeMsgPack(
+    JsonDocument &doc, TInput &input, Filter filter,
+    NestingLimit nestingLimit = NestingLimit()) {
+  return deserialize<MsgPackDeserializer>(doc, input, nestingLimit, filter);
 }
 }  // namespace ARDUINOJSON_NAMESPACE
@@ -19,6 +19,11 @@ class StringCopier {
     return StringBuilder(_pool);
   }
 
+  // Releases the last completed string, e.g. the key of a filtered-out member
+  void reclaim(const char* s) {
+    if (s) _pool->reclaimLastString(s);
+  }
+
  private:
   MemoryPool* _pool;
 };
@@ -34,6 +34,9 @@ class StringMover {
     return StringBuilder(&_ptr);
   }
 
+  // Strings are moved within the input buffer, nothing to release
+  void reclaim(const char*) {}
+
  private:
   char* _ptr;
 };
@@ -22,7 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #pragma GCC diagnostic warning "-Wswitch"
 #pragma GCC diagnostic warning "-Wreorder"
-#pragma GCC diagnostic warning "-Wformat="
+#pragma GCC diagnostic warning "-Wformat"
 #pragma GCC diagnostic warning "-Wunused-value"
 #pragma GCC diagnostic warning "-Wunused-variable"
 #pragma GCC diagnostic warning "-Wwrite-strings"
@@ -36,14 +36,14 @@ namespace MQTT {
   }
 
   //! Write an arbitrary chunk of data, with 16-bit length first
-  void write(uint8_t *buf, uint32_t& bufpos, uint8_t *data, uint16_t dlen) {
+  void write(uint8_t *buf, uint32_t& bufpos, const uint8_t *data, uint16_t dlen) {
     write(buf, bufpos, dlen);
     memcpy(buf + bufpos, data, dlen);
     bufpos += dlen;
   }
 
   //! Write a string, with 16-bit length first
-  void write(uint8_t *buf, uint32_t& bufpos, String str) {
+  void write(uint8_t *buf, uint32_t& bufpos, const String& str) {
     const char* c = str.c_str();
     uint32_t length_pos = bufpos;
     bufpos += 2;
@@ -93,28 +93,14 @@ namespace MQTT {
 
   template <>
   uint8_t read<uint8_t>(Client& client) {
-    while(!client.available()) {}
+    while (!client.available()) {
+      if (!client.connected())
+	return 0;
+      yield();
+    }
     return client.read();
   }
 
-  template <>
-  uint16_t read<uint16_t>(Client& client) {
-    uint16_t val = read<uint8_t>(client) << 8;
-    val |= read<uint8_t>(client);
-    return val;
-  }
-
-  template <>
-  String read<String>(Client& client) {
-    uint16_t len = read<uint16_t>(client);
-    String val;
-    val.reserve(len);
-    for (uint16_t i = 0; i < len; i++)
-      val += (char)read<uint8_t>(client);
-
-    return val;
-  }
-
 
   // Message class
   uint8_t Message::fixed_header_length(uint32_t rlength) const {
@@ -171,31 +157,69 @@ namespace MQTT {
     write(buf, bufpos, _packet_id);
   }
 
-  bool Message::send(Client& client) {
+  uint32_t Message::write_head(uint8_t *buf, uint32_t len) const {
     uint32_t variable_header_len = variable_header_length();
     uint32_t remaining_length = variable_header_len + payload_length();
-    uint32_t packet_length = fixed_header_length(remaining_length);
-    if (_payload_callback == nullptr)
-      packet_length += remaining_length;
-    else
-      packet_length += variable_header_len;
+    if (fixed_header_length(remaining_length) + variable_header_len > len)
+      return 0;
+
+    uint32_t pos = 0;
+    write_fixed_header(buf, pos, remaining_length);
+    write_variable_header(buf, pos);
+    return pos;
+  }
 
-    uint8_t *packet = new uint8_t[packet_length];
+  bool Message::send(Client& client, uint8_t *scratch, uint32_t scratch_len) {
+    uint32_t variable_header_len = variable_header_length();
+    uint32_t payload_len = payload_length();
+    uint32_t remaining_length = variable_header_len + payload_len;
+    uint32_t head_length = fixed_header_length(remaining_length) + variable_header_len;
+
+    // Payloads without contiguous storage (e.g. Connect) are serialised behind the headers
+    const uint8_t *payload = payload_data();
+    bool serialise_payload = (_payload_callback == nullptr) && (payload == nullptr);
+    bool copy_payload = (_payload_callback == nullptr) && (payload != nullptr)
+      && (scratch != nullptr) && (head_length + payload_len <= scratch_len);
+
+    uint32_t build_length = head_length;
+    if (serialise_payload || copy_payload)
+      build_length += payload_len;
+
+    uint8_t head[MQTT_HEADER_BUFFER];
+    uint8_t *packet = head;
+    bool packet_mine = false;
+    if (build_length > sizeof(head)) {
+      if ((scratch != nullptr) && (build_length <= scratch_len)) {
+	packet = scratch;
+      } else {
+	// Oversized headers only, e.g. a very long topic
+	packet = new uint8_t[build_length];
+	packet_mine = true;
+      }
+    } else if (copy_payload) {
+      packet = scratch;
+    }
 
     uint32_t pos = 0;
     write_fixed_header(packet, pos, remaining_length);
     write_variable_header(packet, pos);
+    if (serialise_payload || copy_payload)
+      write_payload(packet, pos);
 
-    write_payload(packet, pos);
-
-    uint32_t sent = client.write(const_cast<const uint8_t*>(packet), packet_length);
-    delete [] packet;
-    if (sent != packet_length)
+    uint32_t sent = client.write(const_cast<const uint8_t*>(packet), build_length);
+    if (packet_mine)
+      delete [] packet;
+    if (sent != build_length)
       return false;
 
     if (_payload_callback != nullptr)
       return _payload_callback(client);
 
+    if ((payload != nullptr) && !copy_payload && (payload_len > 0)) {
+      if (client.write(payload, payload_len) != payload_len)
+	return false;
+    }
+
     return true;
   }
 
@@ -204,9 +228,23 @@ namespace MQTT {
   PacketParser::PacketParser(Client& client) :
     _client(client),
     _state(State::Start),
+    _remaining_data(nullptr),
     _msg(nullptr)
   {}
 
+  bool PacketParser::_read_data(void) {
+    while ((_to_read > 0) && (_client.available() > 0)) {
+      int read_size = _client.read(_read_point, _to_read);
+      if (read_size <= 0)
+	return false;
+      _to_read -= read_size;
+      _read_point += read_size;
+    }
+
+    // Come around again if we haven't read everything
+    return _to_read == 0;
+  }
+
   bool PacketParser::_read_type_flags(void) {
     if (_client.available() < 1)
       return false;
@@ -240,7 +278,24 @@ namespace MQTT {
 
     // If the packet is too big, only allow streaming it
     if (_remaining_length > MQTT_TOO_BIG) {
-      _state = State::CreateObject;
+      switch (_type) {
+      case PUBLISH:
+	_head_length = 0;	// Not known until the topic length has been read
+	break;
+
+      case SUBACK:
+	_head_length = 2;	// Packet id
+	break;
+
+      default:
+	_state = State::Skip;
+	return true;
+      }
+
+      _to_read = 2;
+      _remaining_data = new uint8_t[_to_read];
+      _read_point = _remaining_data;
+      _state = State::ReadStreamHeader;
       return true;
     }
 
@@ -257,36 +312,77 @@ namespace MQTT {
   }
 
   bool PacketParser::_read_remaining(void) {
+    if (!_read_data())
+      return false;
+
+    _state = State::CreateObject;
+    return true;
+  }
+
+  bool PacketParser::_read_stream_header(void) {
+    if (!_read_data())
+      return false;
+
+    if (_head_length == 0) {
+      // Topic length is in, read the topic and the packet id if there is one
+      uint32_t length = 2 + ((_remaining_data[0] << 8) | _remaining_data[1]);
+      if (_flags & 0x06)
+	length += 2;
+
+      if (length > _remaining_length) {
+	delete [] _remaining_data;
+	_remaining_data = nullptr;
+	_to_read = _remaining_length - 2;
+	_state = State::Skip;
+	return true;
+      }
+
+      uint8_t *head = new uint8_t[length];
+      memcpy(head, _remaining_data, 2);
+      delete [] _remaining_data;
+      _remaining_data = head;
+      _read_point = head + 2;
+      _to_read = length - 2;
+      _head_length = length;
+      return true;
+    }
+
+    _state = State::CreateObject;
+    return true;
+  }
+
+  bool PacketParser::_skip(void) {
+    uint8_t discard[32];
     while ((_to_read > 0) && (_client.available() > 0)) {
-      int read_size = _client.read(_read_point, _to_read);
-      if (read_size == -1)
+      int read_size = _client.read(discard, _to_read < sizeof(discard) ? _to_read : sizeof(discard));
+      if (read_size <= 0)
 	return false;
       _to_read -= read_size;
-      _read_point += read_size;
     }
-
-    // Come around again if we haven't read everything
     if (_to_read > 0)
       return false;
 
-    _state = State::CreateObject;
+    _msg = nullptr;
+    _state = State::HaveObject;
     return true;
   }
 
   bool PacketParser::_construct_object(void) {
+    _msg = nullptr;
+
     if (_remaining_length > MQTT_TOO_BIG) {
       switch (_type) {
       case PUBLISH:
-	_msg = new Publish(_flags, _client, _remaining_length);
+	_msg = new Publish(_flags, _remaining_data, _head_length, _client, _remaining_length);
 	break;
 
       case SUBACK:
-	_msg = new SubscribeAck(_client, _remaining_length);
+	_msg = new SubscribeAck(_remaining_data, _client, _remaining_length);
 	break;
-
-      default:
-	_msg = nullptr;
       }
+      delete [] _remaining_data;
+      _remaining_data = nullptr;
+
       _state = State::HaveObject;
       return true;
     }
@@ -335,6 +431,7 @@ namespace MQTT {
     }
     if (_remaining_data != nullptr)
       delete [] _remaining_data;
+    _remaining_data = nullptr;
 
     _state = State::HaveObject;
     return true;
@@ -362,6 +459,18 @@ namespace MQTT {
 
         break;
 
+        case State::ReadStreamHeader:
+        if (!_read_stream_header())
+        return nullptr;
+
+        break;
+
+        case State::Skip:
+        if (!_skip())
+        return nullptr;
+
+        break;
+
         case State::CreateObject:
         if (!_construct_object())
         return nullptr;
@@ -429,7 +538,7 @@ namespace MQTT {
   }
 
   void Connect::write_variable_header(uint8_t *buf, uint32_t& bufpos) const {
-    write(buf, bufpos, "MQTT");	// Protocol name
+    write(buf, bufpos, (const uint8_t*)"MQTT", 4);	// Protocol name
     buf[bufpos++] = 4;		// Protocol level
 
     buf[bufpos] = 0;		// Connect flags
@@ -554,22 +663,17 @@ namespace MQTT {
     _payload_callback = pcb;
   }
 
-  Publish::Publish(uint8_t flags, Client& client, uint32_t remaining_length) :
+  Publish::Publish(uint8_t flags, uint8_t* data, uint32_t length, Client& client, uint32_t remaining_length) :
     Message(PUBLISH, flags),
-    _payload(nullptr), _payload_len(remaining_length),
+    _payload(nullptr), _payload_len(remaining_length - length),
     _payload_mine(false)
   {
     _stream_client = &client;
 
-    // Read the topic
-    _topic = read<String>(client);
-    _payload_len -= 2 + _topic.length();
-
-    if (qos() > 0) {
-      // Read the packet id
-      _packet_id = read<uint16_t>(client);
-      _payload_len -= 2;
-    }
+    uint32_t pos = 0;
+    _topic = read<String>(data, pos);
+    if (qos() > 0)
+      _packet_id = read<uint16_t>(data, pos);
 
     // Client stream is now at the start of the payload
   }
@@ -591,6 +695,18 @@ namespace MQTT {
     return *this;
   }
 
+  String Publish::topic(void) const {
+    if (_topic_ref == nullptr)
+      return _topic;
+
+    String str;
+    str.reserve(_topic_len);
+    for (uint16_t i = 0; i < _topic_len; i++)
+      str += _topic_ref[i];
+
+    return str;
+  }
+
   String Publish::payload_string(void) const {
     String str;
     str.reserve(_payload_len);
@@ -601,11 +717,11 @@ namespace MQTT {
   }
 
   uint32_t Publish::variable_header_length(void) const {
-    return 2 + _topic.length() + (qos() ? 2 : 0);
+    return 2 + topic_length() + (qos() ? 2 : 0);
   }
 
   void Publish::write_variable_header(uint8_t *buf, uint32_t& bufpos) const {
-    write(buf, bufpos, _topic);
+    write(buf, bufpos, (const uint8_t*)topic_ptr(), topic_length());
     if (qos())
       write_packet_id(buf, bufpos);
   }
@@ -778,15 +894,15 @@ namespace MQTT {
     }
   }
 
-  SubscribeAck::SubscribeAck(Client& client, uint32_t remaining_length) :
+  SubscribeAck::SubscribeAck(uint8_t* data, Client& client, uint32_t remaining_length) :
     Message(SUBACK),
     _rcs(nullptr),
     _num_rcs(remaining_length - 2)
   {
     _stream_client = &client;
 
-    // Read packet id
-    _packet_id = read<uint16_t>(client);
+    uint32_t pos = 0;
+    _packet_id = read<uint16_t>(data, pos);
 
     // Client stream is now at the start of the list of rcs
   }
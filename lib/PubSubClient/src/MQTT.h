@@ -21,7 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 // switch to warnings in pedantic compiler environment
 #pragma GCC diagnostic warning "-Wreorder"
-#pragma GCC diagnostic warning "-Wformat="
+#pragma GCC diagnostic warning "-Wformat"
 #pragma GCC diagnostic warning "-Wunused-value"
 #pragma GCC diagnostic warning "-Wunused-variable"
 #pragma GCC diagnostic warning "-Wwrite-strings"
@@ -41,6 +41,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define MQTT_TOO_BIG 4096
 #endif
 
+// Stack space used by send() for the fixed and variable headers
+#ifndef MQTT_HEADER_BUFFER
+#define MQTT_HEADER_BUFFER 160
+#endif
+
 class PubSubClient;
 
 //! namespace for classes representing MQTT messages
@@ -146,14 +151,35 @@ namespace MQTT {
     */
     virtual void write_payload(uint8_t *buf, uint32_t& bufpos) const { }
 
+    //! Payload already laid out in memory, written without copying
+    /*!
+      \return Pointer to payload_length() bytes, nullptr if write_payload() has to serialise it
+    */
+    virtual const uint8_t* payload_data(void) const { return nullptr; }
+
     //! Message type to expect in response to this message
     virtual message_type response_type(void) const { return None; }
 
+    //! Write the fixed and variable headers to a buffer
+    /*!
+      \param buf Buffer to write to
+      \param len Size of the buffer
+      \return Number of bytes written, 0 if the headers don't fit
+    */
+    uint32_t write_head(uint8_t *buf, uint32_t len) const;
+
     friend PubSubClient;	// Just to allow it to call response_type()
 
   public:
     //! Send the message out
-    bool send(Client& client);
+    /*!
+      Headers are built on the stack and a contiguous payload is written
+      straight from its own memory, so nothing is allocated per message.
+      \param client Network client to write to
+      \param scratch Optional buffer; packets that fit are sent with a single write()
+      \param scratch_len Size of the scratch buffer
+    */
+    bool send(Client& client, uint8_t *scratch = nullptr, uint32_t scratch_len = 0);
 
     //! Get the message type
     message_type type(void) const { return _type; }
@@ -174,6 +200,8 @@ namespace MQTT {
 	ReadTypeFlags = 0,
 	ReadLength,
 	ReadContents,
+	ReadStreamHeader,	// Topic and packet id in front of a streamed payload
+	Skip,			// Discard a packet too big for buffering that can't be streamed
 	CreateObject,
 	HaveObject,
     };
@@ -181,19 +209,28 @@ namespace MQTT {
     Client &_client;
     State _state;
     uint8_t _flags, _type, _length_shifter;
-    uint32_t _remaining_length, _to_read;
+    uint32_t _remaining_length, _to_read, _head_length;
     uint8_t *_remaining_data, *_read_point;
     Message *_msg;
 
+    //! Read what is available of _to_read bytes to _read_point
+    /*!
+      \return true once all bytes have been read
+    */
+    bool _read_data(void);
+
     bool _read_type_flags(void);
     bool _read_length(void);
     bool _read_remaining(void);
+    bool _read_stream_header(void);
+    bool _skip(void);
     bool _construct_object(void);
 
   public:
     PacketParser(Client& client);
 
   /*!
+    Never waits for data, a partially received packet is resumed on the next call.
     remember to free the object once you're finished with it
     \return A pointer to an object derived from the Message class, representing the packet. If no complete packet was available, nullptr is returned.
   */
@@ -231,6 +268,8 @@ namespace MQTT {
     Connect& set_clean_session(bool cs = true)	{ _clean_session = cs; return *this; }
     //! Unset the "clear session" flag
     Connect& unset_clean_session(void)		{ _clean_session = false; return *this; }
+    //! Get the "clear session" flag
+    bool clean_session(void) const		{ return _clean_session; }
 
     //! Set the "will" flag and associated attributes
     Connect& set_will(String willTopic, String willMessage, uint8_t willQos = 0, bool willRetain = false);
@@ -268,6 +307,9 @@ namespace MQTT {
   public:
     uint8_t rc(void) const { return _rc; }
 
+    //! Whether the server resumed a stored session (only with clean session unset)
+    bool session_present(void) const { return _session_present; }
+
   };
 
 
@@ -275,6 +317,8 @@ namespace MQTT {
   class Publish : public Message {
   protected:
     String _topic;
+    const char *_topic_ref = nullptr;	// Topic in the caller's memory, used instead of _topic when set
+    uint16_t _topic_len = 0;
     uint8_t *_payload = nullptr;
     uint32_t _payload_len = 0;
     bool _payload_mine;
@@ -283,6 +327,7 @@ namespace MQTT {
     void write_variable_header(uint8_t *buf, uint32_t& bufpos) const;
     uint32_t payload_length(void) const;
     void write_payload(uint8_t *buf, uint32_t& bufpos) const;
+    const uint8_t* payload_data(void) const { return _payload; }
 
     message_type response_type(void) const;
 
@@ -297,8 +342,15 @@ namespace MQTT {
     //! Private constructor from a network buffer
     Publish(uint8_t flags, uint8_t* data, uint32_t length);
 
-    //! Private constructor from a network stream
-    Publish(uint8_t flags, Client& client, uint32_t remaining_length);
+    //! Private constructor from the header of a network stream
+    /*!
+      \param flags Flags from the fixed header
+      \param data Topic and packet id, already read by the parser
+      \param length Length of 'data'
+      \param client Network stream positioned at the start of the payload
+      \param remaining_length Remaining length of the packet
+     */
+    Publish(uint8_t flags, uint8_t* data, uint32_t length, Client& client, uint32_t remaining_length);
 
     friend PacketParser;
 
@@ -320,6 +372,21 @@ namespace MQTT {
       Publish(topic, payload, length, false)
     {}
 
+    //! Constructor referencing topic and payload in the caller's memory
+    /*!
+      Nothing is copied or allocated, both have to stay valid as long as this object is used.
+      \param topic Topic of this message, need not be zero-terminated
+      \param topic_len Length of the topic
+      \param payload Pointer to a block of data
+      \param length The length of the data stored at 'payload'
+     */
+    Publish(const char *topic, uint16_t topic_len, const uint8_t *payload, uint32_t length) :
+      Message(PUBLISH),
+      _topic_ref(topic), _topic_len(topic_len),
+      _payload(const_cast<uint8_t*>(payload)), _payload_len(length),
+      _payload_mine(false)
+    {}
+
     //! Constructor from a callback
     /*!
       \param topic Topic of this message
@@ -357,7 +424,12 @@ namespace MQTT {
     Publish& unset_dup(void)		{ _flags = _flags & ~0x08; return *this; }
 
     //! Get the topic string
-    String topic(void) const { return _topic; }
+    String topic(void) const;
+
+    //! Get the topic without copying it, not necessarily zero-terminated
+    const char* topic_ptr(void) const { return _topic_ref != nullptr ? _topic_ref : _topic.c_str(); }
+    //! Get the topic length
+    uint16_t topic_length(void) const { return _topic_ref != nullptr ? _topic_len : _topic.length(); }
 
     //! Get the payload as a string
     String payload_string(void) const;
@@ -461,6 +533,7 @@ namespace MQTT {
     void write_variable_header(uint8_t *buf, uint32_t& bufpos) const;
     uint32_t payload_length(void) const;
     void write_payload(uint8_t *buf, uint32_t& bufpos) const;
+    const uint8_t* payload_data(void) const { return _buffer; }
 
     message_type response_type(void) const { return SUBACK; }
 
@@ -488,8 +561,8 @@ namespace MQTT {
     //! Private constructor from a network buffer
     SubscribeAck(uint8_t* data, uint32_t length);
 
-    //! Private constructor from a network stream
-    SubscribeAck(Client& client, uint32_t remaining_length);
+    //! Private constructor from the packet id and a network stream positioned at the return codes
+    SubscribeAck(uint8_t* data, Client& client, uint32_t remaining_length);
 
     friend PacketParser;
 
@@ -518,6 +591,7 @@ namespace MQTT {
     void write_variable_header(uint8_t *buf, uint32_t& bufpos) const;
     uint32_t payload_length(void) const;
     void write_payload(uint8_t *buf, uint32_t& bufpos) const;
+    const uint8_t* payload_data(void) const { return _buffer; }
 
     message_type response_type(void) const { return UNSUBACK; }
 
@@ -9,7 +9,7 @@
 
 #pragma GCC diagnostic warning "-Wswitch"
 #pragma GCC diagnostic warning "-Wreorder"
-#pragma GCC diagnostic warning "-Wformat="
+#pragma GCC diagnostic warning "-Wformat"
 #pragma GCC diagnostic warning "-Wunused-value"
 #pragma GCC diagnostic warning "-Wunused-variable"
 #pragma GCC diagnostic warning "-Wwrite-strings"
@@ -17,32 +17,64 @@
 
 PubSubClient::PubSubClient(Client& c) :
   _callback(nullptr),
+  _router(nullptr),
   _client(c),
   _parser(c),
   _max_retries(10),
-  isSubAckFound(false)
+  isSubAckFound(false),
+  _send_buffer(nullptr), _send_buffer_len(0),
+  _queue(nullptr), _queue_size(0), _queue_head(0), _queue_tail(0), _queue_used(0),
+  _queue_policy(QUEUE_BLOCK), _queue_dropped(0),
+  _inflight(), _inflight_window(0), _inflight_count(0),
+  _retransmit_timeout(MQTT_RETRANSMIT_TIMEOUT),
+  _delivery_callback(nullptr),
+  _session_present(false),
+  nextMsgId(1)
 {}
 
 PubSubClient::PubSubClient(Client& c, IPAddress &ip, uint16_t port) :
   _callback(nullptr),
+  _router(nullptr),
   _client(c),
   _parser(c),
   _max_retries(10),
   isSubAckFound(false),
+  _send_buffer(nullptr), _send_buffer_len(0),
+  _queue(nullptr), _queue_size(0), _queue_head(0), _queue_tail(0), _queue_used(0),
+  _queue_policy(QUEUE_BLOCK), _queue_dropped(0),
+  _inflight(), _inflight_window(0), _inflight_count(0),
+  _retransmit_timeout(MQTT_RETRANSMIT_TIMEOUT),
+  _delivery_callback(nullptr),
+  _session_present(false),
   server_ip(ip),
-  server_port(port)
+  server_port(port),
+  nextMsgId(1)
 {}
 
 PubSubClient::PubSubClient(Client& c, String hostname, uint16_t port) :
   _callback(nullptr),
+  _router(nullptr),
   _client(c),
   _parser(c),
   _max_retries(10),
   isSubAckFound(false),
+  _send_buffer(nullptr), _send_buffer_len(0),
+  _queue(nullptr), _queue_size(0), _queue_head(0), _queue_tail(0), _queue_used(0),
+  _queue_policy(QUEUE_BLOCK), _queue_dropped(0),
+  _inflight(), _inflight_window(0), _inflight_count(0),
+  _retransmit_timeout(MQTT_RETRANSMIT_TIMEOUT),
+  _delivery_callback(nullptr),
+  _session_present(false),
   server_port(port),
-  server_hostname(hostname)
+  server_hostname(hostname),
+  nextMsgId(1)
 {}
 
+PubSubClient::~PubSubClient() {
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    free(_inflight[i].packet);
+}
+
 PubSubClient& PubSubClient::set_server(IPAddress &ip, uint16_t port) {
   server_hostname = "";
   server_ip = ip;
@@ -56,6 +88,17 @@ PubSubClient& PubSubClient::set_server(String hostname, uint16_t port) {
   return *this;
 }
 
+PubSubClient& PubSubClient::set_queue(uint8_t *buf, uint32_t len, queue_policy policy) {
+  if (_queue_used > 0)
+    _flush_queue();
+
+  _queue = buf;
+  _queue_size = buf ? len : 0;
+  _queue_head = _queue_tail = _queue_used = 0;
+  _queue_policy = policy;
+  return *this;
+}
+
 MQTT::Message* PubSubClient::_recv_message(void) {
   MQTT::Message *msg = _parser.parse();
   if (msg != nullptr)
@@ -64,12 +107,15 @@ MQTT::Message* PubSubClient::_recv_message(void) {
 }
 
 bool PubSubClient::_send_message(MQTT::Message& msg) {
+  if ((_queue_used > 0) && !_flush_queue())
+    return false;
+
   if (msg.need_packet_id())
     msg.set_packet_id(_next_packet_id());
 
   uint8_t retries = 0;
  send:
-  if (!msg.send(_client)) {
+  if (!msg.send(_client, _send_buffer, _send_buffer_len)) {
     if (retries < _max_retries) {
       retries++;
       goto send;
@@ -82,12 +128,16 @@ bool PubSubClient::_send_message(MQTT::Message& msg) {
 }
 
 MQTT::Message* PubSubClient::_send_message_with_response(MQTT::Message& msg) {
+  // Queued messages left over from the previous connection follow the CONNECT
+  if ((msg.type() != MQTT::CONNECT) && (_queue_used > 0) && !_flush_queue())
+    return nullptr;
+
   if (msg.need_packet_id())
     msg.set_packet_id(_next_packet_id());
 
   uint8_t retries = 0;
  send:
-  if (!msg.send(_client)) {
+  if (!msg.send(_client, _send_buffer, _send_buffer_len)) {
     if (retries < _max_retries) {
       retries++;
       goto send;
@@ -114,7 +164,7 @@ void PubSubClient::_process_message(MQTT::Message* msg) {
     {
       MQTT::Publish *pub = static_cast<MQTT::Publish*>(msg);	// RTTI is disabled on embedded, so no dynamic_cast<>()
 
-      if (_callback)
+      if (((_router == nullptr) || (_router->dispatch(*pub) == 0)) && _callback)
       _callback(*pub);
 
       if (pub->qos() == 1) {
@@ -150,12 +200,15 @@ void PubSubClient::_process_message(MQTT::Message* msg) {
     pingOutstanding = false;
     break;
 
-    case MQTT::CONNECT:
-    case MQTT::CONNACK:
     case MQTT::PUBACK:
     case MQTT::PUBREC:
-    case MQTT::PUBREL:
     case MQTT::PUBCOMP:
+    _ack_inflight(msg->type(), msg->packet_id());
+    break;
+
+    case MQTT::CONNECT:
+    case MQTT::CONNACK:
+    case MQTT::PUBREL:
     case MQTT::SUBSCRIBE:
     case MQTT::SUBACK:
     case MQTT::UNSUBSCRIBE:
@@ -208,6 +261,239 @@ MQTT::Message* PubSubClient::_wait_for(MQTT::message_type wait_type, uint16_t wa
   return nullptr;
 }
 
+uint32_t PubSubClient::_queued_packet_length(uint32_t pos) const {
+  // Type and flags, then the remaining length (1-4 bytes)
+  uint32_t length = 1, remaining = 0;
+  uint8_t shift = 0, digit;
+  do {
+    digit = _queue[(pos + length) % _queue_size];
+    remaining |= (uint32_t)(digit & 0x7f) << shift;
+    shift += 7;
+    length++;
+  } while ((digit & 0x80) && (shift < 28));
+
+  return length + remaining;
+}
+
+void PubSubClient::_queue_append(const uint8_t *data, uint32_t len) {
+  uint32_t first = _queue_size - _queue_head;
+  if (first > len)
+    first = len;
+  memcpy(_queue + _queue_head, data, first);
+  memcpy(_queue, data + first, len - first);
+  _queue_head = (_queue_head + len) % _queue_size;
+  _queue_used += len;
+}
+
+bool PubSubClient::_flush_queue(void) {
+  // _queue_tail stays on the first packet not completely written, 'written' bytes of which
+  // (and possibly of the packets after it) have been sent already
+  uint32_t written = 0;
+  while (written < _queue_used) {
+    uint32_t pos = (_queue_tail + written) % _queue_size;
+    uint32_t run = _queue_size - pos;
+    if (run > _queue_used - written)
+      run = _queue_used - written;
+
+    uint32_t sent = _client.write(const_cast<const uint8_t*>(_queue + pos), run);
+    written += sent;
+    while (_queue_used > 0) {
+      uint32_t length = _queued_packet_length(_queue_tail);
+      if (length > written)
+	break;
+      _queue_tail = (_queue_tail + length) % _queue_size;
+      _queue_used -= length;
+      written -= length;
+    }
+
+    if (sent != run) {
+      // The broker has seen a truncated packet, skip it and drop the connection.
+      // Whatever follows starts at a packet boundary and is sent after reconnecting.
+      if (written > 0) {
+	uint32_t length = _queued_packet_length(_queue_tail);
+	_queue_tail = (_queue_tail + length) % _queue_size;
+	_queue_used -= length;
+	_queue_dropped++;
+      }
+      _client.stop();
+      return false;
+    }
+    lastOutActivity = millis();
+  }
+  _queue_head = _queue_tail = 0;
+  return true;
+}
+
+PubSubClient::inflight_t* PubSubClient::_find_inflight(uint16_t pid) {
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    if ((_inflight[i].awaiting != MQTT::None) && (_inflight[i].packet_id == pid))
+      return &_inflight[i];
+
+  return nullptr;
+}
+
+bool PubSubClient::_publish_inflight(MQTT::Publish &pub) {
+  if (_inflight_count >= _inflight_window) {
+    // Takes acknowledgements that have already arrived, a full window is not waited for
+    if (!loop() || (_inflight_count >= _inflight_window))
+      return false;
+  }
+
+  inflight_t *entry = &_inflight[0];
+  while (entry->awaiting != MQTT::None)
+    entry++;
+
+  pub.set_packet_id(_next_packet_id());
+
+  uint8_t head[MQTT_HEADER_BUFFER];
+  uint32_t head_length = pub.write_head(head, sizeof(head));
+  if (head_length == 0)
+    return false;
+
+  entry->length = head_length + pub.payload_len();
+  entry->packet = (uint8_t*)malloc(entry->length);
+  if (entry->packet == nullptr)
+    return false;
+
+  memcpy(entry->packet, head, head_length);
+  if (pub.payload_len() > 0)
+    memcpy(entry->packet + head_length, pub.payload(), pub.payload_len());
+
+  entry->awaiting = pub.qos() == 1 ? MQTT::PUBACK : MQTT::PUBREC;
+  entry->packet_id = pub.packet_id();
+  entry->retries = 0;
+  _inflight_count++;
+
+  // A failed send is retried by _check_inflight() or after reconnecting
+  _send_inflight(*entry);
+  return true;
+}
+
+bool PubSubClient::_send_inflight(inflight_t &entry) {
+  entry.sent = millis();
+
+  if ((_queue_used > 0) && !_flush_queue())
+    return false;
+
+  if (entry.awaiting == MQTT::PUBCOMP) {
+    MQTT::PublishRel pubrel(entry.packet_id);
+    return _send_message(pubrel);
+  }
+
+  uint32_t sent = _client.write(const_cast<const uint8_t*>(entry.packet), entry.length);
+  entry.packet[0] |= 0x08;	// DUP from now on
+  if (sent != entry.length)
+    return false;
+
+  lastOutActivity = millis();
+  return true;
+}
+
+void PubSubClient::_ack_inflight(MQTT::message_type type, uint16_t pid) {
+  inflight_t *entry = _find_inflight(pid);
+  if ((entry == nullptr) || (entry->awaiting != type))
+    return;
+
+  if (type == MQTT::PUBREC) {
+    // The broker owns the message now, only the release is left
+    free(entry->packet);
+    entry->packet = nullptr;
+    entry->awaiting = MQTT::PUBCOMP;
+    entry->retries = 0;
+    _send_inflight(*entry);
+    return;
+  }
+
+  _complete_inflight(*entry, true);
+}
+
+void PubSubClient::_complete_inflight(inflight_t &entry, bool delivered) {
+  uint16_t pid = entry.packet_id;
+  free(entry.packet);
+  entry.packet = nullptr;
+  entry.awaiting = MQTT::None;
+  _inflight_count--;
+
+  if (_delivery_callback)
+    _delivery_callback(pid, delivered);
+}
+
+const uint8_t* PubSubClient::inflight_packet(uint8_t index, uint32_t &length) const {
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (_inflight[i].packet == nullptr)
+      continue;
+    if (index-- > 0)
+      continue;
+    length = _inflight[i].length;
+    return _inflight[i].packet;
+  }
+
+  return nullptr;
+}
+
+bool PubSubClient::restore_inflight(const uint8_t *packet, uint32_t length) {
+  if ((length < 2) || ((packet[0] >> 4) != MQTT::PUBLISH))
+    return false;
+
+  uint8_t qos = (packet[0] >> 1) & 0x03;
+  if ((qos == 0) || (qos == 3))
+    return false;
+
+  // Skip the remaining length, then the topic, to get at the packet id
+  uint32_t pos = 1;
+  while ((pos < length) && (packet[pos] & 0x80))
+    pos++;
+  pos++;
+  if (pos + 2 > length)
+    return false;
+  pos += 2 + ((packet[pos] << 8) | packet[pos + 1]);
+  if (pos + 2 > length)
+    return false;
+  uint16_t pid = (packet[pos] << 8) | packet[pos + 1];
+  if ((pid == 0) || (_find_inflight(pid) != nullptr))
+    return false;
+
+  inflight_t *entry = nullptr;
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    if (_inflight[i].awaiting == MQTT::None) {
+      entry = &_inflight[i];
+      break;
+    }
+  if (entry == nullptr)
+    return false;
+
+  entry->packet = (uint8_t*)malloc(length);
+  if (entry->packet == nullptr)
+    return false;
+
+  memcpy(entry->packet, packet, length);
+  entry->packet[0] |= 0x08;	// Has been sent before the reboot
+  entry->length = length;
+  entry->awaiting = qos == 1 ? MQTT::PUBACK : MQTT::PUBREC;
+  entry->packet_id = pid;
+  entry->retries = 0;
+  entry->sent = millis() - _retransmit_timeout;
+  _inflight_count++;
+  return true;
+}
+
+void PubSubClient::_check_inflight(void) {
+  unsigned long t = millis();
+  for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    inflight_t &entry = _inflight[i];
+    if ((entry.awaiting == MQTT::None) || (t - entry.sent < _retransmit_timeout))
+      continue;
+
+    if (entry.retries >= _max_retries) {
+      _complete_inflight(entry, false);
+      continue;
+    }
+    entry.retries++;
+    if (!_send_inflight(entry))
+      return;
+  }
+}
+
 bool PubSubClient::connect(String id) {
   MQTT::Connect conn(id);
   return connect(conn);
@@ -237,7 +523,9 @@ bool PubSubClient::connect(MQTT::Connect &conn) {
   }
 
   pingOutstanding = false;
-  nextMsgId = 1;		// Init the next packet id
+  if (conn.clean_session())
+    nextMsgId = 1;		// Init the next packet id, a persistent session continues them
+  _session_present = false;
   lastInActivity = millis();	// Init this so that _wait_for() doesn't think we've already timed-out
   keepalive = conn.keepalive();	// Store the keepalive period from this connection
 
@@ -253,10 +541,18 @@ bool PubSubClient::connect(MQTT::Connect &conn) {
     if (ack->rc() > 0) {
       _client.stop();
       ret = false;
-    }
+    } else
+      _session_present = ack->session_present();
   }
   delete response;
 
+  // Messages interrupted by the disconnect go out again right away
+  if (ret && (_inflight_count > 0)) {
+    for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+      if (_inflight[i].awaiting != MQTT::None)
+	_inflight[i].sent = millis() - _retransmit_timeout;
+  }
+
   return ret;
 }
 
@@ -278,6 +574,9 @@ bool PubSubClient::loop() {
       pingOutstanding = true;
     }
   }
+  if ((_queue_used > 0) && !_flush_queue())
+    return false;
+
   if (_client.available()) {
     // Read the packet and check it
     MQTT::Message *msg = _recv_message();
@@ -286,6 +585,10 @@ bool PubSubClient::loop() {
       delete msg;
     }
   }
+
+  if (_inflight_count > 0)
+    _check_inflight();
+
   return true;
 }
 
@@ -306,6 +609,15 @@ bool PubSubClient::publish(String topic, const uint8_t* payload, uint32_t plengt
   return publish(pub);
 }
 
+bool PubSubClient::publish(const char *topic, const uint8_t* payload, uint32_t plength, bool retained) {
+  if (!connected())
+    return false;
+
+  MQTT::Publish pub(topic, strlen(topic), payload, plength);
+  pub.set_retain(retained);
+  return publish(pub);
+}
+
 bool PubSubClient::publish(String topic, MQTT::payload_callback_t pcb, uint32_t length, bool retained) {
   if (!connected())
     return false;
@@ -328,6 +640,9 @@ bool PubSubClient::publish(MQTT::Publish &pub) {
   if (!connected())
     return false;
 
+  if ((pub.qos() > 0) && (_inflight_window > 0) && !pub.has_stream() && (pub._payload_callback == nullptr))
+    return _publish_inflight(pub);
+
   MQTT::Message *response;
   switch (pub.qos()) {
   case 0:
@@ -361,6 +676,58 @@ bool PubSubClient::publish(MQTT::Publish &pub) {
   return false;
 }
 
+bool PubSubClient::queue(MQTT::Publish &pub) {
+  if (!connected())
+    return false;
+
+  if ((_queue == nullptr) || (pub.qos() > 0) || pub.has_stream() || (pub._payload_callback != nullptr))
+    return publish(pub);
+
+  uint8_t head[MQTT_HEADER_BUFFER];
+  uint32_t head_length = pub.write_head(head, sizeof(head));
+  uint32_t length = head_length + pub.payload_len();
+  if ((head_length == 0) || (length > _queue_size))
+    return publish(pub);
+
+  if (length > _queue_size - _queue_used) {
+    switch (_queue_policy) {
+    case QUEUE_BLOCK:
+      if (!_flush_queue())
+	return false;
+      break;
+
+    case QUEUE_DROP_OLDEST:
+      while (length > _queue_size - _queue_used) {
+	uint32_t oldest = _queued_packet_length(_queue_tail);
+	_queue_tail = (_queue_tail + oldest) % _queue_size;
+	_queue_used -= oldest;
+	_queue_dropped++;
+      }
+      break;
+
+    case QUEUE_DROP_NEWEST:
+      _queue_dropped++;
+      return false;
+    }
+  }
+
+  _queue_append(head, head_length);
+  _queue_append(pub.payload(), pub.payload_len());
+  return true;
+}
+
+bool PubSubClient::queue(String topic, const uint8_t* payload, uint32_t plength, bool retained) {
+  MQTT::Publish pub(topic, const_cast<uint8_t*>(payload), plength);
+  pub.set_retain(retained);
+  return queue(pub);
+}
+
+bool PubSubClient::queue(const char *topic, const uint8_t* payload, uint32_t plength, bool retained) {
+  MQTT::Publish pub(topic, strlen(topic), payload, plength);
+  pub.set_retain(retained);
+  return queue(pub);
+}
+
 bool PubSubClient::subscribe(String topic, uint8_t qos) {
   if (!connected())
     return false;
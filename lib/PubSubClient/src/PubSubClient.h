@@ -9,7 +9,7 @@
 
 #pragma GCC diagnostic warning "-Wreorder"
 #pragma GCC diagnostic warning "-Wswitch"
-#pragma GCC diagnostic warning "-Wformat="
+#pragma GCC diagnostic warning "-Wformat"
 #pragma GCC diagnostic warning "-Wunused-value"
 #pragma GCC diagnostic warning "-Wunused-variable"
 #pragma GCC diagnostic warning "-Wwrite-strings"
@@ -22,6 +22,17 @@
 #include <Arduino.h>
 
 #include "MQTT.h"
+#include "TopicRouter.h"
+
+// Capacity of the table of QoS 1/2 messages awaiting acknowledgement
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 8
+#endif
+
+// ms before an unacknowledged message is sent again
+#ifndef MQTT_RETRANSMIT_TIMEOUT
+#define MQTT_RETRANSMIT_TIMEOUT 5000
+#endif
 
 //! Main do-everything class that sketches will use
 class PubSubClient {
@@ -32,17 +43,56 @@ public:
   typedef void(*callback_t)(const MQTT::Publish&);
 #endif
 
+#ifdef _GLIBCXX_FUNCTIONAL
+  typedef std::function<void(uint16_t, bool)> delivery_callback_t;
+#else
+  typedef void(*delivery_callback_t)(uint16_t, bool);
+#endif
+
+  //! What queue() does when a message doesn't fit into the outbound queue
+  enum queue_policy {
+    QUEUE_BLOCK,	// Flush the queue to the network first
+    QUEUE_DROP_OLDEST,	// Discard queued messages that were not sent yet
+    QUEUE_DROP_NEWEST	// Reject the new message
+  };
+
 private:
 
    bool pingOutstanding;
 
    callback_t _callback;
+   MQTT::TopicRouter *_router;
 
    Client &_client;
    MQTT::PacketParser _parser;
    uint8_t _max_retries;
    bool isSubAckFound;
 
+   uint8_t *_send_buffer;
+   uint32_t _send_buffer_len;
+
+   // Outbound ring of encoded QoS 0 PUBLISH packets, always starting at a packet boundary
+   uint8_t *_queue;
+   uint32_t _queue_size, _queue_head, _queue_tail, _queue_used;
+   queue_policy _queue_policy;
+   uint32_t _queue_dropped;
+
+   //! QoS 1/2 message sent with the in-flight window and not acknowledged yet
+   struct inflight_t {
+     MQTT::message_type awaiting;	// PUBACK, PUBREC or PUBCOMP; None if the slot is free
+     uint16_t packet_id;
+     uint8_t retries;
+     uint8_t *packet;			// Encoded PUBLISH for retransmission, freed on PUBREC
+     uint32_t length;
+     unsigned long sent;
+   };
+
+   inflight_t _inflight[MQTT_MAX_INFLIGHT];
+   uint8_t _inflight_window, _inflight_count;
+   unsigned long _retransmit_timeout;
+   delivery_callback_t _delivery_callback;
+   bool _session_present;
+
    IPAddress server_ip;
    uint16_t server_port;
    String server_hostname;
@@ -73,7 +123,7 @@ private:
 
    //! Process incoming messages
    /*!
-     - Calls the callback function when a PUBLISH message comes in
+     - Calls the router, or the callback function if no route matches, when a PUBLISH message comes in
      - Handles the handshake for PUBLISH when qos > 0
      - Handles ping requests and responses
      \param msg Message to process
@@ -89,13 +139,46 @@ private:
     */
    MQTT::Message*_wait_for(MQTT::message_type wait_type, uint16_t wait_pid = 0);
 
-   //! Return the next packet id
+   //! Length of the queued packet starting at a ring position
+   uint32_t _queued_packet_length(uint32_t pos) const;
+
+   //! Copy bytes into the ring at its head
+   void _queue_append(const uint8_t *data, uint32_t len);
+
+   //! Write all queued packets to the client
+   /*!
+     Contiguous packets go out in one write(), or two when the ring wraps.
+     \return false if the client didn't accept everything
+    */
+   bool _flush_queue(void);
+
+   //! Return the next packet id not used by an in-flight message
    uint16_t _next_packet_id(void) {
-     nextMsgId++;
-     if (nextMsgId == 0) nextMsgId = 1;
+     do {
+       nextMsgId++;
+       if (nextMsgId == 0) nextMsgId = 1;
+     } while (_find_inflight(nextMsgId) != nullptr);
      return nextMsgId;
    }
 
+   //! Find the in-flight entry for a packet id
+   inflight_t* _find_inflight(uint16_t pid);
+
+   //! Send a message through the in-flight window without waiting for its acknowledgement
+   bool _publish_inflight(MQTT::Publish &pub);
+
+   //! (Re)send the stored PUBLISH, or the PUBREL once PUBREC has arrived
+   bool _send_inflight(inflight_t &entry);
+
+   //! Handle PUBACK, PUBREC and PUBCOMP for in-flight messages
+   void _ack_inflight(MQTT::message_type type, uint16_t pid);
+
+   //! Release an in-flight entry and report the outcome
+   void _complete_inflight(inflight_t &entry, bool delivered);
+
+   //! Retransmit entries whose acknowledgement timed out
+   void _check_inflight(void);
+
 public:
    //! Simple constructor
    /*!
@@ -108,6 +191,9 @@ public:
    //! Constructors with the host name
    PubSubClient(Client& c, String hostname, uint16_t port = 1883);
 
+   //! Destructor, frees messages still in flight
+   ~PubSubClient();
+
    //! Set the server ip address
    PubSubClient& set_server(IPAddress &ip, uint16_t port = 1883);
    //! Set the server host name
@@ -120,9 +206,102 @@ public:
    //! Unset the callback function
    PubSubClient& unset_callback(void) { _callback = nullptr; return * this; }
 
+   //! Set a router that dispatches incoming messages by topic
+   /*!
+     Messages not matched by any of its filters go to the callback function.
+     The router must outlive the client.
+   */
+   PubSubClient& set_router(MQTT::TopicRouter &router) { _router = &router; return *this; }
+   //! Unset the router
+   PubSubClient& unset_router(void) { _router = nullptr; return *this; }
+
    //! Set the maximum number of retries when waiting for response packets
    PubSubClient& set_max_retries(uint8_t mr) { _max_retries = mr; return *this; }
 
+   //! Set a scratch buffer for outgoing packets
+   /*!
+     Packets that fit are assembled in it and handed to the client in one
+     write(), which saves a TLS record per packet. Larger packets are sent
+     as headers followed by the payload. The buffer must outlive the client.
+     \param buf Buffer to use, nullptr to disable
+     \param len Size of the buffer in bytes
+   */
+   PubSubClient& set_send_buffer(uint8_t *buf, uint32_t len) { _send_buffer = buf; _send_buffer_len = buf ? len : 0; return *this; }
+
+   //! Set the memory used to queue outgoing messages
+   /*!
+     Messages passed to queue() are encoded into this ring and sent by loop().
+     The buffer must outlive the client.
+     \param buf Buffer to use, nullptr to disable queueing
+     \param len Size of the buffer in bytes
+     \param policy What to do when the queue is full
+   */
+   PubSubClient& set_queue(uint8_t *buf, uint32_t len, queue_policy policy = QUEUE_BLOCK);
+
+   //! Set the number of QoS 1/2 messages that may await acknowledgement at once
+   /*!
+     With a window of 0 (the default) publish() waits for every acknowledgement.
+     Otherwise publish() returns as soon as the message is sent, acknowledgements
+     are processed by loop() and unacknowledged messages are resent with the DUP
+     flag after set_retransmit_timeout(). While the window is full publish() returns
+     false, the caller tries again after loop() has processed acknowledgements.
+     \param window Number of messages, at most MQTT_MAX_INFLIGHT
+   */
+   PubSubClient& set_inflight_window(uint8_t window) { _inflight_window = window > MQTT_MAX_INFLIGHT ? MQTT_MAX_INFLIGHT : window; return *this; }
+
+   //! Set the time after which unacknowledged messages are sent again
+   PubSubClient& set_retransmit_timeout(unsigned long ms) { _retransmit_timeout = ms; return *this; }
+
+   //! Set the function called when an in-flight message is acknowledged or given up
+   /*!
+     Called with the packet id of the message (see MQTT::Publish::packet_id())
+     and whether the broker has acknowledged it. Messages are given up after
+     set_max_retries() retransmissions.
+   */
+   PubSubClient& set_delivery_callback(delivery_callback_t cb) { _delivery_callback = cb; return *this; }
+
+   //! Number of QoS 1/2 messages awaiting acknowledgement
+   uint8_t inflight(void) const { return _inflight_count; }
+
+   //! Get an encoded QoS 1/2 PUBLISH that has not been acknowledged yet
+   /*!
+     Together with next_packet_id() this is the client side of a persistent
+     session, to be saved before a reboot or deep sleep and restored with
+     restore_inflight() and set_next_packet_id() before connecting.
+     \param index Which of the messages, from 0
+     \return Pointer to the packet, nullptr if there are no more
+   */
+   const uint8_t* inflight_packet(uint8_t index, uint32_t &length) const;
+
+   //! Resume an unacknowledged message saved with inflight_packet()
+   /*!
+     The message is sent again with the DUP flag once connected.
+     \return false if the packet is invalid, its id is in use or the slots are full
+   */
+   bool restore_inflight(const uint8_t *packet, uint32_t length);
+
+   //! The packet id counter, the next message gets the following id
+   uint16_t next_packet_id(void) const { return nextMsgId; }
+
+   //! Continue the packet ids of a persistent session
+   PubSubClient& set_next_packet_id(uint16_t id) { nextMsgId = id; return *this; }
+
+   //! Whether the server resumed the session on the last connect
+   /*!
+     Only possible when connecting with the clean session flag unset;
+     subscriptions of a present session are still active.
+   */
+   bool session_present(void) const { return _session_present; }
+
+   //! Set the full-queue policy
+   PubSubClient& set_queue_policy(queue_policy policy) { _queue_policy = policy; return *this; }
+
+   //! Bytes waiting in the outbound queue
+   uint32_t queued(void) const { return _queue_used; }
+
+   //! Number of messages dropped because the queue was full
+   uint32_t queue_dropped(void) const { return _queue_dropped; }
+
    //! Connect to the server with a client id
    /*!
      \param id Client id for this device
@@ -162,6 +341,15 @@ public:
     */
    bool publish(String topic, const uint8_t *payload, uint32_t plength, bool retained = false);
 
+   //! Publish an arbitrary data payload without copying the topic
+   /*!
+     \param topic Zero-terminated topic of the message
+     \param payload Pointer to contents of the message
+     \param plength Length of the message (pointed to by payload) in bytes
+     \param retained If true, this message will be stored on the server
+    */
+   bool publish(const char *topic, const uint8_t *payload, uint32_t plength, bool retained = false);
+
    //! Publish an arbitrary data payload from a callback
    /*!
      \param topic Topic of this message
@@ -181,6 +369,27 @@ public:
    */
    bool publish_P(String topic, PGM_P payload, uint32_t plength, bool retained = false);
 
+   //! Queue a message to be sent by loop()
+   /*!
+     Only QoS 0 messages with an in-memory payload are queued, others and
+     messages larger than the queue are published immediately (after the
+     queue has been flushed, so ordering is kept).
+     \return false if the message was dropped or could not be sent
+    */
+   bool queue(MQTT::Publish &pub);
+
+   //! Queue an arbitrary data payload
+   /*!
+     \param topic Topic of the message
+     \param payload Pointer to contents of the message, copied into the queue
+     \param plength Length of the message (pointed to by payload) in bytes
+     \param retained If true, this message will be stored on the server
+    */
+   bool queue(String topic, const uint8_t *payload, uint32_t plength, bool retained = false);
+
+   //! Queue an arbitrary data payload without copying the topic
+   bool queue(const char *topic, const uint8_t *payload, uint32_t plength, bool retained = false);
+
    //! Subscribe to a topic
    /*!
      \param topic Topic filter
@@ -193,7 +402,7 @@ public:
 
    //! Wait for packets to come in, processing them
    /*!
-     Also periodically pings the server
+     Also periodically pings the server and sends queued messages
    */
    bool loop();
 
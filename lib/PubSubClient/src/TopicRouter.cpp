@@ -0,0 +1,220 @@
+/*
+ TopicRouter.cpp - Dispatch of incoming messages by topic filter
+*/
+
+#include <Arduino.h>
+#include "TopicRouter.h"
+
+#pragma GCC diagnostic warning "-Wreorder"
+#pragma GCC diagnostic warning "-Wunused-value"
+#pragma GCC diagnostic warning "-Wunused-variable"
+#pragma GCC diagnostic warning "-Wwrite-strings"
+#pragma GCC diagnostic warning "-Wreturn-type"
+
+namespace MQTT {
+
+  TopicRouter::TopicRouter() :
+    _node_count(0),
+    _route_count(0),
+    _pool_used(0)
+  {
+    clear();
+  }
+
+  void TopicRouter::clear(void) {
+    _nodes[0].child = 0;
+    _nodes[0].sibling = 0;
+    _nodes[0].route = -1;
+    _node_count = 1;
+    for (uint8_t i = 0; i < _route_count; i++)
+      _routes[i].handler = nullptr;
+    _route_count = 0;
+    _pool_used = 0;
+  }
+
+  uint8_t TopicRouter::_child(uint8_t parent, const char *level, uint8_t length, bool create) {
+    for (uint8_t n = _nodes[parent].child; n; n = _nodes[n].sibling)
+      if ((_nodes[n].length == length) && (memcmp(_pool + _nodes[n].segment, level, length) == 0))
+	return n;
+
+    if (!create || (_node_count >= MQTT_ROUTER_NODES) || (_pool_used + length > MQTT_ROUTER_POOL))
+      return 0;
+
+    uint8_t n = _node_count++;
+    memcpy(_pool + _pool_used, level, length);
+    _nodes[n].segment = _pool_used;
+    _nodes[n].length = length;
+    _nodes[n].child = 0;
+    _nodes[n].route = -1;
+    _pool_used += length;
+
+    _nodes[n].sibling = _nodes[parent].child;
+    _nodes[parent].child = n;
+    return n;
+  }
+
+  uint8_t TopicRouter::_node(const char *filter, bool create) {
+    // '#' must be the last level and wildcards must fill a whole level
+    for (const char *c = filter; *c; c++) {
+      if ((*c != '+') && (*c != '#'))
+	continue;
+      if ((c > filter) && (c[-1] != '/'))
+	return 0;
+      if ((c[1] != 0) && ((*c == '#') || (c[1] != '/')))
+	return 0;
+    }
+
+    uint8_t n = 0;
+    const char *level = filter;
+    while (true) {
+      const char *level_end = strchr(level, '/');
+      if (level_end == nullptr)
+	level_end = level + strlen(level);
+      if (level_end - level > 255)
+	return 0;
+
+      n = _child(n, level, level_end - level, create);
+      if (n == 0)
+	return 0;
+
+      if (*level_end == 0)
+	break;
+      level = level_end + 1;
+    }
+    return n;
+  }
+
+  int8_t TopicRouter::add(const char *filter, handler_t handler) {
+    uint8_t n = _node(filter, true);
+    if (n == 0)
+      return -1;
+
+    if (_nodes[n].route < 0) {
+      if (_route_count >= MQTT_MAX_ROUTES)
+	return -1;
+      _nodes[n].route = _route_count++;
+    }
+
+    route_t &route = _routes[_nodes[n].route];
+    route.handler = handler;
+    route.dispatches = 0;
+    route.time_us = 0;
+    return _nodes[n].route;
+  }
+
+  int16_t TopicRouter::_filter(const node_t *nodes, const char *pool, uint8_t parent, int8_t route, char *buffer, int16_t length) {
+    for (uint8_t n = nodes[parent].child; n; n = nodes[n].sibling) {
+      int16_t l = length;
+      if (parent != 0)
+	buffer[l++] = '/';
+      memcpy(buffer + l, pool + nodes[n].segment, nodes[n].length);
+      l += nodes[n].length;
+
+      if (nodes[n].route == route) {
+	buffer[l] = 0;
+	return l;
+      }
+      int16_t found = _filter(nodes, pool, n, route, buffer, l);
+      if (found >= 0)
+	return found;
+    }
+    return -1;
+  }
+
+  bool TopicRouter::remove(const char *filter) {
+    uint8_t n = _node(filter, false);
+    if ((n == 0) || (_nodes[n].route < 0))
+      return false;
+    int8_t removed = _nodes[n].route;
+
+    // Filters are read back from a copy of the trie and inserted again in route order
+    node_t nodes[MQTT_ROUTER_NODES];
+    char pool[MQTT_ROUTER_POOL];
+    char buffer[MQTT_ROUTER_POOL + MQTT_ROUTER_NODES];
+    memcpy(nodes, _nodes, sizeof(nodes));
+    memcpy(pool, _pool, _pool_used);
+    uint8_t count = _route_count;
+
+    _nodes[0].child = 0;
+    _node_count = 1;
+    _pool_used = 0;
+    _route_count = 0;
+    for (int8_t r = 0; r < count; r++) {
+      if (r == removed)
+	continue;
+      if (_filter(nodes, pool, 0, r, buffer, 0) < 0)
+	continue;
+      n = _node(buffer, true); // fits, the trie held it before
+      _nodes[n].route = _route_count;
+      if (r != _route_count)
+	_routes[_route_count] = _routes[r];
+      _route_count++;
+    }
+    for (uint8_t r = _route_count; r < count; r++)
+      _routes[r].handler = nullptr;
+    return true;
+  }
+
+  uint8_t TopicRouter::_call(int8_t route, const Publish& pub) {
+    if ((route < 0) || !_routes[route].handler)
+      return 0;
+
+    unsigned long start = micros();
+    _routes[route].handler(pub);
+    _routes[route].time_us += micros() - start;
+    _routes[route].dispatches++;
+    return 1;
+  }
+
+  uint8_t TopicRouter::_match(uint8_t parent, const char *level, const char *end, const Publish& pub) {
+    const char *level_end = level;
+    while ((level_end < end) && (*level_end != '/'))
+      level_end++;
+    bool last = level_end == end;
+
+    // Wildcards don't match topics starting with '$'
+    bool wildcards = (parent != 0) || (level == end) || (*level != '$');
+
+    uint8_t calls = 0;
+    for (uint8_t n = _nodes[parent].child; n; n = _nodes[n].sibling) {
+      const node_t &node = _nodes[n];
+      const char *segment = _pool + node.segment;
+
+      if ((node.length == 1) && (*segment == '#')) {
+	if (wildcards)
+	  calls += _call(node.route, pub);
+	continue;
+      }
+
+      if ((node.length == 1) && (*segment == '+')) {
+	if (!wildcards)
+	  continue;
+      } else if ((node.length != level_end - level) || (memcmp(segment, level, node.length) != 0)) {
+	continue;
+      }
+
+      if (!last) {
+	calls += _match(n, level_end + 1, end, pub);
+	continue;
+      }
+
+      calls += _call(node.route, pub);
+
+      // "a/#" also matches "a"
+      for (uint8_t c = node.child; c; c = _nodes[c].sibling)
+	if ((_nodes[c].length == 1) && (_pool[_nodes[c].segment] == '#'))
+	  calls += _call(_nodes[c].route, pub);
+    }
+
+    return calls;
+  }
+
+  uint8_t TopicRouter::dispatch(const Publish& pub) {
+    if (_route_count == 0)
+      return 0;
+
+    const char *topic = pub.topic_ptr();
+    return _match(0, topic, topic + pub.topic_length(), pub);
+  }
+
+}
@@ -0,0 +1,139 @@
+/*
+ TopicRouter.h - Dispatch of incoming messages by topic filter
+*/
+
+#pragma once
+
+#pragma GCC diagnostic warning "-Wreorder"
+#pragma GCC diagnostic warning "-Wunused-value"
+#pragma GCC diagnostic warning "-Wunused-variable"
+#pragma GCC diagnostic warning "-Wwrite-strings"
+
+#include <stdint.h>
+#if defined(ESP8266) || defined(ESP32)
+#include <functional>
+#endif
+
+#include "MQTT.h"
+
+// Number of topic filters that can be registered
+#ifndef MQTT_MAX_ROUTES
+#define MQTT_MAX_ROUTES 8
+#endif
+
+// Trie nodes, one per distinct topic level across all filters
+#ifndef MQTT_ROUTER_NODES
+#define MQTT_ROUTER_NODES 24
+#endif
+
+// Bytes of topic level names stored by the trie
+#ifndef MQTT_ROUTER_POOL
+#define MQTT_ROUTER_POOL 256
+#endif
+
+namespace MQTT {
+
+  //! Routes incoming messages to handlers registered for topic filters
+  /*!
+    Filters may contain the '+' (one level) and '#' (all remaining levels)
+    wildcards. They are kept in a trie of topic levels, so a message is
+    matched by walking its topic once, regardless of the number of filters.
+    All storage is fixed-size, sized by MQTT_MAX_ROUTES, MQTT_ROUTER_NODES
+    and MQTT_ROUTER_POOL.
+  */
+  class TopicRouter {
+  public:
+#ifdef _GLIBCXX_FUNCTIONAL
+    typedef std::function<void(const Publish&)> handler_t;
+#else
+    typedef void(*handler_t)(const Publish&);
+#endif
+
+  private:
+    struct node_t {
+      uint16_t segment;		// Offset of the level name in _pool
+      uint8_t length;		// Length of the level name
+      uint8_t child, sibling;	// Node indexes, 0 is the root and means none
+      int8_t route;		// Route ending at this level, -1 if none
+    };
+
+    struct route_t {
+      handler_t handler;
+      uint32_t dispatches;
+      uint32_t time_us;
+    };
+
+    node_t _nodes[MQTT_ROUTER_NODES];
+    uint8_t _node_count;
+    route_t _routes[MQTT_MAX_ROUTES];
+    uint8_t _route_count;
+    char _pool[MQTT_ROUTER_POOL];
+    uint16_t _pool_used;
+
+    //! Find or create the child of a node for a topic level
+    /*!
+      \return Node index, 0 if out of nodes or pool space
+    */
+    uint8_t _child(uint8_t parent, const char *level, uint8_t length, bool create = true);
+
+    //! Find the node of a topic filter
+    /*!
+      \return Node index, 0 if the filter is invalid or not registered (or out of space when creating)
+    */
+    uint8_t _node(const char *filter, bool create);
+
+    //! Write the filter of a route, searching below a node of a saved trie
+    /*!
+      \return Length of the filter, -1 if the route is not below the node
+    */
+    static int16_t _filter(const node_t *nodes, const char *pool, uint8_t parent, int8_t route, char *buffer, int16_t length);
+
+    //! Match the remaining topic levels below a node
+    uint8_t _match(uint8_t parent, const char *level, const char *end, const Publish& pub);
+
+    //! Call the handler of a route and account for it
+    uint8_t _call(int8_t route, const Publish& pub);
+
+  public:
+    //! Constructor for an empty router
+    TopicRouter();
+
+    //! Register a handler for a topic filter
+    /*!
+      Registering the same filter again replaces its handler.
+      The filter is copied, it need not stay valid.
+      \param filter Topic filter, e.g. "/owner/+/status" or "sensors/#"
+      \param handler Function called for every matching message
+      \return Route index for the statistics, -1 if the filter is invalid or the router is full
+    */
+    int8_t add(const char *filter, handler_t handler);
+
+    //! Remove the route of a topic filter
+    /*!
+      The trie is rebuilt without it, so its nodes and pool space are reused.
+      Routes registered after it move down by one index.
+      \return false if the filter has no route
+    */
+    bool remove(const char *filter);
+
+    //! Remove all routes
+    void clear(void);
+
+    //! Call the handlers of all filters matching the topic of a message
+    /*!
+      A streamed message can only be read by the first handler.
+      \return Number of handlers called
+    */
+    uint8_t dispatch(const Publish& pub);
+
+    //! Number of registered routes
+    uint8_t size(void) const { return _route_count; }
+
+    //! Number of messages passed to a route
+    uint32_t dispatches(uint8_t route) const { return route < _route_count ? _routes[route].dispatches : 0; }
+
+    //! Total time spent in the handler of a route, in microseconds
+    uint32_t dispatch_time(uint8_t route) const { return route < _route_count ? _routes[route].time_us : 0; }
+  };
+
+}
@@ -0,0 +1,184 @@
+/**
+ *
+ * @file ESP32DeltaPatch.cpp
+ *
+ * This file is part of the ESP32 Http Updater.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "ESP32DeltaPatch.h"
+
+ESP32DeltaPatch::ESP32DeltaPatch(source_t source, uint32_t sourceSize, target_t target) :
+    _source(source),
+    _sourceSize(sourceSize),
+    _target(target),
+    _targetSize(0),
+    _patchRemaining(0),
+    _error(DELTA_OK)
+{
+}
+
+/**
+ * read exactly length bytes of patch
+ */
+bool ESP32DeltaPatch::read(Stream& patch, uint8_t *data, size_t length)
+{
+    if(length > _patchRemaining) {
+        _error = DELTA_SHORT_PATCH;
+        return false;
+    }
+    if(patch.readBytes(data, length) != length) {
+        _error = DELTA_SHORT_PATCH;
+        return false;
+    }
+    _patchRemaining -= length;
+    return true;
+}
+
+/**
+ * 8-byte little endian sign-magnitude integer (bsdiff offtin)
+ */
+bool ESP32DeltaPatch::readOffset(Stream& patch, int64_t &value)
+{
+    uint8_t buf[8];
+    if(!read(patch, buf, sizeof(buf))) {
+        return false;
+    }
+    value = buf[7] & 0x7F;
+    for(int i = 6; i >= 0; i--) {
+        value = value * 256 + buf[i];
+    }
+    if(buf[7] & 0x80) {
+        value = -value;
+    }
+    return true;
+}
+
+uint32_t ESP32DeltaPatch::begin(Stream& patch)
+{
+    uint8_t header[DELTA_PATCH_HEADER_SIZE - 8];
+    int64_t size;
+
+    _patchRemaining = DELTA_PATCH_HEADER_SIZE;
+    if(!read(patch, header, sizeof(header)) || memcmp(header, DELTA_PATCH_MAGIC, sizeof(header)) != 0) {
+        _error = DELTA_BAD_HEADER;
+        return 0;
+    }
+    if(!readOffset(patch, size) || size <= 0 || size > 0xFFFFFFFFLL) {
+        _error = DELTA_BAD_HEADER;
+        return 0;
+    }
+
+    _targetSize = size;
+    return _targetSize;
+}
+
+/**
+ * new = patch + old, byte by byte; old bytes outside of the image count as 0 like in bspatch
+ */
+bool ESP32DeltaPatch::diff(Stream& patch, int64_t oldPos, uint32_t length)
+{
+    uint8_t data[DELTA_PATCH_WINDOW];
+    uint8_t old[DELTA_PATCH_WINDOW];
+
+    while(length > 0) {
+        size_t n = length < sizeof(data) ? length : sizeof(data);
+        if(!read(patch, data, n)) {
+            return false;
+        }
+
+        // part of the window that lies within the old image
+        int64_t from = oldPos < 0 ? 0 : oldPos;
+        int64_t to = oldPos + (int64_t) n;
+        if(to > _sourceSize) {
+            to = _sourceSize;
+        }
+        if(from < to) {
+            size_t skip = from - oldPos;
+            if(!_source(from, old, to - from)) {
+                _error = DELTA_SOURCE_READ;
+                return false;
+            }
+            for(size_t i = 0; i < (size_t)(to - from); i++) {
+                data[skip + i] += old[i];
+            }
+        }
+
+        if(_target(data, n) != n) {
+            _error = DELTA_TARGET_WRITE;
+            return false;
+        }
+        oldPos += n;
+        length -= n;
+        yield();
+    }
+    return true;
+}
+
+bool ESP32DeltaPatch::extra(Stream& patch, uint32_t length)
+{
+    uint8_t data[DELTA_PATCH_WINDOW];
+
+    while(length > 0) {
+        size_t n = length < sizeof(data) ? length : sizeof(data);
+        if(!read(patch, data, n)) {
+            return false;
+        }
+        if(_target(data, n) != n) {
+            _error = DELTA_TARGET_WRITE;
+            return false;
+        }
+        length -= n;
+        yield();
+    }
+    return true;
+}
+
+bool ESP32DeltaPatch::apply(Stream& patch, uint32_t patchSize)
+{
+    if(_targetSize == 0 || patchSize < DELTA_PATCH_HEADER_SIZE) {
+        _error = DELTA_BAD_HEADER;
+        return false;
+    }
+    _patchRemaining = patchSize - DELTA_PATCH_HEADER_SIZE;
+
+    uint32_t newPos = 0;
+    int64_t oldPos = 0;
+
+    while(newPos < _targetSize) {
+        int64_t diffLength, extraLength, seek;
+        if(!readOffset(patch, diffLength) || !readOffset(patch, extraLength) || !readOffset(patch, seek)) {
+            return false;
+        }
+        if(diffLength < 0 || extraLength < 0 || diffLength + extraLength > (int64_t)(_targetSize - newPos)) {
+            _error = DELTA_CORRUPT;
+            return false;
+        }
+
+        if(!diff(patch, oldPos, diffLength)) {
+            return false;
+        }
+        if(!extra(patch, extraLength)) {
+            return false;
+        }
+
+        newPos += diffLength + extraLength;
+        oldPos += diffLength + seek;
+    }
+
+    return true;
+}
@@ -0,0 +1,94 @@
+/**
+ *
+ * @file ESP32DeltaPatch.h
+ *
+ * This file is part of the ESP32 Http Updater.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef ESP32DELTAPATCH_H_
+#define ESP32DELTAPATCH_H_
+
+#include <Arduino.h>
+#include <functional>
+
+/// bytes of patch and old image held in RAM at a time (each)
+#ifndef DELTA_PATCH_WINDOW
+#define DELTA_PATCH_WINDOW 256
+#endif
+
+#define DELTA_PATCH_MAGIC "ENDSLEY/BSDIFF43"
+#define DELTA_PATCH_HEADER_SIZE 24 // magic and new image size
+
+/**
+ * Streaming bspatch.
+ *
+ * The patch is the uncompressed ENDSLEY/BSDIFF43 format written by bsdiff (github.com/mendsley/bsdiff):
+ * 16 bytes magic, 8 bytes new size, then records of three 8-byte sign-magnitude integers
+ * (diff length, extra length, old seek), diff bytes added to the old image and extra bytes copied.
+ * Records are applied as they arrive, so only DELTA_PATCH_WINDOW bytes of patch and old image are in RAM.
+ * The old image is read through a callback and the new one written through another, which keeps the
+ * patcher independent of flash partitions.
+ */
+class ESP32DeltaPatch
+{
+public:
+    typedef std::function<bool(uint32_t offset, uint8_t *data, size_t length)> source_t; // reads the old image
+    typedef std::function<size_t(uint8_t *data, size_t length)> target_t;                // appends to the new image
+
+    enum error_t {
+        DELTA_OK = 0,
+        DELTA_BAD_HEADER,
+        DELTA_CORRUPT,      // control values out of range
+        DELTA_SHORT_PATCH,  // stream ended early
+        DELTA_SOURCE_READ,
+        DELTA_TARGET_WRITE
+    };
+
+    ESP32DeltaPatch(source_t source, uint32_t sourceSize, target_t target);
+
+    /**
+     * read and validate the header
+     * @return size of the new image, 0 on error
+     */
+    uint32_t begin(Stream& patch);
+
+    /**
+     * apply the records following the header
+     * @param patch Stream positioned after the header
+     * @param patchSize size of the whole patch including header
+     * @return true if the whole new image has been written
+     */
+    bool apply(Stream& patch, uint32_t patchSize);
+
+    error_t getError(void) { return _error; }
+
+protected:
+    source_t _source;
+    uint32_t _sourceSize;
+    target_t _target;
+    uint32_t _targetSize;
+    uint32_t _patchRemaining;
+    error_t _error;
+
+    bool read(Stream& patch, uint8_t *data, size_t length);
+    bool readOffset(Stream& patch, int64_t &value);
+    bool diff(Stream& patch, int64_t oldPos, uint32_t length);
+    bool extra(Stream& patch, uint32_t length);
+};
+
+#endif /* ESP32DELTAPATCH_H_ */
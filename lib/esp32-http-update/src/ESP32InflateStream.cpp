@@ -0,0 +1,228 @@
+/**
+ *
+ * @file ESP32InflateStream.cpp
+ *
+ * This file is part of the ESP32 Http Updater.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "ESP32InflateStream.h"
+
+#define GZIP_FLAG_HCRC    0x02
+#define GZIP_FLAG_EXTRA   0x04
+#define GZIP_FLAG_NAME    0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+ESP32InflateStream::ESP32InflateStream(Stream& in, uint32_t compressedSize, format_t format) :
+    _in(in),
+    _inRemaining(compressedSize),
+    _format(format),
+    _decompressor(NULL),
+    _dict(NULL),
+    _input(NULL),
+    _inputPos(0),
+    _inputLength(0),
+    _dictPos(0),
+    _outPos(0),
+    _outLength(0),
+    _totalOut(0),
+    _done(false),
+    _error(false)
+{
+}
+
+ESP32InflateStream::~ESP32InflateStream()
+{
+    free(_decompressor);
+    free(_dict);
+    free(_input);
+}
+
+bool ESP32InflateStream::begin(void)
+{
+    _decompressor = (tinfl_decompressor *) malloc(sizeof(tinfl_decompressor));
+    _dict = (uint8_t *) malloc(TINFL_LZ_DICT_SIZE);
+    _input = (uint8_t *) malloc(INFLATE_INPUT_BUFFER);
+    if(!_decompressor || !_dict || !_input) {
+        _error = true;
+        return false;
+    }
+    tinfl_init(_decompressor);
+
+    if(_format == INFLATE_GZIP && !skipGzipHeader()) {
+        _error = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * refill the input buffer from the network
+ */
+bool ESP32InflateStream::readInput(void)
+{
+    size_t n = _inRemaining < INFLATE_INPUT_BUFFER ? _inRemaining : INFLATE_INPUT_BUFFER;
+    if(n == 0) {
+        return false;
+    }
+    n = _in.readBytes(_input, n);
+    if(n == 0) {
+        return false; // timeout
+    }
+    _inRemaining -= n;
+    _inputPos = 0;
+    _inputLength = n;
+    return true;
+}
+
+bool ESP32InflateStream::readRaw(uint8_t &value)
+{
+    if(_inputPos == _inputLength && !readInput()) {
+        return false;
+    }
+    value = _input[_inputPos++];
+    return true;
+}
+
+/**
+ * RFC 1952 member header, leaves the input at the deflate data
+ */
+bool ESP32InflateStream::skipGzipHeader(void)
+{
+    uint8_t header[10];
+    for(size_t i = 0; i < sizeof(header); i++) {
+        if(!readRaw(header[i])) {
+            return false;
+        }
+    }
+    if(header[0] != 0x1F || header[1] != 0x8B || header[2] != 8) {
+        return false; // not gzip or not deflate
+    }
+
+    uint8_t flags = header[3];
+    uint8_t c;
+    if(flags & GZIP_FLAG_EXTRA) {
+        uint8_t lo, hi;
+        if(!readRaw(lo) || !readRaw(hi)) {
+            return false;
+        }
+        for(uint16_t n = lo | (hi << 8); n > 0; n--) {
+            if(!readRaw(c)) {
+                return false;
+            }
+        }
+    }
+    if(flags & GZIP_FLAG_NAME) {
+        do {
+            if(!readRaw(c)) {
+                return false;
+            }
+        } while(c != 0);
+    }
+    if(flags & GZIP_FLAG_COMMENT) {
+        do {
+            if(!readRaw(c)) {
+                return false;
+            }
+        } while(c != 0);
+    }
+    if(flags & GZIP_FLAG_HCRC) {
+        if(!readRaw(c) || !readRaw(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * decompress until there is output, the end of the stream or an error
+ * @return true if output is available
+ */
+bool ESP32InflateStream::inflate(void)
+{
+    while(_outLength == 0 && !_done && !_error) {
+        if(_inputPos == _inputLength && _inRemaining > 0 && !readInput()) {
+            _error = true;
+            break;
+        }
+
+        uint32_t flags = 0;
+        if(_inRemaining > 0) {
+            flags |= TINFL_FLAG_HAS_MORE_INPUT;
+        }
+        if(_format == INFLATE_ZLIB) {
+            flags |= TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
+        }
+
+        size_t inBytes = _inputLength - _inputPos;
+        size_t outBytes = TINFL_LZ_DICT_SIZE - _dictPos;
+        tinfl_status status = tinfl_decompress(_decompressor, _input + _inputPos, &inBytes, _dict, _dict + _dictPos, &outBytes, flags);
+
+        _inputPos += inBytes;
+        _outPos = _dictPos;
+        _outLength = outBytes;
+        _dictPos = (_dictPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+        _totalOut += outBytes;
+
+        if(status == TINFL_STATUS_DONE) {
+            _done = true;
+        } else if(status < 0) {
+            _error = true;
+        } else if(status == TINFL_STATUS_NEEDS_MORE_INPUT && _inRemaining == 0 && _inputPos == _inputLength) {
+            _error = true; // truncated
+        }
+        yield();
+    }
+    return _outLength > 0;
+}
+
+int ESP32InflateStream::available(void)
+{
+    inflate();
+    return _outLength;
+}
+
+int ESP32InflateStream::read(void)
+{
+    if(!inflate()) {
+        return -1;
+    }
+    _outLength--;
+    return _dict[_outPos++];
+}
+
+int ESP32InflateStream::peek(void)
+{
+    if(!inflate()) {
+        return -1;
+    }
+    return _dict[_outPos];
+}
+
+size_t ESP32InflateStream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length && inflate()) {
+        size_t n = length - count < _outLength ? length - count : _outLength;
+        memcpy(buffer + count, _dict + _outPos, n);
+        _outPos += n;
+        _outLength -= n;
+        count += n;
+    }
+    return count;
+}
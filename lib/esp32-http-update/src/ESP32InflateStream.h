@@ -0,0 +1,108 @@
+/**
+ *
+ * @file ESP32InflateStream.h
+ *
+ * This file is part of the ESP32 Http Updater.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef ESP32INFLATESTREAM_H_
+#define ESP32INFLATESTREAM_H_
+
+#include <Arduino.h>
+
+#ifdef __has_include
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+#else
+#include "rom/miniz.h"
+#endif
+
+/// bytes of compressed input read from the network at a time
+#ifndef INFLATE_INPUT_BUFFER
+#define INFLATE_INPUT_BUFFER 512
+#endif
+
+/**
+ * Read only Stream returning the decompressed content of another Stream.
+ *
+ * Uses the inflater (tinfl) of the ESP32 ROM, so no decompressor is linked in. Deflate back-references
+ * reach up to 32 kB, which is the bounded window kept in RAM together with the decompressor state
+ * (about 44 kB of heap while updating, freed by the destructor).
+ * Formats are zlib ("deflate" in HTTP, Adler-32 checked by tinfl) and gzip. The gzip trailer is not read,
+ * so ESP32HTTPUpdate only accepts compressed bodies with x-MD5, which Update checks over the decompressed bytes.
+ */
+class ESP32InflateStream : public Stream
+{
+public:
+    enum format_t {
+        INFLATE_ZLIB,
+        INFLATE_GZIP
+    };
+
+    ESP32InflateStream(Stream& in, uint32_t compressedSize, format_t format);
+    ~ESP32InflateStream();
+
+    /**
+     * allocate buffers and read the gzip header
+     * @return false if out of memory or the header is invalid
+     */
+    bool begin(void);
+
+    bool hasError(void) { return _error; }
+    uint32_t totalOut(void) { return _totalOut; }
+
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+        return readBytes((char *) buffer, length);
+    }
+
+    size_t write(uint8_t) override { return 0; }
+    void flush(void) override {}
+
+protected:
+    Stream& _in;
+    uint32_t _inRemaining;
+    format_t _format;
+
+    tinfl_decompressor *_decompressor;
+    uint8_t *_dict;   // TINFL_LZ_DICT_SIZE, wraps around
+    uint8_t *_input;  // INFLATE_INPUT_BUFFER
+    size_t _inputPos;
+    size_t _inputLength;
+    size_t _dictPos;  // where tinfl writes next
+    size_t _outPos;   // decompressed bytes not read yet
+    size_t _outLength;
+    uint32_t _totalOut;
+    bool _done;
+    bool _error;
+
+    bool readInput(void);
+    bool readRaw(uint8_t &value);
+    bool skipGzipHeader(void);
+    bool inflate(void);
+};
+
+#endif /* ESP32INFLATESTREAM_H_ */
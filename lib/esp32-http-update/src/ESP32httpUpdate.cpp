@@ -25,6 +25,8 @@
 
 #include "ESP32httpUpdate.h"
 #include <StreamString.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
 
 ESP32HTTPUpdate::ESP32HTTPUpdate(void)
 {
@@ -150,6 +152,10 @@ String ESP32HTTPUpdate::getLastErrorString(void)
         return F("Verify bin header failed");
     case HTTP_UE_BIN_FOR_WRONG_FLASH:
         return F("bin for wrong flash size");
+    case HTTP_UE_DELTA_FAILED:
+        return F("Delta patch failed");
+    case HTTP_UE_DECOMPRESS_FAILED:
+        return F("Decompression failed");
     }
 
     return String();
@@ -189,7 +195,18 @@ HTTPUpdateResult ESP32HTTPUpdate::handleUpdate(HTTPClient& http, const String& c
         http.addHeader(F("x-ESP32-version"), currentVersion);
     }
 
-    const char * headerkeys[] = { "x-MD5" };
+    if(_deltaUpdates && !spiffs) {
+        // server may answer with a patch against this build, see runDeltaUpdate()
+        http.addHeader(F("x-ESP32-sketch-md5"), ESP.getSketchMD5());
+        http.addHeader(F("x-ESP32-delta"), F("bsdiff43"));
+    }
+
+    if(_compressedUpdates) {
+        // server may answer with a compressed body, see ESP32InflateStream
+        http.addHeader(F("x-ESP32-encoding"), F("gzip, deflate"));
+    }
+
+    const char * headerkeys[] = { "x-MD5", "x-Delta", "x-Encoding", "x-Size" };
     size_t headerkeyssize = sizeof(headerkeys) / sizeof(char*);
 
     // track these headers
@@ -216,18 +233,26 @@ HTTPUpdateResult ESP32HTTPUpdate::handleUpdate(HTTPClient& http, const String& c
         DEBUG_HTTP_UPDATE("[httpUpdate]  - MD5: %s\n", http.header("x-MD5").c_str());
     }
 
+    // compressed body, len is the compressed and size the decompressed length
+    String encoding = _compressedUpdates ? http.header("x-Encoding") : String();
+    int size = len;
+    if(encoding.length()) {
+        size = http.header("x-Size").toInt();
+        DEBUG_HTTP_UPDATE("[httpUpdate]  - encoding: %s, size: %d\n", encoding.c_str(), size);
+    }
+
     if(currentVersion && currentVersion[0] != 0x00) {
         DEBUG_HTTP_UPDATE("[httpUpdate]  - current version: %s\n", currentVersion.c_str() );
     }
 
     switch(code) {
     case HTTP_CODE_OK:  ///< OK (Start Update)
-        if(len > 0) {
+        if(len > 0 && size > 0) {
             bool startUpdate = true;
             if(spiffs) {
                 size_t spiffsSize = ((size_t) SPIFFS.totalBytes() - (size_t) SPIFFS.usedBytes());
-                if(len > (int) spiffsSize) {
-                    DEBUG_HTTP_UPDATE("[httpUpdate] spiffsSize to low (%d) needed: %d\n", spiffsSize, len);
+                if(size > (int) spiffsSize) {
+                    DEBUG_HTTP_UPDATE("[httpUpdate] spiffsSize to low (%d) needed: %d\n", spiffsSize, size);
                     startUpdate = false;
                 }
             } else {
@@ -293,7 +318,37 @@ HTTPUpdateResult ESP32HTTPUpdate::handleUpdate(HTTPClient& http, const String& c
                     */
                 }
 
-                if(runUpdate(*tcp, len, http.header("x-MD5"), command)) {
+                bool delta = !spiffs && _deltaUpdates && http.header("x-Delta") == "bsdiff43";
+                if(delta) {
+                    DEBUG_HTTP_UPDATE("[httpUpdate] runDeltaUpdate...\n");
+                }
+
+                Stream * body = tcp;
+                ESP32InflateStream inflater(*tcp, len, encoding == "gzip" ? ESP32InflateStream::INFLATE_GZIP : ESP32InflateStream::INFLATE_ZLIB);
+                if(encoding.length()) {
+                    if(encoding != "gzip" && encoding != "deflate") {
+                        _lastError = HTTP_UE_DECOMPRESS_FAILED;
+                        DEBUG_HTTP_UPDATE("[httpUpdate] unsupported encoding %s\n", encoding.c_str());
+                        http.end();
+                        return HTTP_UPDATE_FAILED;
+                    }
+                    if(!http.hasHeader("x-MD5") || http.header("x-MD5").length() == 0) {
+                        // gzip trailer is not checked, the MD5 is what verifies the decompressed image
+                        _lastError = HTTP_UE_SERVER_FAULTY_MD5;
+                        DEBUG_HTTP_UPDATE("[httpUpdate] compressed body without x-MD5\n");
+                        http.end();
+                        return HTTP_UPDATE_FAILED;
+                    }
+                    if(!inflater.begin()) {
+                        _lastError = HTTP_UE_DECOMPRESS_FAILED;
+                        DEBUG_HTTP_UPDATE("[httpUpdate] inflate begin failed!\n");
+                        http.end();
+                        return HTTP_UPDATE_FAILED;
+                    }
+                    body = &inflater;
+                }
+
+                if(delta ? runDeltaUpdate(*body, size, http.header("x-MD5")) : runUpdate(*body, size, http.header("x-MD5"), command)) {
                     ret = HTTP_UPDATE_OK;
                     DEBUG_HTTP_UPDATE("[httpUpdate] Update ok\n");
                     http.end();
@@ -303,6 +358,9 @@ HTTPUpdateResult ESP32HTTPUpdate::handleUpdate(HTTPClient& http, const String& c
                     }
 
                 } else {
+                    if(inflater.hasError()) {
+                        _lastError = HTTP_UE_DECOMPRESS_FAILED;
+                    }
                     ret = HTTP_UPDATE_FAILED;
                     DEBUG_HTTP_UPDATE("[httpUpdate] Update failed\n");
                 }
@@ -310,7 +368,7 @@ HTTPUpdateResult ESP32HTTPUpdate::handleUpdate(HTTPClient& http, const String& c
         } else {
             _lastError = HTTP_UE_SERVER_NOT_REPORT_SIZE;
             ret = HTTP_UPDATE_FAILED;
-            DEBUG_HTTP_UPDATE("[httpUpdate] Content-Length is 0 or not set by Server?!\n");
+            DEBUG_HTTP_UPDATE("[httpUpdate] Content-Length or x-Size is 0 or not set by Server?!\n");
         }
         break;
     case HTTP_CODE_NOT_MODIFIED:
@@ -384,6 +442,76 @@ bool ESP32HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int comma
     return true;
 }
 
+/**
+ * write Update to flash by applying a patch to the running sketch
+ * @param in Stream& patch
+ * @param size uint32_t patch size
+ * @param md5 String of the resulting image
+ * @return true if Update ok
+ */
+bool ESP32HTTPUpdate::runDeltaUpdate(Stream& in, uint32_t size, String md5)
+{
+
+    StreamString error;
+
+    const esp_partition_t * running = esp_ota_get_running_partition();
+    if(running == NULL) {
+        _lastError = HTTP_UE_DELTA_FAILED;
+        DEBUG_HTTP_UPDATE("[httpUpdate] no running partition!\n");
+        return false;
+    }
+
+    ESP32DeltaPatch patch(
+        [running](uint32_t offset, uint8_t * data, size_t length) {
+            return esp_partition_read(running, offset, data, length) == ESP_OK;
+        },
+        ESP.getSketchSize(),
+        [](uint8_t * data, size_t length) {
+            return Update.write(data, length);
+        });
+
+    uint32_t newSize = patch.begin(in);
+    if(newSize == 0) {
+        _lastError = HTTP_UE_DELTA_FAILED;
+        DEBUG_HTTP_UPDATE("[httpUpdate] delta header invalid!\n");
+        return false;
+    }
+
+    if(!Update.begin(newSize, U_FLASH)) {
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        DEBUG_HTTP_UPDATE("[httpUpdate] Update.begin failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    if(md5.length()) {
+        if(!Update.setMD5(md5.c_str())) {
+            _lastError = HTTP_UE_SERVER_FAULTY_MD5;
+            DEBUG_HTTP_UPDATE("[httpUpdate] Update.setMD5 failed! (%s)\n", md5.c_str());
+            Update.abort();
+            return false;
+        }
+    }
+
+    if(!patch.apply(in, size)) {
+        _lastError = Update.hasError() ? Update.getError() : HTTP_UE_DELTA_FAILED;
+        DEBUG_HTTP_UPDATE("[httpUpdate] delta patch failed! (%d)\n", patch.getError());
+        Update.abort();
+        return false;
+    }
+
+    if(!Update.end()) {
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        DEBUG_HTTP_UPDATE("[httpUpdate] Update.end failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    return true;
+}
+
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
 ESP32HTTPUpdate ESPhttpUpdate;
 #endif
@@ -36,6 +36,9 @@
 #include "FS.h"
 #include "SPIFFS.h"
 
+#include "ESP32DeltaPatch.h"
+#include "ESP32InflateStream.h"
+
 #ifdef DEBUG_ESP_HTTP_UPDATE
 #ifdef DEBUG_ESP_PORT
 #define DEBUG_HTTP_UPDATE(...) DEBUG_ESP_PORT.printf( __VA_ARGS__ )
@@ -55,6 +58,8 @@
 #define HTTP_UE_SERVER_FAULTY_MD5           (-105)
 #define HTTP_UE_BIN_VERIFY_HEADER_FAILED    (-106)
 #define HTTP_UE_BIN_FOR_WRONG_FLASH         (-107)
+#define HTTP_UE_DELTA_FAILED                (-108)
+#define HTTP_UE_DECOMPRESS_FAILED           (-109)
 
 enum HTTPUpdateResult {
     HTTP_UPDATE_FAILED,
@@ -75,6 +80,18 @@ public:
         _rebootOnUpdate = reboot;
     }
 
+    // Advertise the running sketch MD5 and accept a bsdiff patch against it instead of the full image (default on)
+    void deltaUpdates(bool enabled)
+    {
+        _deltaUpdates = enabled;
+    }
+
+    // Accept a gzip or zlib compressed body, decompressed while it is written (default on)
+    void compressedUpdates(bool enabled)
+    {
+        _compressedUpdates = enabled;
+    }
+
     // This function is deprecated, use rebootOnUpdate and the next one instead
     t_httpUpdate_return update(const String& url, const String& currentVersion,
                                const String& httpsCertificate, bool reboot) __attribute__((deprecated));
@@ -104,9 +121,12 @@ public:
 protected:
     t_httpUpdate_return handleUpdate(HTTPClient& http, const String& currentVersion, bool spiffs = false);
     bool runUpdate(Stream& in, uint32_t size, String md5, int command = U_FLASH);
+    bool runDeltaUpdate(Stream& in, uint32_t size, String md5);
 
     int _lastError;
     bool _rebootOnUpdate = true;
+    bool _deltaUpdates = true;
+    bool _compressedUpdates = true;
 };
 
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
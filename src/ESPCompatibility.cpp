@@ -1,7 +1,7 @@
 #include "ESPCompatibility.h"
 
-char * ESPCompatibility::mac = "FFFFFFFFFFF";
-char * ESPCompatibility::fcid = "FFFFFFFFFFF";
+char ESPCompatibility::mac[13] = "FFFFFFFFFFFF";
+char ESPCompatibility::fcid[13] = "FFFFFF";
 
 char * ESPCompatibility::get_mac_id()
 {
@@ -33,7 +33,7 @@ char * ESPCompatibility::get_mac_id()
   String macAddress = WiFi.macAddress();
   macAddress.replace(":", "");
   macAddress.replace(" ", "");
-  sprintf(ESPCompatibility::mac, "%s", macAddress.c_str());
+  snprintf(ESPCompatibility::mac, sizeof(ESPCompatibility::mac), "%s", macAddress.c_str());
 
   return ESPCompatibility::mac;
 }
@@ -42,7 +42,7 @@ char * ESPCompatibility::get_flash_id()
 {
 
 #ifdef ESP8266
-  sprintf(ESPCompatibility::fcid, "%02X%02X%02X", ESP.getFlashChipId());
+  snprintf(ESPCompatibility::fcid, sizeof(ESPCompatibility::fcid), "%06X", ESP.getFlashChipId());
 #endif
 
 #ifdef ESP32
@@ -56,12 +56,10 @@ char * ESPCompatibility::get_flash_id()
 
 char *ESPCompatibility::mac_id()
 {
-  ESPCompatibility::mac = get_mac_id();
-  return ESPCompatibility::mac;
+  return get_mac_id();
 }
 
 char * ESPCompatibility::flash_id()
 {
-  ESPCompatibility::fcid = get_flash_id();
-  return ESPCompatibility::fcid;
+  return get_flash_id();
 }
\ No newline at end of file
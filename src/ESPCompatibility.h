@@ -12,8 +12,8 @@ class ESPCompatibility {
 
   public:
 
-    static char * mac;  // [13]
-    static char * fcid; // [13]
+    static char mac[13];
+    static char fcid[13];
 
     static char* mac_id();
     static char* flash_id();
@@ -0,0 +1,371 @@
+#include "HTTPResponseReader.h"
+
+HTTPResponseReader::HTTPResponseReader()
+{
+  begin(nullptr);
+}
+
+void HTTPResponseReader::begin(Client *client)
+{
+  _client = client;
+  _state = STATUS_LINE;
+  _line[0] = 0;
+  _line_length = 0;
+  _status_code = 0;
+  _content_length = -1;
+  _chunked = false;
+  _keep_alive = false;
+  _remaining = 0;
+  _bytes_received = 0;
+}
+
+int HTTPResponseReader::_client_read()
+{
+  int c = _client->read();
+  if (c >= 0)
+  {
+    _bytes_received++;
+  }
+  return c;
+}
+
+/*
+ * Headers
+ */
+
+bool HTTPResponseReader::readHeaders(int budget)
+{
+  if (_client == nullptr)
+  {
+    return false;
+  }
+
+  while ((_state == STATUS_LINE || _state == HEADERS) && (budget-- > 0) && _client->available())
+  {
+    int c = _client_read();
+    if (c < 0)
+    {
+      break;
+    }
+    if (c == '\n')
+    {
+      if ((_line_length > 0) && (_line[_line_length - 1] == '\r'))
+      {
+        _line_length--;
+      }
+      _line[_line_length] = 0;
+      _line_length = 0;
+      if (!_process_line())
+      {
+        _state = FAILED;
+        return false;
+      }
+    }
+    else if (_line_length < sizeof(_line) - 1)
+    {
+      _line[_line_length++] = c;
+    }
+  }
+
+  return (_state != STATUS_LINE) && (_state != HEADERS) && (_state != FAILED);
+}
+
+static const char *header_value(const char *line, const char *name)
+{
+  size_t len = strlen(name);
+  if (strncasecmp(line, name, len) != 0)
+  {
+    return nullptr;
+  }
+  const char *value = line + len;
+  while (*value == ' ' || *value == '\t')
+  {
+    value++;
+  }
+  return value;
+}
+
+bool HTTPResponseReader::_process_line()
+{
+  if (_state == STATUS_LINE)
+  {
+    // HTTP/1.x 200 OK
+    if (strncmp(_line, "HTTP/1.", 7) != 0)
+    {
+      return false;
+    }
+    _keep_alive = (_line[7] != '0'); // persistent by default since HTTP/1.1
+    const char *code = strchr(_line, ' ');
+    if (code == nullptr)
+    {
+      return false;
+    }
+    _status_code = atoi(code + 1);
+    _state = HEADERS;
+    return true;
+  }
+
+  if (_line[0] == 0)
+  {
+    // end of headers
+    if ((_status_code == 204) || (_status_code == 304) || (_status_code < 200))
+    {
+      _state = DONE; // no body
+    }
+    else if (_chunked)
+    {
+      _remaining = 0;
+      _state = CHUNK_SIZE;
+    }
+    else
+    {
+      _remaining = (_content_length > 0) ? _content_length : 0;
+      _state = (_content_length == 0) ? DONE : BODY;
+      if (_content_length < 0)
+      {
+        _keep_alive = false; // body is delimited by connection close
+      }
+    }
+    return true;
+  }
+
+  const char *value;
+
+  if ((value = header_value(_line, "Content-Length:")) != nullptr)
+  {
+    _content_length = atol(value);
+  }
+  else if ((value = header_value(_line, "Transfer-Encoding:")) != nullptr)
+  {
+    _chunked = (strncasecmp(value, "chunked", 7) == 0);
+  }
+  else if ((value = header_value(_line, "Connection:")) != nullptr)
+  {
+    if (strncasecmp(value, "close", 5) == 0)
+    {
+      _keep_alive = false;
+    }
+    else if (strncasecmp(value, "keep-alive", 10) == 0)
+    {
+      _keep_alive = true;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Body
+ */
+
+bool HTTPResponseReader::_advance_chunk()
+{
+  while (true)
+  {
+    int c;
+
+    switch (_state)
+    {
+
+    case CHUNK_DATA:
+      if (_remaining > 0)
+      {
+        return true;
+      }
+      _state = CHUNK_DATA_END;
+      break;
+
+    case CHUNK_DATA_END: // CRLF after chunk data
+      if (!_client->available())
+        return false;
+      c = _client_read();
+      if (c == '\n')
+      {
+        _remaining = 0;
+        _state = CHUNK_SIZE;
+      }
+      break;
+
+    case CHUNK_SIZE:
+    case CHUNK_EXTENSION:
+      if (!_client->available())
+        return false;
+      c = _client_read();
+      if (c == '\n')
+      {
+        if (_remaining == 0)
+        {
+          _line_length = 0;
+          _state = TRAILERS; // last-chunk
+        }
+        else
+        {
+          _state = CHUNK_DATA;
+        }
+      }
+      else if (c == '\r' || _state == CHUNK_EXTENSION)
+      {
+        // skip
+      }
+      else if (c >= '0' && c <= '9')
+      {
+        _remaining = (_remaining << 4) | (c - '0');
+      }
+      else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      {
+        _remaining = (_remaining << 4) | ((c | 0x20) - 'a' + 10);
+      }
+      else if (c == ';' || c == ' ' || c == '\t')
+      {
+        _state = CHUNK_EXTENSION;
+      }
+      else
+      {
+        _state = FAILED;
+        return false;
+      }
+      break;
+
+    case TRAILERS: // optional trailer headers, ended by an empty line
+      if (!_client->available())
+        return false;
+      c = _client_read();
+      if (c == '\n')
+      {
+        if (_line_length == 0)
+        {
+          _state = DONE;
+        }
+        _line_length = 0;
+      }
+      else if (c != '\r')
+      {
+        _line_length = 1;
+      }
+      break;
+
+    case DONE:
+      return true;
+
+    default:
+      return false;
+    }
+  }
+}
+
+int HTTPResponseReader::available()
+{
+  if (_state == BODY)
+  {
+    int n = _client->available();
+    if ((_content_length >= 0) && ((unsigned long)n > _remaining))
+    {
+      n = _remaining;
+    }
+    return n;
+  }
+
+  if ((_state >= CHUNK_SIZE) && (_state <= TRAILERS))
+  {
+    if (!_advance_chunk() || (_state != CHUNK_DATA))
+    {
+      return 0;
+    }
+    int n = _client->available();
+    if ((unsigned long)n > _remaining)
+    {
+      n = _remaining;
+    }
+    return n;
+  }
+
+  return 0;
+}
+
+int HTTPResponseReader::read()
+{
+  if (_state == BODY)
+  {
+    int c = _client_read();
+    if ((c >= 0) && (_content_length >= 0) && (--_remaining == 0))
+    {
+      _state = DONE;
+    }
+    return c;
+  }
+
+  if ((_state >= CHUNK_SIZE) && (_state <= TRAILERS))
+  {
+    if (!_advance_chunk() || (_state != CHUNK_DATA))
+    {
+      return -1;
+    }
+    int c = _client_read();
+    if (c >= 0)
+    {
+      _remaining--;
+    }
+    return c;
+  }
+
+  return -1;
+}
+
+int HTTPResponseReader::peek()
+{
+  if (_state == BODY)
+  {
+    return _client->peek();
+  }
+
+  if ((_state >= CHUNK_SIZE) && (_state <= TRAILERS))
+  {
+    if (!_advance_chunk() || (_state != CHUNK_DATA))
+    {
+      return -1;
+    }
+    return _client->peek();
+  }
+
+  return -1;
+}
+
+bool HTTPResponseReader::bodyReady()
+{
+  if ((_state == STATUS_LINE) || (_state == HEADERS))
+  {
+    return false;
+  }
+
+  // available() counts only what the client holds now (with BearSSL the current TLS record), so the
+  // caller consumes that and asks again instead of waiting for more
+  return (available() > 0) || ended();
+}
+
+bool HTTPResponseReader::ended()
+{
+  if ((_state == STATUS_LINE) || (_state == HEADERS))
+  {
+    return false;
+  }
+
+  if (available() > 0) // also consumes chunk framing, may reach DONE
+  {
+    return false;
+  }
+
+  return (_state == DONE) || (_state == FAILED) || !_client->connected();
+}
+
+bool HTTPResponseReader::done()
+{
+  return _state == DONE;
+}
+
+bool HTTPResponseReader::drain()
+{
+  while (!done() && (read() >= 0))
+  {
+  }
+  return done();
+}
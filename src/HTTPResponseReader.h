@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+/*
+ * Incremental HTTP/1.1 response reader.
+ *
+ * readHeaders() consumes status line and headers without blocking, using a small fixed line buffer.
+ * Afterwards the instance is a Stream over the decoded body (Content-Length or chunked framing),
+ * so it can be passed directly to deserializeJson().
+ */
+
+class HTTPResponseReader : public Stream
+{
+public:
+    HTTPResponseReader();
+
+    void begin(Client *client); // resets state for a new response on client
+
+    bool readHeaders(int budget); // consumes up to budget bytes; true once headers are complete
+    bool bodyReady();             // true when body bytes can be read without waiting, or nothing more will arrive
+    bool ended();                 // true when no more body bytes will arrive (complete, failed or connection closed)
+    bool done();                  // true when the whole body has been consumed
+    bool drain();                 // discards already received rest of body; true if done() afterwards
+
+    bool failed() { return _state == FAILED; }
+    int statusCode() { return _status_code; }
+    long contentLength() { return _content_length; } // -1 if not sent
+    bool chunked() { return _chunked; }
+    bool keepAlive() { return _keep_alive; }
+    unsigned long bytesReceived() { return _bytes_received; } // raw bytes incl. headers and framing
+
+    // Stream over the decoded body
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t) { return 0; }
+
+private:
+    enum state
+    {
+        STATUS_LINE = 0,
+        HEADERS = 1,
+        BODY = 2,
+        CHUNK_SIZE = 3,
+        CHUNK_EXTENSION = 4,
+        CHUNK_DATA = 5,
+        CHUNK_DATA_END = 6,
+        TRAILERS = 7,
+        DONE = 8,
+        FAILED = 9
+    };
+
+    Client *_client;
+    state _state;
+
+    char _line[64]; // longer lines are truncated, only their start is relevant
+    uint8_t _line_length;
+
+    int _status_code;
+    long _content_length;
+    bool _chunked;
+    bool _keep_alive;
+
+    unsigned long _remaining; // bytes left in body (Content-Length) or in current chunk
+    unsigned long _bytes_received;
+
+    int _client_read();
+    bool _process_line();
+    bool _advance_chunk(); // consumes chunk framing; true when positioned on data or done
+};
@@ -0,0 +1,338 @@
+#include "MQTTOutbox.h"
+
+#ifdef ESP32
+#include <SPIFFS.h>
+#endif
+
+#define MQTT_OUTBOX_CURSOR "/thinx.qc"
+#define MQTT_OUTBOX_HEADER 5 // flags, topic length, payload length
+
+MQTTOutbox::MQTTOutbox()
+{
+  _ready = false;
+  _buffered = 0;
+  _buffered_since = 0;
+  _size[0] = 0;
+  _size[1] = 0;
+  _write_segment = 0;
+  _read_segment = 0;
+  _read_offset = 0;
+  _dropped_bytes = 0;
+}
+
+const char *MQTTOutbox::_path(uint8_t segment)
+{
+  return segment ? "/thinx.q1" : "/thinx.q0";
+}
+
+void MQTTOutbox::begin()
+{
+  if (_ready)
+  {
+    return;
+  }
+
+  for (uint8_t segment = 0; segment < 2; segment++)
+  {
+    _size[segment] = 0;
+    if (SPIFFS.exists(_path(segment)))
+    {
+      File f = SPIFFS.open(_path(segment), "r");
+      if (f)
+      {
+        _size[segment] = f.size();
+        f.close();
+      }
+    }
+  }
+
+  _write_segment = 0;
+  _read_segment = 0;
+  _read_offset = 0;
+
+  File f = SPIFFS.open(MQTT_OUTBOX_CURSOR, "r");
+  if (f)
+  {
+    uint8_t cursor[6];
+    if (f.read(cursor, sizeof(cursor)) == sizeof(cursor))
+    {
+      _write_segment = cursor[0] & 1;
+      _read_segment = cursor[1] & 1;
+      _read_offset = ((uint32_t)cursor[2] << 24) | ((uint32_t)cursor[3] << 16) | (cursor[4] << 8) | cursor[5];
+    }
+    f.close();
+  }
+
+  if (_read_offset > _size[_read_segment])
+  {
+    _read_offset = _size[_read_segment];
+  }
+  _ready = true;
+}
+
+void MQTTOutbox::_save_cursor()
+{
+  uint8_t cursor[6] = {
+      _write_segment,
+      _read_segment,
+      (uint8_t)(_read_offset >> 24),
+      (uint8_t)(_read_offset >> 16),
+      (uint8_t)(_read_offset >> 8),
+      (uint8_t)_read_offset};
+
+  File f = SPIFFS.open(MQTT_OUTBOX_CURSOR, "w");
+  if (f)
+  {
+    f.write(cursor, sizeof(cursor));
+    f.close();
+  }
+}
+
+void MQTTOutbox::_clear_segment(uint8_t segment)
+{
+  if (SPIFFS.exists(_path(segment)))
+  {
+    SPIFFS.remove(_path(segment));
+  }
+  _size[segment] = 0;
+  if (_read_segment == segment)
+  {
+    _read_offset = 0;
+  }
+}
+
+bool MQTTOutbox::_stored()
+{
+  if (_read_segment != _write_segment)
+  {
+    return true; // older segment is removed as soon as it is drained
+  }
+  return _read_offset < _size[_read_segment];
+}
+
+bool MQTTOutbox::pending()
+{
+  return (_buffered > 0) || _stored();
+}
+
+unsigned long MQTTOutbox::bufferAge()
+{
+  return (_buffered > 0) ? (millis() - _buffered_since) : 0;
+}
+
+/*
+ * Writing
+ */
+
+bool MQTTOutbox::_reserve(size_t length)
+{
+  if ((_size[_write_segment] == 0) || (_size[_write_segment] + length <= MQTT_OUTBOX_SIZE / 2))
+  {
+    return true;
+  }
+
+  uint8_t next = _write_segment ^ 1;
+  if (_size[next] > 0)
+  {
+    // Full: the next segment still holds the oldest messages, continue reading in the current one
+    _dropped_bytes += _size[next] - ((_read_segment == next) ? _read_offset : 0);
+    _clear_segment(next);
+    _read_segment = _write_segment;
+    _read_offset = 0;
+  }
+  _write_segment = next;
+  _save_cursor();
+  return true;
+}
+
+bool MQTTOutbox::_write(const uint8_t *data, size_t length)
+{
+  _reserve(length);
+
+  File f = SPIFFS.open(_path(_write_segment), "a");
+  if (!f)
+  {
+    return false;
+  }
+  size_t written = f.write(data, length);
+  f.close();
+  _size[_write_segment] += written;
+  return written == length;
+}
+
+bool MQTTOutbox::flush()
+{
+  if (_buffered == 0)
+  {
+    return true;
+  }
+  bool success = _write(_buffer, _buffered);
+  _buffered = 0;
+  return success;
+}
+
+bool MQTTOutbox::append(const char *topic, const uint8_t *payload, size_t length, bool retain)
+{
+  if (!_ready)
+  {
+    return false;
+  }
+
+  // Lengths are stored in 16 bits
+  size_t topic_length = strlen(topic);
+  size_t record_length = MQTT_OUTBOX_HEADER + topic_length + length;
+  if ((topic_length > 0xFFFF) || (length > 0xFFFF) || (topic_length + length > MQTT_OUTBOX_RECORD))
+  {
+    return false;
+  }
+
+  if (_buffered + record_length > sizeof(_buffer))
+  {
+    flush();
+  }
+
+  uint8_t header[MQTT_OUTBOX_HEADER] = {
+      (uint8_t)(retain ? 1 : 0),
+      (uint8_t)(topic_length >> 8),
+      (uint8_t)topic_length,
+      (uint8_t)(length >> 8),
+      (uint8_t)length};
+
+  if (record_length > sizeof(_buffer))
+  {
+    // Too big for batching, written on its own
+    _reserve(record_length);
+    File f = SPIFFS.open(_path(_write_segment), "a");
+    if (!f)
+    {
+      return false;
+    }
+    size_t written = f.write(header, sizeof(header));
+    written += f.write((const uint8_t *)topic, topic_length);
+    written += f.write(payload, length);
+    f.close();
+    _size[_write_segment] += written;
+    return written == record_length;
+  }
+
+  if (_buffered == 0)
+  {
+    _buffered_since = millis();
+  }
+  memcpy(_buffer + _buffered, header, sizeof(header));
+  memcpy(_buffer + _buffered + sizeof(header), topic, topic_length);
+  memcpy(_buffer + _buffered + sizeof(header) + topic_length, payload, length);
+  _buffered += record_length;
+  return true;
+}
+
+/*
+ * Reading
+ */
+
+uint8_t MQTTOutbox::drain(PubSubClient &client, uint8_t count)
+{
+  if (!_ready)
+  {
+    return 0;
+  }
+
+  uint8_t sent = 0;
+  bool moved = false; // crossed a segment boundary, the cursor is persisted only then
+  File f;
+
+  while (sent < count)
+  {
+    if (_read_offset >= _size[_read_segment])
+    {
+      if (f)
+      {
+        f.close();
+        f = File();
+      }
+      if (_read_segment == _write_segment)
+      {
+        if (_size[_read_segment] > 0)
+        {
+          _clear_segment(_read_segment); // all sent, start over
+          moved = true;
+        }
+        break;
+      }
+      // Older segment is done, continue with the newer one
+      _clear_segment(_read_segment);
+      _read_segment = _write_segment;
+      _read_offset = 0;
+      moved = true;
+      continue;
+    }
+
+    if (!f)
+    {
+      f = SPIFFS.open(_path(_read_segment), "r");
+      if (!f || !f.seek(_read_offset, SeekSet))
+      {
+        _read_offset = _size[_read_segment]; // unreadable, skip the segment
+        continue;
+      }
+    }
+
+    uint8_t header[MQTT_OUTBOX_HEADER];
+    if (f.read(header, sizeof(header)) != sizeof(header))
+    {
+      _read_offset = _size[_read_segment]; // truncated by power loss
+      continue;
+    }
+    uint16_t topic_length = (header[1] << 8) | header[2];
+    uint16_t length = (header[3] << 8) | header[4];
+    if ((topic_length + length > sizeof(_record)) || (f.read(_record, topic_length + length) != topic_length + length))
+    {
+      _read_offset = _size[_read_segment];
+      continue;
+    }
+
+    MQTT::Publish pub((const char *)_record, topic_length, _record + topic_length, length);
+    pub.set_retain(header[0] & 1);
+    if (!client.queue(pub))
+    {
+      break; // read again next time
+    }
+
+    _read_offset += sizeof(header) + topic_length + length;
+    sent++;
+  }
+
+  if (f)
+  {
+    f.close();
+  }
+  if (!_stored() && (_size[_read_segment] > 0))
+  {
+    _clear_segment(_read_segment); // drained by this call
+    moved = true;
+  }
+  if (moved)
+  {
+    _save_cursor();
+  }
+
+  // Stored messages are handed off, the ones appended since follow from RAM without touching flash
+  while ((sent < count) && (_buffered > 0) && !_stored())
+  {
+    uint16_t topic_length = (_buffer[1] << 8) | _buffer[2];
+    uint16_t length = (_buffer[3] << 8) | _buffer[4];
+    size_t record_length = MQTT_OUTBOX_HEADER + topic_length + length;
+
+    MQTT::Publish pub((const char *)_buffer + MQTT_OUTBOX_HEADER, topic_length, _buffer + MQTT_OUTBOX_HEADER + topic_length, length);
+    pub.set_retain(_buffer[0] & 1);
+    if (!client.queue(pub))
+    {
+      break;
+    }
+
+    _buffered -= record_length;
+    memmove(_buffer, _buffer + record_length, _buffered);
+    sent++;
+  }
+  return sent;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <PubSubClient.h>
+
+// Bytes kept on SPIFFS, split into two segments; the older segment is dropped when both are full
+#ifndef MQTT_OUTBOX_SIZE
+#define MQTT_OUTBOX_SIZE 16384
+#endif
+
+// Appends are collected in RAM and written to SPIFFS in one go
+#ifndef MQTT_OUTBOX_BUFFER
+#define MQTT_OUTBOX_BUFFER 256
+#endif
+
+// Largest message that can be stored (topic + payload)
+#ifndef MQTT_OUTBOX_RECORD
+#define MQTT_OUTBOX_RECORD 512
+#endif
+
+/*
+ * Persistent store-and-forward log of outgoing MQTT messages.
+ *
+ * append() only copies the message to a RAM buffer; flush() writes the buffer sequentially to the newer
+ * of two segment files. drain() republishes the oldest messages in order, those on SPIFFS first and then
+ * the ones still in RAM, which never reach flash if the backlog is gone by then. The read position is
+ * persisted when a segment has been drained, so after a reboot the rest of a partly drained segment is
+ * sent again. Messages still buffered are lost on power failure.
+ */
+
+class MQTTOutbox
+{
+public:
+    MQTTOutbox();
+
+    void begin(); // restores segment sizes and read position from SPIFFS, must be called after SPIFFS.begin()
+    bool ready() { return _ready; }
+
+    bool append(const char *topic, const uint8_t *payload, size_t length, bool retain); // false if too long for a record
+    bool flush();                                       // writes buffered messages to SPIFFS
+    uint8_t drain(PubSubClient &client, uint8_t count); // queues up to count oldest messages, returns number taken
+
+    bool pending();                 // true while there are messages to drain
+    unsigned long bufferAge();      // ms since the oldest unflushed append, 0 if none
+    uint32_t droppedBytes() { return _dropped_bytes; } // lost because the log was full
+
+private:
+    bool _ready;
+    uint8_t _buffer[MQTT_OUTBOX_BUFFER];
+    uint16_t _buffered;
+    unsigned long _buffered_since;
+
+    uint8_t _record[MQTT_OUTBOX_RECORD]; // message being drained
+
+    uint32_t _size[2];     // bytes in each segment file
+    uint8_t _write_segment;
+    uint8_t _read_segment;
+    uint32_t _read_offset; // next message in _read_segment
+    uint32_t _dropped_bytes;
+
+    static const char *_path(uint8_t segment);
+    bool _stored(); // true while SPIFFS holds messages not drained yet
+    void _save_cursor();
+    bool _reserve(size_t length); // rotates segments if length does not fit into the current one
+    bool _write(const uint8_t *data, size_t length);
+    void _clear_segment(uint8_t segment);
+};
@@ -0,0 +1,253 @@
+#include "MQTTUpdate.h"
+
+#include <FS.h>
+#ifdef ESP32
+#include <SPIFFS.h>
+#include <Update.h>
+#else
+#include <Updater.h>
+#endif
+
+#define MQTT_UPDATE_STATE "/thinx.ota"
+#define MQTT_UPDATE_BEGIN_LENGTH 41 // 'B', id, size, sha256
+#define MQTT_UPDATE_CHUNK_HEADER 13 // 'C', id, offset, crc32
+
+MQTTUpdate::MQTTUpdate()
+{
+  _active = false;
+  _interrupted = false;
+  _id = 0;
+  _size = 0;
+  _offset = 0;
+}
+
+uint32_t MQTTUpdate::_read32(const uint8_t *data)
+{
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+// CRC-32 (IEEE 802.3, as zlib), bitwise to avoid a 1 kB table
+uint32_t MQTTUpdate::_crc32(const uint8_t *data, uint32_t length)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+const char *MQTTUpdate::statusName(status s)
+{
+  switch (s)
+  {
+  case STARTED:
+    return "started";
+  case RESUMED:
+    return "resumed";
+  case WRITTEN:
+    return "ok";
+  case SKIPPED:
+    return "expected";
+  case COMPLETED:
+    return "done";
+  case ERROR_CRC:
+    return "crc";
+  case ERROR_SHA:
+    return "sha";
+  case ERROR_FLASH:
+    return "flash";
+  case ERROR_SIZE:
+    return "size";
+  default:
+    return "ignored";
+  }
+}
+
+/*
+ * Persistence. The flash updater cannot continue a partially written image after reboot, so only the image
+ * is saved when it starts; restore() then tells the owner which one was interrupted and the sender starts it over.
+ */
+
+void MQTTUpdate::_persist()
+{
+  uint8_t state[8];
+  uint32_t values[2] = {_id, _size};
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    state[i * 4] = values[i] >> 24;
+    state[i * 4 + 1] = values[i] >> 16;
+    state[i * 4 + 2] = values[i] >> 8;
+    state[i * 4 + 3] = values[i];
+  }
+
+  File f = SPIFFS.open(MQTT_UPDATE_STATE, "w");
+  if (f)
+  {
+    f.write(state, sizeof(state));
+    f.close();
+  }
+}
+
+void MQTTUpdate::_forget()
+{
+  if (SPIFFS.exists(MQTT_UPDATE_STATE))
+  {
+    SPIFFS.remove(MQTT_UPDATE_STATE);
+  }
+}
+
+void MQTTUpdate::restore()
+{
+  File f = SPIFFS.open(MQTT_UPDATE_STATE, "r");
+  if (!f)
+  {
+    return;
+  }
+
+  uint8_t state[8];
+  if (f.read(state, sizeof(state)) == sizeof(state))
+  {
+    _id = _read32(state);
+    _size = _read32(state + 4);
+    _offset = 0; // written part is lost with the updater state
+    _interrupted = true;
+  }
+  f.close();
+}
+
+bool MQTTUpdate::interrupted()
+{
+  return _interrupted;
+}
+
+void MQTTUpdate::abort()
+{
+  if (_active)
+  {
+    Update.end(false); // incomplete image, discarded
+  }
+  _active = false;
+  _offset = 0;
+  _forget();
+}
+
+// Update.end() would commit a complete image, so a rejected one is dropped without it
+void MQTTUpdate::_discard()
+{
+#ifdef ESP32
+  Update.abort();
+#else
+  Update.setMD5("00000000000000000000000000000000"); // end() fails the MD5 check and resets the updater
+  Update.end();
+#endif
+  _active = false;
+  _offset = 0;
+  _forget();
+}
+
+/*
+ * Messages
+ */
+
+MQTTUpdate::status MQTTUpdate::handle(const uint8_t *message, uint32_t length)
+{
+  if (length == 0)
+  {
+    return IGNORED;
+  }
+  if (message[0] == 'B')
+  {
+    return _begin(message, length);
+  }
+  if (message[0] == 'C')
+  {
+    return _chunk(message, length);
+  }
+  return IGNORED;
+}
+
+MQTTUpdate::status MQTTUpdate::_begin(const uint8_t *message, uint32_t length)
+{
+  if (length != MQTT_UPDATE_BEGIN_LENGTH)
+  {
+    return ERROR_SIZE;
+  }
+
+  uint32_t id = _read32(message + 1);
+  uint32_t size = _read32(message + 5);
+  if (_active && (id == _id) && (size == _size) && (memcmp(_hash, message + 9, sizeof(_hash)) == 0))
+  {
+    return RESUMED;
+  }
+
+  abort(); // different image replaces the one in progress
+  _interrupted = false;
+  _id = id;
+  _size = size;
+  _offset = 0;
+  if ((size == 0) || !Update.begin(size))
+  {
+    return ERROR_FLASH;
+  }
+
+  memcpy(_hash, message + 9, sizeof(_hash));
+  _sha = Sha256();
+  _active = true;
+  _persist();
+  return STARTED;
+}
+
+MQTTUpdate::status MQTTUpdate::_chunk(const uint8_t *message, uint32_t length)
+{
+  if ((length <= MQTT_UPDATE_CHUNK_HEADER) || !_active || (_read32(message + 1) != _id))
+  {
+    return ERROR_SIZE;
+  }
+
+  uint32_t offset = _read32(message + 5);
+  const uint8_t *data = message + MQTT_UPDATE_CHUNK_HEADER;
+  uint32_t data_length = length - MQTT_UPDATE_CHUNK_HEADER;
+
+  if (offset != _offset)
+  {
+    return SKIPPED; // already written or a gap, the acknowledgement tells the sender where to continue
+  }
+  if (data_length > _size - _offset)
+  {
+    return ERROR_SIZE;
+  }
+  if (_crc32(data, data_length) != _read32(message + 9))
+  {
+    return ERROR_CRC;
+  }
+
+  if (Update.write(const_cast<uint8_t *>(data), data_length) != data_length)
+  {
+    abort();
+    return ERROR_FLASH;
+  }
+  _sha.update(data, data_length);
+  _offset += data_length;
+
+  if (_offset < _size)
+  {
+    return WRITTEN;
+  }
+
+  uint8_t hash[SHA256_BLOCK_SIZE];
+  _sha.final(hash);
+  if (memcmp(hash, _hash, sizeof(hash)) != 0)
+  {
+    _discard();
+    return ERROR_SHA;
+  }
+
+  _active = false;
+  _forget();
+  return Update.end() ? COMPLETED : ERROR_FLASH;
+}
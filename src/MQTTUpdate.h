@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Arduino.h>
+#include "sha256.h"
+
+/*
+ * Receiver of a firmware image sent over MQTT in numbered chunks.
+ *
+ * Messages are binary, integers big endian:
+ *   'B' id(4) size(4) sha256(32)          begins image id, or resumes it if already in progress
+ *   'C' id(4) offset(4) crc32(4) data     chunk starting at offset, checked against CRC-32 before it is written
+ * The owner acknowledges every message with offset() (the next byte expected), so after a reconnect the sender
+ * resumes from the last written chunk. Once the last chunk is written the SHA-256 of the whole image is checked;
+ * an image with a wrong hash is discarded without Update.end() committing it.
+ */
+
+class MQTTUpdate
+{
+public:
+    enum status
+    {
+        IGNORED,     // not an update message
+        STARTED,     // new image, flash prepared
+        RESUMED,     // begin for the image in progress, continue at offset()
+        WRITTEN,     // chunk written
+        SKIPPED,     // duplicate or out of order chunk, expected offset() instead
+        COMPLETED,   // image verified and committed, reboot to apply
+        ERROR_CRC,   // chunk corrupted, send again
+        ERROR_SHA,   // image hash mismatch, update aborted
+        ERROR_FLASH, // Update refused the image or a write
+        ERROR_SIZE   // malformed message or no update in progress
+    };
+
+    MQTTUpdate();
+
+    status handle(const uint8_t *message, uint32_t length);
+    void abort();
+
+    void restore();      // detects an update interrupted by reboot, call after SPIFFS.begin()
+    bool interrupted();  // restore() found one; cleared by the next begin message
+    bool active() { return _active; }
+    uint32_t id() { return _id; }
+    uint32_t offset() { return _offset; }
+    uint32_t size() { return _size; }
+
+    static const char *statusName(status s); // short name used in acknowledgements
+
+private:
+    bool _active;
+    bool _interrupted;
+    uint32_t _id;
+    uint32_t _size;
+    uint32_t _offset;
+    uint8_t _hash[SHA256_BLOCK_SIZE];
+    Sha256 _sha;
+
+    status _begin(const uint8_t *message, uint32_t length);
+    status _chunk(const uint8_t *message, uint32_t length);
+    void _persist(); // saves id and size, restore() reports them as interrupted
+    void _forget();
+    void _discard(); // drops a complete image that failed verification
+
+    static uint32_t _read32(const uint8_t *data);
+    static uint32_t _crc32(const uint8_t *data, uint32_t length);
+};
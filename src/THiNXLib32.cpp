@@ -2,12 +2,9 @@
 
 extern "C"
 {
-#include "user_interface.h"
 #include "thinx.h"
-#include <cont.h>
 #include <time.h>
 #include <stdlib.h>
-  extern cont_t g_cont;
 }
 
 #include "THiNXLib32.h"
@@ -15,24 +12,68 @@ extern "C"
 const int API_KEY_TLEN = 64;
 #define OWNER_KEY_TLEN API_KEY_TLEN
 
-#ifndef strdup()
+#ifndef strdup
 // Reimplementation just to fix missing in THiNX32 since Arduino Core 3.0
 char *strdup(const char *source)
 {
-  int len = strlen(source);
-  char *dest = new char[len];
-  for (int i = 0; i < len; i++)
-    dest[i] = source[i];
+  size_t len = strlen(source) + 1;
+  char *dest = (char *)malloc(len);
+  if (dest != nullptr)
+    memcpy(dest, source, len);
 
   return dest;
 }
 #endif
 
+// Bounded copy into a fixed-size identity slot; values that do not fit are rejected, not truncated
+template <size_t size>
+static bool identity_copy(char (&slot)[size], const char *value)
+{
+  if (value == nullptr)
+  {
+    slot[0] = 0;
+    return true;
+  }
+  size_t length = strlen(value);
+  if (length >= size)
+  {
+    return false;
+  }
+  memmove(slot, value, length + 1); // value may be the slot itself
+  return true;
+}
+
 #ifndef THINX_FIRMWARE_VERSION_SHORT
 #define THINX_FIRMWARE_VERSION_SHORT VERSION
 #endif
 
-#define MQTT_RECONNECT_DELAY 60000 // ms; time after which broken MQTT connection will trigger reboot instead of reconnect
+#ifndef MQTT_RECONNECT_DELAY
+#define MQTT_RECONNECT_DELAY 60000 // ms; upper bound of the reconnect backoff
+#endif
+
+#ifndef MQTT_RECONNECT_BASE
+#define MQTT_RECONNECT_BASE 1000 // ms; backoff window of the first retry, doubles with every failure
+#endif
+
+#ifndef THINX_CHECKIN_SLICE
+#define THINX_CHECKIN_SLICE 128 // bytes of API response consumed per loop(), keeps each loop() call short
+#endif
+
+#ifndef THINX_CHECKIN_TIMEOUT
+#define THINX_CHECKIN_TIMEOUT 30000 // ms; API response deadline
+#endif
+
+#ifndef THINX_CONNECT_TIMEOUT
+#define THINX_CONNECT_TIMEOUT 5000 // ms; longest wait of the blocking TCP connect and of each TLS handshake read
+#endif
+
+#ifndef THINX_CONTENT_LENGTH_SLOT
+#define THINX_CONTENT_LENGTH_SLOT 32 // room for "Content-Length: n\r\n\r\n" after the static request headers
+#endif
+
+#ifndef THINX_RESPONSE_CAPACITY
+#define THINX_RESPONSE_CAPACITY 1024 // JsonDocument capacity for streamed API responses (strings are copied into it)
+#endif
 
 #ifndef THINX_COMMIT_ID
 // any commit ID is sufficient to allow update
@@ -40,14 +81,15 @@ char *strdup(const char *source)
 #endif
 
 // Static variables
-char *THiNX::thinx_api_key;
-char *THiNX::thinx_owner_key;
+char THiNX::thinx_api_key[THINX_API_KEY_SIZE + 1];
 char THiNX::json_buffer[768];
+char THiNX::api_body[THINX_RESPONSE_BUFFER];
 
 const char THiNX::time_format[] = "%T";
 const char THiNX::date_format[] = "%Y-%m-%d";
 char *THiNX::thinx_mqtt_url = (char*)THINX_MQTT_URL;
 char *THiNX::thinx_cloud_url = (char*)THINX_CLOUD_URL;
+char THiNX::thinx_proxy_host[64] = {0};
 double THiNX::benchmark_speed = 0.0f; // kilobytes per second
 
 #include "thinx_root_ca.h"
@@ -82,42 +124,156 @@ bool THiNX::logging = false;
 
 // #define LOG `if (logging)`
 
-uint32_t THiNX::last_free_heap_size;
+/*
+ * Memory telemetry
+ */
 
-/* Convenience method for debugging memory issues. */
-void THiNX::printStackHeap(const String &tag)
+void THiNX::sample_memory(memory_marks &marks)
 {
-  if (!logging)
-    return;
   uint32_t heap = ESP.getFreeHeap();
-  uint32_t diff = 0;
-  String way = "=";
-  // if (last_free_heap_size != heap) { // rate limiting
-  if (last_free_heap_size > heap)
+#if defined(ESP8266)
+  uint32_t block = ESP.getMaxFreeBlockSize();
+  uint32_t stack = ESP.getFreeContStack();
+#else
+  uint32_t block = ESP.getMaxAllocHeap();
+  uint32_t stack = uxTaskGetStackHighWaterMark(NULL);
+#endif
+
+  if (heap < marks.free_heap)
+    marks.free_heap = heap;
+  if (block < marks.max_block)
+    marks.max_block = block;
+  if (stack < marks.free_stack)
+    marks.free_stack = stack;
+
+#ifdef DEBUG_RAM
+  if (logging)
+    Serial.printf("*TH: heap %u, block %u, stack %u\n", heap, block, stack);
+#endif
+}
+
+void THiNX::set_phase(phase next)
+{
+  sample_memory(telemetry_phases[next]);
+
+  unsigned long now = millis();
+  if (!phase_timing_started || (next != thinx_phase))
+  {
+    if (phase_timing_started)
+    {
+      uint32_t elapsed = now - phase_started;
+      phase_timing &timing = phase_timings[thinx_phase];
+      timing.count++;
+      timing.total_ms += elapsed;
+      if (elapsed < timing.min_ms)
+        timing.min_ms = elapsed;
+      if (elapsed > timing.max_ms)
+        timing.max_ms = elapsed;
+      int bucket = 0;
+      while ((bucket < THINX_PHASE_BUCKETS - 1) && (elapsed >= phase_bucket_limits[bucket]))
+        bucket++;
+      if (timing.buckets[bucket] < UINT16_MAX)
+        timing.buckets[bucket]++;
+    }
+    phase_started = now;
+    phase_timing_started = true;
+  }
+
+  if ((next == COMPLETED) && (boot_duration == 0))
+  {
+    boot_duration = now;
+  }
+
+  thinx_phase = next;
+}
+
+// appends [free_heap,max_block,free_stack] or [] if never sampled
+static size_t append_marks(char *buffer, size_t size, size_t length, const THiNX::memory_marks &marks)
+{
+  if (length >= size)
+    return length;
+  int written;
+  if (marks.free_heap == UINT32_MAX)
   {
-    diff = last_free_heap_size - heap;
-    way = "-";
+    written = snprintf(buffer + length, size - length, "[]");
   }
   else
   {
-    diff = heap - last_free_heap_size;
-    way = "+";
+    written = snprintf(buffer + length, size - length, "[%u,%u,%u]",
+                       (unsigned)marks.free_heap, (unsigned)marks.max_block, (unsigned)marks.free_stack);
+  }
+  return length + written;
+}
+
+static size_t append_text(char *buffer, size_t size, size_t length, const char *text)
+{
+  if (length >= size)
+    return length;
+  return length + snprintf(buffer + length, size - length, "%s", text);
+}
+
+const uint32_t THiNX::phase_bucket_limits[THINX_PHASE_BUCKETS - 1] = {100, 500, 1000, 2000, 5000, 10000, 30000};
+
+// appends [count,min,max,mean,[buckets...]] or [] if phase was never left
+static size_t append_timing(char *buffer, size_t size, size_t length, const THiNX::phase_timing &timing)
+{
+  if (length >= size)
+    return length;
+  if (timing.count == 0)
+  {
+    return length + snprintf(buffer + length, size - length, "[]");
+  }
+  length += snprintf(buffer + length, size - length, "[%u,%u,%u,%u,[",
+                     (unsigned)timing.count, (unsigned)timing.min_ms, (unsigned)timing.max_ms, (unsigned)timing.mean());
+  for (int i = 0; (i < THINX_PHASE_BUCKETS) && (length < size); i++)
+  {
+    length += snprintf(buffer + length, size - length, (i > 0) ? ",%u" : "%u", (unsigned)timing.buckets[i]);
+  }
+  return append_text(buffer, size, length, "]]");
+}
+
+void THiNX::publishPhaseMetrics()
+{
+  char message[640]; // fits all phases with realistic values, never published truncated
+  size_t length = snprintf(message, sizeof(message), "{\"metrics\":{\"boot\":%lu,\"phases\":[", boot_duration);
+  for (int i = INIT; i <= COMPLETED; i++)
+  {
+    if (i > INIT)
+      length = append_text(message, sizeof(message), length, ",");
+    length = append_timing(message, sizeof(message), length, phase_timings[i]);
   }
-  if (diff < 1)
+  length = append_text(message, sizeof(message), length, "]}}");
+
+  if (length >= sizeof(message))
+  {
     return;
-#ifdef DEBUG
-  if (logging)
+  }
+  publish_status_unretained(message);
+}
+
+void THiNX::publishTelemetry()
+{
+  char message[448]; // fits all marks with 10-digit values
+  size_t length = append_text(message, sizeof(message), 0, "{\"telemetry\":{\"phases\":[");
+  for (int i = INIT; i <= COMPLETED; i++)
   {
-    Serial.print(tag);
-    Serial.print(" HEAP: ");
-    Serial.print(heap);
-    Serial.print("; ");
-    Serial.print(way);
-    Serial.println(diff);
+    if (i > INIT)
+      length = append_text(message, sizeof(message), length, ",");
+    length = append_marks(message, sizeof(message), length, telemetry_phases[i]);
   }
-#endif
-  last_free_heap_size = heap;
-  //}
+  length = append_text(message, sizeof(message), length, "],\"parse\":");
+  length = append_marks(message, sizeof(message), length, telemetry_parse);
+  length = append_text(message, sizeof(message), length, ",\"checkin\":");
+  length = append_marks(message, sizeof(message), length, telemetry_checkin);
+  length = append_text(message, sizeof(message), length, ",\"update\":");
+  length = append_marks(message, sizeof(message), length, telemetry_update);
+  length = append_text(message, sizeof(message), length, "}}");
+
+  if (length >= sizeof(message))
+  {
+    return; // truncated JSON would be useless
+  }
+  publish_status_unretained(message);
 }
 
 /* Constructor */
@@ -137,21 +293,16 @@ THiNX::THiNX(const char *__apikey)
 THiNX::THiNX(const char *__apikey, const char *__owner_id)
 {
 
-#ifdef DEBUG_RAM
-  if (logging)
-    printStackHeap("before-init");
-#endif
-
   //Serial.print("Init with owner:"); Serial.println(__owner_id);
 
-  thinx_phase = INIT;
+  set_phase(INIT);
 
 #ifdef __USE_WIFI_MANAGER__
   should_save_config = false;
   WiFiManager wifiManager;
   api_key_param = new WiFiManagerParameter("apikey", "API Key", thinx_api_key, 64);
   wifiManager.addParameter(api_key_param);
-  owner_param = new WiFiManagerParameter("owner", "Owner ID", thinx_owner_key, 64);
+  owner_param = new WiFiManagerParameter("owner", "Owner ID", thinx_owner, 64);
   wifiManager.addParameter(owner_param);
 #ifdef DEBUG
   wifiManager.setTimeout(30);
@@ -187,18 +338,21 @@ THiNX::THiNX(const char *__apikey, const char *__owner_id)
   wifi_retry = 0;
 
   app_version = (char*)"\0";
-  available_update_url = (char*)"\0";
+  available_update_url[0] = 0;
 
   thinx_firmware_version_short = (char*)"\0";
   thinx_firmware_version = (char*)"\0";
   env_hash = ENV_HASH;
   thinx_version_id = (char*)"\0";
-  thinx_api_key = (char*)"\0";
+  thinx_api_key[0] = 0;
   thinx_forced_update = false;
   last_checkin_timestamp = 0; // 1/1/1970
-  mqtt_reconnect_timeout = 0;
+  thinx_mqtt_alias[0] = 0;
+  mqtt_reconnect_attempts = 0;
+  mqtt_reconnect_since = 0;
+  mqtt_reconnect_wait = 0;
 
-  checkin_time = millis() + checkin_interval / 4; // retry faster before first checkin
+  checkin_time = millis() - (checkin_interval - checkin_interval / 4); // retry faster before first checkin, after 1/4 of the interval
   reboot_interval = millis() + reboot_timeout;
 
   deferred_update_url = ""; // may be loaded from device info or set from registration
@@ -206,7 +360,7 @@ THiNX::THiNX(const char *__apikey, const char *__owner_id)
   // will be loaded from SPIFFS/EEPROM or retrieved on Registration later
   if (strlen(__owner_id) < 1)
   {
-    thinx_owner = (char*)THINX_OWNER;
+    identity_copy(thinx_owner, THINX_OWNER);
     Serial.print("Overriding thinx_owner with:"); Serial.println(thinx_owner);
   }
 
@@ -234,9 +388,8 @@ THiNX::THiNX(const char *__apikey, const char *__owner_id)
 
   bool api_key_valid = false;
 
-  if (strlen(__apikey) > 4)
+  if ((strlen(__apikey) > 4) && identity_copy(thinx_api_key, __apikey))
   {
-    thinx_api_key = (char*)__apikey;
     api_key_valid = true;
   }
   else
@@ -246,15 +399,14 @@ THiNX::THiNX(const char *__apikey, const char *__owner_id)
 
   bool owner_valid = false;
 
-  if (strlen(__owner_id) == OWNER_KEY_TLEN)
+  if ((strlen(__owner_id) == OWNER_KEY_TLEN) && identity_copy(thinx_owner, __owner_id))
   {
-    thinx_owner = (char*)__owner_id;
     owner_valid = true;
   }
   else
   {
     if (logging) Serial.print(F("*TH: No Owner ID!"));
-    thinx_owner = (char*)"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
+    thinx_owner[0] = 0;
     Serial.print("Set zero"); Serial.println(thinx_owner);
     return;
   }
@@ -279,6 +431,8 @@ void THiNX::init_with_api_key(const char *__apikey)
       Serial.println(F("*TH: Filesystem check failed, disabling THiNX."));
     return;
   }
+  mqtt_outbox.begin();
+  mqtt_update.restore();
 #endif
 
   if (info_loaded == false)
@@ -289,22 +443,20 @@ void THiNX::init_with_api_key(const char *__apikey)
 
   if (strlen(__apikey) > 4)
   {
-    thinx_api_key = (char*)__apikey;
+    identity_copy(thinx_api_key, __apikey);
   }
-  else
+
+  if (strlen(thinx_api_key) < 4)
   {
-    if (strlen(thinx_api_key) < 4)
-    {
 #ifdef DEBUG
-      if (logging)
-        Serial.print(F("*TH: No API Key!"));
+    if (logging)
+      Serial.print(F("*TH: No API Key!"));
 #endif
-      return;
-    }
+    return;
   }
 
   wifi_connection_in_progress = false;
-  thinx_phase = CONNECT_WIFI;
+  set_phase(CONNECT_WIFI);
 }
 
 /*
@@ -471,14 +623,17 @@ void THiNX::checkin()
   if (!wifi_connected)
     return; // if (logging) Serial.println(F("*TH: Cannot checkin while not connected, exiting."));
 
+  if (thinx_checkin_state != CHECKIN_IDLE)
+    return; // already in progress
+
+  sample_memory(telemetry_checkin);
   generate_checkin_body(); // returns json_buffer buffer
-#ifndef __DISABLE_HTTPS__
-  send_data_secure(json_buffer); // HTTPS
-#else
-  send_data(json_buffer); // HTTP fallback
-#endif
+  sample_memory(telemetry_checkin);
+
+  // Request is sent and response read by do_connect_api() from loop()
+  thinx_checkin_state = CHECKIN_CONNECT;
 
-  checkin_time = millis() + checkin_interval;
+  checkin_time = millis();
 }
 
 /*
@@ -504,7 +659,7 @@ void THiNX::generate_checkin_body()
 #endif
   }
 
-  if ((thinx_owner != nullptr) && (strlen(thinx_owner) == OWNER_KEY_TLEN))
+  if (strlen(thinx_owner) == OWNER_KEY_TLEN)
   {
     root["registration"]["owner"] = thinx_owner;
 #ifdef DEBUG
@@ -530,6 +685,11 @@ void THiNX::generate_checkin_body()
 #endif
   }
 
+  if (mqtt_compact_topics)
+  {
+    root["registration"]["mqtt_compact"] = true; // asks for mqtt_alias in response
+  }
+
   if (strlen(thinx_firmware_version) > 1)
   {
 #ifdef DEBUG
@@ -634,210 +794,70 @@ void THiNX::generate_checkin_body()
  * Registration - HTTP POST
  */
 
-#ifdef __DISABLE_HTTPS__
-void THiNX::send_data(const String &body)
+WiFiClient *THiNX::api_client()
 {
-  if (!http_client.connect(thinx_cloud_url, 7442))
-  {
-    if (logging)
-      Serial.println(F("*TH: API connection failed."));
-    return;
-  }
-
-  http_client.println(F("POST /device/register HTTP/1.1"));
-  http_client.print(F("Host: "));
-  http_client.println(THINX_CLOUD_URL);
-  http_client.print(F("Authentication: "));
-  http_client.println(THINX_API_KEY);
-  http_client.println(F("Accept: application/json")); // application/json
-  http_client.println(F("Origin: device"));
-  http_client.println(F("Content-Type: application/json"));
-  http_client.println(F("User-Agent: THiNX-Client"));
-  http_client.println(F("Connection: close"));
-  http_client.print(F("Content-Length: "));
-  http_client.println(body.length());
-  http_client.println();
-  http_client.println(body);
-
-  //Serial.print("*TH: [httpclient body] ");
-  //Serial.println(body);
-
-  fetch_data(&http_client);
-}
+#ifndef __DISABLE_HTTPS__
+  return &https_client;
+#else
+  return &http_client;
 #endif
+}
 
-#ifdef __DISABLE_HTTPS__
-void THiNX::fetch_data(WiFiClient *client)
-{
-
-  unsigned long benchmark_start = 0;
+/*
+ * Opens the API connection, the one step of a check-in that blocks loop(): DNS is bounded by the resolver,
+ * the TCP connect and the TLS handshake by THINX_CONNECT_TIMEOUT.
+ */
 
-  char buf[768];
-  int pos = 0;
-  unsigned long time_out = millis() + 30000;
+bool THiNX::checkin_connect()
+{
+  checkin_reused = false;
 
-  while (!client->available())
+  if (api_keep_alive && api_client()->connected())
   {
-    if (millis() > time_out)
-    {
-#ifdef DEBUG
-      if (logging)
-        Serial.println(F("*TH: HTTP request timeout."));
-#endif
-      return;
-    }
-    yield();
+    checkin_reused = true;
+    api_connections_reused++;
+    return true;
   }
 
-  int bytes = 0;
-
-  // Read while connected
-  bool headers_passed = false;
-  benchmark_start = millis();
-  while (client->available())
-  {
-    String line = "    ";
-    if (!headers_passed)
-    {
-      line = client->readStringUntil('\n');
-      bytes += line.length();
-      if (line.length() < 3)
-      {
-        headers_passed = true;
-      }
-    }
-    else
-    {
-      buf[pos] = client->read();
-      bytes++;
-      pos++;
-    }
-  }
+#ifndef __DISABLE_HTTPS__
 
-  buf[pos] = '\0'; // add null termination for any case...
-  client->stop();  // ??
+  int ret = ESP.getFreeHeap();
 
-  unsigned long benchmark_time = millis() - benchmark_start;
-#ifdef DEBUG
-  Serial.print(F("Fetched "));
-  Serial.print(bytes);
-  Serial.print(F(" bytes in "));
-  Serial.print(benchmark_time);
-  Serial.println(" ms");
-  //Serial.println(String(buf));
-#endif
-  double in_second = double(1000) / double(benchmark_time);
-  benchmark_speed = double(bytes * in_second / 1000);
 #ifdef DEBUG
-  Serial.print(F("Benchmark speed is "));
-  Serial.print(benchmark_speed);
-  Serial.println(F(" kb/s"));
+  if (logging)
+    Serial.println(F("Secure API checkin..."));
 #endif
 
-#ifdef DEBUG
-  if (pos == 0)
+  // Resolved first, so a DNS failure is not mistaken for a rejected handshake (or a failed MFLN probe)
+  IPAddress api_address;
+  if (!WiFi.hostByName(thinx_cloud_url, api_address))
   {
 #ifdef DEBUG
     if (logging)
-      Serial.printf("*TH: API Communication error, fix me now!\n");
+      Serial.println(F("*TH: API host not resolved."));
 #endif
+    return false;
   }
-#endif
-  parse(buf);
-}
-#endif
-
-#ifndef __DISABLE_HTTPS__
-void THiNX::fetch_data_secure(BearSSL::WiFiClientSecure *client)
-{
-  // if (logging) Serial.println(F("*TH: Waiting for API response..."));
-
-  char buf[768];
-  int pos = 0;
 
-  unsigned long interval = 30000;
-  unsigned long currentMillis = millis(), previousMillis = millis();
-
-  // Wait until client available or timeout...
-  unsigned long time_out = millis() + 30000;
-  // if (logging) Serial.println(F("*TH: Waiting for client..."));
+  https_client.stop();        // clears the TLS error of the previous connection
+  https_client.setInsecure(); // does not validate anything, very dangerous!
 
-  while (!client->available())
-  {
-    if (millis() > time_out)
-    {
-      if (logging)
-        Serial.println(F("*TH: Client NOT available."));
-      return;
-    }
-    yield();
-  }
+  // connect() blocks loop(): the TCP connect and every handshake read wait up to the client timeout
+  https_client.setTimeout(THINX_CONNECT_TIMEOUT);
 
-  // Read while connected
-  bool headers_passed = false;
-  while (client->available())
+  uint16_t mfln = mfln_buffer_size(); // probes only on first use, host or firmware change
+  if (mfln > 0)
   {
-    String line = "    ";
-    if (!headers_passed)
-    {
-      line = client->readStringUntil('\n');
-      yield();
-      if (line.length() < 3)
-      {
-        headers_passed = true;
-      }
-    }
-    else
-    {
-      buf[pos] = client->read();
-      yield();
-      pos++;
-    }
-  }
-
-#ifdef DEBUG
-  // if (logging) Serial.println();
-#endif
-  buf[pos] = '\0'; // add null termination for any case...
-  client->stop();  // ??
 #ifdef DEBUG
-  // if (logging) Serial.println();
-  if (pos == 0)
-  {
     if (logging)
-      Serial.printf("*TH: API Communication error, fix me now!\n");
-  }
-#endif
-  parse(buf);
-}
-#endif
-
-#ifndef __DISABLE_HTTPS__
-/* Secure version */
-void THiNX::send_data_secure(const String &body)
-{
-
-  int ret = ESP.getFreeHeap();
-
-#ifdef DEBUG
-  if (logging)
-    Serial.println(F("Secure API checkin..."));
+      Serial.printf("Setting MFLN buffer sizes to %u\n", mfln);
 #endif
+    https_client.setBufferSizes(mfln, mfln);
+  }
 
-  https_client.setInsecure(); // does not validate anything, very dangerous!
-
-  bool mfln = https_client.probeMaxFragmentLength(thinx_cloud_url, 7443, 512);
-#ifdef DEBUG
-  if (logging)
-    Serial.printf("MFLN supported: %s\n", mfln ? "yes" : "no");
-#endif
-  if (mfln)
+  if (api_keep_alive)
   {
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("Setting MFLN buffer sizes to 512"));
-#endif
-    https_client.setBufferSizes(512, 512);
+    https_client.setSession(&api_tls_session);
   }
 
   if (!https_client.connect(thinx_cloud_url, 7443))
@@ -846,140 +866,561 @@ void THiNX::send_data_secure(const String &body)
     if (logging)
       Serial.println(F("*TH: API connection failed."));
 #endif
-    return;
+    // TCP failures leave the caches alone, only a failed handshake may be caused by them
+    if (https_client.getLastSSLError() != 0)
+    {
+      api_tls_session = BearSSL::Session(); // do not offer a session the server may have rejected
+      api_tls_session_cached = false;
+      mfln_invalidate();                    // server may have changed its MFLN support
+    }
+    return false;
+  }
+
+  if (api_keep_alive && api_tls_session_cached)
+  {
+    api_handshakes_offered++;
   }
   else
   {
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("HTTPS Client connected."));
-#endif
+    api_handshakes_full++;
   }
+  api_tls_session_cached = api_keep_alive;
 
 #ifdef DEBUG
+  if (logging)
+    Serial.println(F("HTTPS Client connected."));
   if (logging)
     Serial.printf("MFLN status: %s\n", https_client.getMFLNStatus() ? "true" : "false");
   if (logging)
     Serial.printf("Memory used: %d\n", ret - ESP.getFreeHeap());
 #endif
 
-  https_client.println(F("POST /device/register HTTP/1.1"));
-  https_client.print(F("Host: "));
-  https_client.println(thinx_cloud_url);
-  https_client.print(F("Authentication: "));
-  https_client.println(thinx_api_key);
-  https_client.println(F("Accept: application/json")); // application/json
-  https_client.println(F("Origin: device"));
-  https_client.println(F("Content-Type: application/json"));
-  https_client.println(F("User-Agent: THiNX-Client"));
-  https_client.print(F("Content-Length: "));
-  https_client.println(body.length());
-  https_client.println();
-  https_client.println(body);
+#else
+
+  http_client.setTimeout(THINX_CONNECT_TIMEOUT); // connect() blocks loop() up to this long
+  if (!http_client.connect(thinx_cloud_url, 7442))
+  {
+    if (logging)
+      Serial.println(F("*TH: API connection failed."));
+    return false;
+  }
+  api_handshakes_full++;
 
-  fetch_data_secure(&https_client);
-}
 #endif
+  return true;
+}
+
+#ifndef __DISABLE_HTTPS__
 
 /*
- * Response Parser
+ * BearSSL max fragment length cache
  */
 
-int strpos(char *hay, char *needle, int offset)
-{
-  char haystack[strlen(hay)];
-  strncpy(haystack, hay + offset, strlen(hay) - offset);
-  char *p = strstr(haystack, needle);
-  if (p)
-    return p - haystack + offset;
-  return -1;
-}
+#define MFLN_PROBE_SIZE 512
+#define MFLN_CACHE_FILE "/thinx.mfl"
 
-void THiNX::parse(const char *pload)
+uint16_t THiNX::mfln_buffer_size()
 {
-  if (ESP.getFreeHeap() < strlen(pload))
-  { // should be at least 4K for SSL!
-    if (logging)
-      Serial.println(F("*TH: Not enough RAM to parse!"));
-    Serial.flush();
-    delay(5000);
-    ESP.restart();
-    return;
-  }
-
-  payload_type ptype = Unknown;
+  bool host_fits = strlen(thinx_cloud_url) < sizeof(mfln_host);
 
-  int start_index = 0;
-
-  int32_t reg_index = (int32)strstr(pload, "\"registration");
-  int32_t upd_index = (int32)strstr(pload, "\"FIRMWARE_UPDATE");
-  int32_t not_index = (int32)strstr(pload, "\"notification");
-  int32_t cfg_index = (int32)strstr(pload, "\"configuration");
-
-  if (upd_index > start_index)
+  if (mfln_cached && host_fits && (strcmp(mfln_host, thinx_cloud_url) == 0))
   {
-    start_index = upd_index;
-    ptype = UPDATE;
+    return mfln_size;
   }
 
-  if (reg_index > start_index)
+  if (host_fits && mfln_restore())
   {
-    start_index = reg_index;
-    ptype = REGISTRATION;
+    return mfln_size;
   }
 
-  if (not_index > start_index)
-  {
-    start_index = not_index;
-    ptype = NOTIFICATION;
-  }
+  bool mfln = https_client.probeMaxFragmentLength(thinx_cloud_url, 7443, MFLN_PROBE_SIZE);
+#ifdef DEBUG
+  if (logging)
+    Serial.printf("MFLN supported: %s\n", mfln ? "yes" : "no");
+#endif
+  mfln_size = mfln ? MFLN_PROBE_SIZE : 0;
 
-  if (cfg_index > start_index)
+  if (host_fits)
   {
-    start_index = cfg_index;
-    ptype = CONFIGURATION;
+    strcpy(mfln_host, thinx_cloud_url);
+    mfln_cached = true;
+    mfln_save();
   }
+  return mfln_size;
+}
 
-  if (ptype == Unknown)
+bool THiNX::mfln_restore()
+{
+#ifdef __USE_SPIFFS__
+  File f = SPIFFS.open(MFLN_CACHE_FILE, "r");
+  if (!f)
   {
-#ifdef DEBUG
-    Serial.println(F("*THD: unknown ptype"));
-#endif
-    return;
+    return false;
   }
 
-  DynamicJsonDocument root(768); // hopefully this is enough, otherwise 200 bytes leak somewhere here
-
-  auto error = deserializeJson(root, pload);
-
+  DynamicJsonDocument doc(256);
+  auto error = deserializeJson(doc, f);
+  f.close();
   if (error)
   {
-    Serial.print(F("*THD: Failed parsing root node!"));
-    Serial.println(error.c_str());
-#ifdef DEBUG
-    Serial.println(pload);
-#endif
-    return;
+    return false;
   }
 
-  switch (ptype)
+  // valid only for the same host and the firmware that stored it
+  const char *host = doc["host"] | "";
+  const char *firmware = doc["fw"] | "";
+  if ((strcmp(host, thinx_cloud_url) != 0) || (strcmp(firmware, app_version) != 0))
   {
-
+    return false;
+  }
+
+  mfln_size = doc["mfln"] | 0;
+  strcpy(mfln_host, thinx_cloud_url);
+  mfln_cached = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void THiNX::mfln_save()
+{
+#ifdef __USE_SPIFFS__
+  DynamicJsonDocument doc(256);
+  doc["host"] = (const char *)mfln_host;
+  doc["fw"] = app_version;
+  doc["mfln"] = mfln_size;
+
+  File f = SPIFFS.open(MFLN_CACHE_FILE, "w");
+  if (f)
+  {
+    serializeJson(doc, f);
+    f.close();
+  }
+#endif
+}
+
+void THiNX::mfln_invalidate()
+{
+  mfln_cached = false;
+  mfln_host[0] = 0;
+#ifdef __USE_SPIFFS__
+  if (SPIFFS.exists(MFLN_CACHE_FILE))
+  {
+    SPIFFS.remove(MFLN_CACHE_FILE);
+  }
+#endif
+
+}
+
+#endif
+
+WiFiClient *THiNX::mqtt_transport_client()
+{
+  if (mqtt_transport != nullptr)
+  {
+    return mqtt_transport;
+  }
+
+#ifndef __DISABLE_HTTPS__
+  BearSSL::WiFiClientSecure *tls = new BearSSL::WiFiClientSecure();
+  tls->setInsecure(); // same as API, does not validate anything
+
+  // Probed once per boot unless the broker is the API host, whose result is cached already
+  uint16_t mfln = 0;
+  if (strcmp(thinx_mqtt_url, thinx_cloud_url) == 0)
+  {
+    mfln = mfln_buffer_size();
+  }
+  else if (tls->probeMaxFragmentLength(thinx_mqtt_url, 8883, MFLN_PROBE_SIZE))
+  {
+    mfln = MFLN_PROBE_SIZE;
+  }
+  if (mfln > 0)
+  {
+    tls->setBufferSizes(mfln, mfln);
+  }
+  mqtt_transport = tls;
+#else
+  mqtt_transport = new WiFiClient();
+#endif
+  return mqtt_transport;
+}
+
+// true if value is embedded in the request head at offset, terminated by CRLF
+static bool request_head_embeds(const char *head, size_t offset, const char *value)
+{
+  size_t length = strlen(value);
+  return (strncmp(head + offset, value, length) == 0) && (head[offset + length] == '\r');
+}
+
+bool THiNX::request_head_valid()
+{
+  return (api_request_head != nullptr) &&
+         (api_request_head_keep_alive == api_keep_alive) &&
+         request_head_embeds(api_request_head, api_request_head_host, thinx_cloud_url) &&
+         request_head_embeds(api_request_head, api_request_head_key, thinx_api_key);
+}
+
+bool THiNX::build_request_head()
+{
+  static const char format[] = "POST /device/register HTTP/1.1\r\n"
+                               "Host: %s\r\n"
+                               "Authentication: %s\r\n"
+                               "Accept: application/json\r\n"
+                               "Origin: device\r\n"
+                               "Content-Type: application/json\r\n"
+                               "User-Agent: THiNX-Client\r\n"
+                               "Connection: %s\r\n";
+
+  const char *connection = api_keep_alive ? "keep-alive" : "close";
+  int length = snprintf(nullptr, 0, format, thinx_cloud_url, thinx_api_key, connection);
+
+  free(api_request_head);
+  api_request_head = (char *)malloc(length + THINX_CONTENT_LENGTH_SLOT);
+  if (api_request_head == nullptr)
+  {
+    api_request_head_length = 0;
+    return false;
+  }
+
+  snprintf(api_request_head, length + 1, format, thinx_cloud_url, thinx_api_key, connection);
+  api_request_head_length = length;
+  api_request_head_host = strlen("POST /device/register HTTP/1.1\r\nHost: ");
+  api_request_head_key = api_request_head_host + strlen(thinx_cloud_url) + strlen("\r\nAuthentication: ");
+  api_request_head_keep_alive = api_keep_alive;
+  return true;
+}
+
+bool THiNX::checkin_send()
+{
+  if (!request_head_valid() && !build_request_head())
+  {
+#ifdef DEBUG
+    if (logging)
+      Serial.println(F("*TH: Out of memory for request headers."));
+#endif
+    return false;
+  }
+
+  WiFiClient *client = api_client();
+  size_t body_length = strlen(json_buffer);
+
+  // Headers and body go out in two writes, so they don't get split into a segment/record per line
+  int tail = snprintf(api_request_head + api_request_head_length, THINX_CONTENT_LENGTH_SLOT,
+                      "Content-Length: %u\r\n\r\n", (unsigned)body_length);
+  client->write((const uint8_t *)api_request_head, api_request_head_length + tail);
+  client->write((const uint8_t *)json_buffer, body_length);
+  return true;
+}
+
+void THiNX::checkin_abort()
+{
+  api_client()->stop();
+  checkin_body_release();
+  thinx_checkin_state = CHECKIN_IDLE;
+}
+
+bool THiNX::checkin_body_grow()
+{
+  size_t capacity = api_body_capacity * 2;
+  if (api_response.contentLength() > (long)capacity)
+  {
+    capacity = api_response.contentLength(); // one allocation when the size is known
+  }
+  if (capacity > THINX_RESPONSE_LIMIT)
+  {
+    capacity = THINX_RESPONSE_LIMIT;
+  }
+  if (capacity <= api_body_length)
+  {
+    return false;
+  }
+
+  char *grown = (char *)malloc(capacity);
+  if (grown == nullptr)
+  {
+    return false;
+  }
+  memcpy(grown, api_body_data, api_body_length);
+  checkin_body_release();
+  api_body_data = grown;
+  api_body_capacity = capacity;
+  return true;
+}
+
+void THiNX::checkin_body_release()
+{
+  if (api_body_data != api_body)
+  {
+    free(api_body_data);
+  }
+  api_body_data = api_body;
+  api_body_capacity = sizeof(api_body);
+}
+
+/*
+ * Response Parser
+ */
+
+// Read-only Stream over a zero-terminated payload (MQTT message, stored data)
+class PayloadStream : public Stream
+{
+public:
+  PayloadStream(const char *payload) : _position(payload) { setTimeout(0); }
+  int available() { return strlen(_position); }
+  int read() { return *_position ? (unsigned char)*_position++ : -1; }
+  int peek() { return *_position ? (unsigned char)*_position : -1; }
+  size_t write(uint8_t) { return 0; }
+
+private:
+  const char *_position;
+};
+
+// Check-in response body as collected by CHECKIN_READ_BODY, not zero-terminated
+class ResponseBodyStream : public Stream
+{
+public:
+  ResponseBodyStream(const char *buffer, size_t length)
+      : _buffer(buffer), _length(length), _position(0) { setTimeout(0); }
+  int available() { return _length - _position; }
+  int read() { return (_position < _length) ? (unsigned char)_buffer[_position++] : -1; }
+  int peek() { return (_position < _length) ? (unsigned char)_buffer[_position] : -1; }
+  size_t write(uint8_t) { return 0; }
+
+private:
+  const char *_buffer;
+  size_t _length;
+  size_t _position;
+};
+
+/*
+ * Envelope tokenizer: payloads are objects like {"registration":{...}}, the first known
+ * top-level key decides the payload type and only its value is deserialized.
+ */
+
+static int envelope_read(Stream &s)
+{
+  char c;
+  return s.readBytes(&c, 1) ? (unsigned char)c : -1; // honours stream timeout like ArduinoJson does
+}
+
+static int envelope_next(Stream &s) // next non-whitespace character
+{
+  int c;
+  do
+  {
+    c = envelope_read(s);
+  } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+  return c;
+}
+
+// reads key after opening quote; false for keys that do not fit (these are never envelopes)
+static bool envelope_read_key(Stream &s, char *key, size_t size)
+{
+  size_t length = 0;
+  bool fits = true;
+  int c;
+  while ((c = envelope_read(s)) != '"')
+  {
+    if (c < 0)
+      return false;
+    if (c == '\\')
+    {
+      envelope_read(s);
+      fits = false;
+    }
+    if (length < size - 1)
+      key[length++] = c;
+    else
+      fits = false;
+  }
+  key[length] = 0;
+  return fits;
+}
+
+// skips value starting with c, returns first non-whitespace character after it or -1
+static int envelope_skip_value(Stream &s, int c)
+{
+  int depth = 0;
+  bool in_string = false;
+  while (c >= 0)
+  {
+    if (in_string)
+    {
+      if (c == '\\')
+      {
+        envelope_read(s);
+      }
+      else if (c == '"')
+      {
+        in_string = false;
+        if (depth == 0)
+          return envelope_next(s);
+      }
+    }
+    else if (c == '"')
+    {
+      in_string = true;
+    }
+    else if (c == '{' || c == '[')
+    {
+      depth++;
+    }
+    else if (c == '}' || c == ']')
+    {
+      if (depth == 0)
+        return c; // end of envelope after primitive
+      if (--depth == 0)
+        return envelope_next(s);
+    }
+    else if (depth == 0)
+    {
+      if (c == ',')
+        return c;
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+        return envelope_next(s);
+    }
+    c = envelope_read(s);
+  }
+  return -1;
+}
+
+// Members read by parse_envelope(), anything else is skipped by the deserializer without allocating
+static const char *const registration_fields[] = {
+    "status", "alias", "owner", "udid", "auto_update", "forced_update", "timestamp",
+    "mac", "version", "env_hash", "url", "ott", "mqtt_alias"};
+static const char *const notification_fields[] = {"response_type", "response"};
+
+static void allow_fields(JsonDocument &filter, const char *const *fields, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    filter[fields[i]] = true;
+  }
+}
+
+static THiNX::payload_type envelope_type(const char *key)
+{
+  if (strcmp(key, "registration") == 0)
+    return THiNX::REGISTRATION;
+  if (strcmp(key, "notification") == 0)
+    return THiNX::NOTIFICATION;
+  if (strcmp(key, "configuration") == 0)
+    return THiNX::CONFIGURATION;
+  return THiNX::Unknown;
+}
+
+void THiNX::parse(const char *pload)
+{
+  if (ESP.getFreeHeap() < strlen(pload))
+  { // should be at least 4K for SSL!
+    if (logging)
+      Serial.println(F("*TH: Not enough RAM to parse!"));
+    Serial.flush();
+    delay(5000);
+    ESP.restart();
+    return;
+  }
+
+  PayloadStream payload(pload);
+  parse(payload);
+}
+
+void THiNX::parse(Stream &body)
+{
+  sample_memory(telemetry_parse);
+  parse_stream(body);
+  sample_memory(telemetry_parse);
+}
+
+void THiNX::parse_stream(Stream &body)
+{
+  char key[16]; // longest envelope key is "configuration"
+
+  if (envelope_next(body) != '{')
+  {
+    Serial.println(F("*THD: Failed parsing root node!"));
+    return;
+  }
+
+  int c = envelope_next(body);
+  while (c == '"')
+  {
+    if (!envelope_read_key(body, key, sizeof(key)))
+    {
+      key[0] = 0;
+    }
+    if (envelope_next(body) != ':')
+    {
+      break;
+    }
+
+    payload_type ptype = envelope_type(key);
+    if (ptype != Unknown)
+    {
+      StaticJsonDocument<JSON_OBJECT_SIZE(13)> filter; // keys are not copied
+      if (ptype == REGISTRATION)
+      {
+        allow_fields(filter, registration_fields, sizeof(registration_fields) / sizeof(registration_fields[0]));
+      }
+      else if (ptype == NOTIFICATION)
+      {
+        allow_fields(filter, notification_fields, sizeof(notification_fields) / sizeof(notification_fields[0]));
+      }
+      else
+      {
+        filter.set(true); // configuration is forwarded to the callback as a whole
+      }
+
+      DynamicJsonDocument envelope(THINX_RESPONSE_CAPACITY); // holds only the envelope subtree
+      auto error = deserializeJson(envelope, body, DeserializationOption::Filter(filter));
+      if (error)
+      {
+        Serial.print(F("*THD: Failed parsing envelope: "));
+        Serial.println(error.c_str());
+        return;
+      }
+      if ((ptype == REGISTRATION) && (envelope["status"] == "FIRMWARE_UPDATE"))
+      {
+        ptype = UPDATE;
+      }
+      parse_envelope(ptype, envelope.as<JsonObject>());
+      return;
+    }
+
+    c = envelope_skip_value(body, envelope_next(body));
+    if (c != ',')
+    {
+      break;
+    }
+    c = envelope_next(body);
+  }
+
+#ifdef DEBUG
+  Serial.println(F("*THD: unknown ptype"));
+#endif
+}
+
+void THiNX::parse_envelope(payload_type ptype, JsonObject envelope)
+{
+  switch (ptype)
+  {
+
   case UPDATE:
   {
 
-    JsonObject update = root["registration"];
+    JsonObject update = envelope;
 
     String alias = update["alias"];
     if (alias.length() > 4)
     {
-      thinx_alias = strdup(alias.c_str());
+      identity_copy(thinx_alias, alias.c_str());
     }
 
    String udid = update["udid"];
-   if (strlen(udid.c_str()) <= 37)
+   if (identity_copy(thinx_udid, udid.c_str()))
    {
-     thinx_udid = strdup(udid.c_str());
      Serial.print("UDID: ");
      Serial.println(thinx_udid);
    }
@@ -1044,7 +1485,7 @@ void THiNX::parse(const char *pload)
           if (logging)
             Serial.println(F("*TH: firmware has same version and env. Firmware has been already installed."));
 #endif
-          available_update_url = "";
+          available_update_url[0] = 0;
           notify_on_successful_update();
           return;
         }
@@ -1066,7 +1507,7 @@ void THiNX::parse(const char *pload)
         if (logging)
           Serial.println(F("*TH: firmware has same version and no env. Firmware has been already installed."));
 #endif
-        available_update_url = "";
+        available_update_url[0] = 0;
         notify_on_successful_update();
         return;
       }
@@ -1125,7 +1566,7 @@ void THiNX::parse(const char *pload)
         update_url.replace(":7443", "");
         update_url.replace(thinx_cloud_url, "");
         deferred_update_url = String(update_url); // needs a copy because string will not exist later
-        available_update_url = deferred_update_url.c_str();
+        identity_copy(available_update_url, deferred_update_url.c_str());
         return;
       }
       return;
@@ -1139,7 +1580,7 @@ void THiNX::parse(const char *pload)
     Serial.println("notification...");
 
     // Currently, this is used for update only, can be extended with request_category or similar.
-    JsonObject notification = root["notification"];
+    JsonObject notification = envelope;
 
     if (notification.isNull())
     {
@@ -1200,7 +1641,7 @@ void THiNX::parse(const char *pload)
   case REGISTRATION:
   {
 
-    JsonObject registration = root["registration"];
+    JsonObject registration = envelope;
 
     if (registration.isNull())
     {
@@ -1220,13 +1661,20 @@ void THiNX::parse(const char *pload)
       String alias = registration["alias"];
       if (alias.length() > 1 && (alias.indexOf("null") != 0))
       {
-        thinx_alias = strdup(alias.c_str());
+        identity_copy(thinx_alias, alias.c_str());
       }
 
       String owner = registration["owner"];
       if (owner.length() > 4)
       {
-        strcpy(thinx_owner, owner.c_str());
+        identity_copy(thinx_owner, owner.c_str());
+      }
+
+      // Takes effect with the next MQTT connect, so subscription and publishes never mix both channel forms
+      const char *mqtt_alias = registration["mqtt_alias"];
+      if (mqtt_alias != nullptr)
+      {
+        identity_copy(thinx_mqtt_alias, mqtt_alias);
       }
 
       String udid = registration["udid"];
@@ -1234,7 +1682,7 @@ void THiNX::parse(const char *pload)
       const char *udid_s = udid.c_str();
       if (strlen(udid_s) == 36)
       {
-        strcpy(thinx_udid, udid_s);
+        identity_copy(thinx_udid, udid_s);
       } else {
         Serial.print("Skipped UDID length = "); Serial.println(strlen(udid.c_str()));
       }
@@ -1267,9 +1715,9 @@ void THiNX::parse(const char *pload)
       // Warning, this branch may be deprecated!
 
       const char* udid = registration["udid"];
-      if (strlen(udid) > 4)
+      if ((udid != nullptr) && (strlen(udid) > 4))
       {
-        thinx_udid = strdup(udid);
+        identity_copy(thinx_udid, udid);
       }
 
 #ifdef DEBUG
@@ -1361,7 +1809,7 @@ void THiNX::parse(const char *pload)
   case CONFIGURATION:
   {
 
-    JsonObject configuration = root["configuration"];
+    JsonObject configuration = envelope;
 
     if (configuration.isNull())
     {
@@ -1413,10 +1861,17 @@ void THiNX::parse(const char *pload)
     }
 #endif
 
-    // Forward update body to the library user, impacts stack with pload again!
+    // Forward update body to the library user as {"configuration":{...}} (re-serialized, source may have been a stream)
     if (_config_callback != NULL)
     {
-      _config_callback((char *)pload);
+      static const char prefix[] = "{\"configuration\":";
+      size_t length = strlen(prefix) + measureJson(configuration) + 2;
+      char *pload = new char[length];
+      strcpy(pload, prefix);
+      serializeJson(configuration, pload + strlen(prefix), length - strlen(prefix));
+      strcat(pload, "}");
+      _config_callback(pload);
+      delete[] pload;
     }
   }
   break;
@@ -1432,18 +1887,42 @@ void THiNX::parse(const char *pload)
 
 void THiNX::init_thinx_mqtt_channel()
 {
-  snprintf(mqtt_device_channel, sizeof(mqtt_device_channel), "/%s/%s", thinx_owner, thinx_udid);
+  mqtt_channel_prefix(mqtt_device_channel, sizeof(mqtt_device_channel));
+  mqtt_device_channel_length = strlen(mqtt_device_channel);
+  generate_mqtt_status_channel();
+}
+
+/*
+ * In compact mode the server-assigned alias stands for /owner/udid, which cuts about 100 bytes from every
+ * message topic. Falls back to the full form until the alias is known.
+ */
+
+int THiNX::mqtt_channel_prefix(char *buffer, size_t size)
+{
+  if (mqtt_compact_topics && (thinx_mqtt_alias[0] != 0))
+  {
+    return snprintf(buffer, size, "/a/%s", thinx_mqtt_alias);
+  }
+  return snprintf(buffer, size, "/%s/%s", thinx_owner, thinx_udid);
 }
 
 String THiNX::thinx_mqtt_channels()
 {
-  snprintf(mqtt_device_channels, sizeof(mqtt_device_channels), "/%s/%s/#", thinx_owner, thinx_udid);
+  int length = mqtt_channel_prefix(mqtt_device_channels, sizeof(mqtt_device_channels));
+  if ((length > 0) && ((size_t)length < sizeof(mqtt_device_channels)))
+  {
+    snprintf(mqtt_device_channels + length, sizeof(mqtt_device_channels) - length, "/#");
+  }
   return String(mqtt_device_channels);
 }
 
 char *THiNX::generate_mqtt_status_channel()
 {
-  snprintf(mqtt_device_status_channel, sizeof(mqtt_device_status_channel), "/%s/%s/status", thinx_owner, thinx_udid);
+  int length = mqtt_channel_prefix(mqtt_device_status_channel, sizeof(mqtt_device_status_channel));
+  if ((length > 0) && ((size_t)length < sizeof(mqtt_device_status_channel)))
+  {
+    snprintf(mqtt_device_status_channel + length, sizeof(mqtt_device_status_channel) - length, "/status");
+  }
   return mqtt_device_status_channel;
 }
 
@@ -1459,27 +1938,36 @@ unsigned long THiNX::epoch()
 
 void THiNX::notify_on_successful_update()
 {
-  // Notify on reboot for update
-  if (mqtt_client != nullptr)
+  // Queued when connected, otherwise stored in the SPIFFS outbox and sent after the reboot
+  strncpy_P(json_buffer, PSTR("{ title: \"Update Successful\", body: \"The device has been successfully updated.\", type: \"success\" }"), sizeof(json_buffer));
+  generate_mqtt_status_channel();
+  bool accepted = publish_or_store(mqtt_device_status_channel, (const uint8_t *)json_buffer, strlen(json_buffer), false);
+#ifdef __USE_SPIFFS__
+  mqtt_outbox.flush(); // the device is about to reboot
+#endif
+
+  if ((mqtt_client == nullptr) || !mqtt_client->connected())
   {
-    mqtt_client->publish(
-        mqtt_device_status_channel,
-        F("{ title: \"Update Successful\", body: \"The device has been successfully updated.\", type: \"success\" }"));
-    unsigned long tout = millis() + 5000;
-    while (millis() < tout)
+    if (logging)
     {
-      mqtt_client->loop();
-      delay(10);
+      if (accepted)
+        Serial.println(F("*TH: Device updated but MQTT not active, notification stored."));
+      else
+        Serial.println(F("*TH: Device updated but MQTT not active to notify."));
     }
-    mqtt_client->disconnect();
-    mqtt_client->loop();
-    delay(10);
+    return;
   }
-  else
+
+  // Let the queue go out before disconnecting
+  unsigned long start = millis();
+  while ((mqtt_client->queued() > 0) && (millis() - start < 5000))
   {
-    if (logging)
-      Serial.println(F("*TH: Device updated but MQTT not active to notify. TODO: Store."));
+    mqtt_client->loop();
+    delay(10);
   }
+  mqtt_client->disconnect();
+  mqtt_client->loop();
+  delay(10);
 }
 
 /*
@@ -1488,160 +1976,189 @@ void THiNX::notify_on_successful_update()
 
 void THiNX::publish_status_unretained(const char *message)
 {
-  // Early exit
-  if ((mqtt_client == nullptr) || (mqtt_client == NULL))
-  {
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT not active while trying to publish retained status."));
-#endif
-    return;
-  }
-
-  publish_status(message, false);
-  if (mqtt_client)
-  {
-    mqtt_client->loop(); // kicks the MQTT immediately (if any)
-    delay(10);
-  }
+  publish_status(message, false); // queued, sent by loop()
 }
 
 void THiNX::publish_status(const char *message, bool retain)
 {
-
-  // Early exit
-  if (mqtt_client == nullptr)
-  {
 #ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT not active while trying to publish retained status."));
+  // if (logging) Serial.print("*TH > "); Serial.println(message);
 #endif
-    return;
-  }
 
-#ifdef DEBUG
-  // if (logging) Serial.print("*TH > "); Serial.println(message);
-#endif
+  // Stored while MQTT is down, loop() reconnects with backoff
+  publish_or_store(mqtt_device_status_channel, (const uint8_t *)message, strlen(message), retain);
+}
+
+/*
+ * Sends a MQTT message to the Device Channel (/owner/udid)
+ */
+
+void THiNX::publish(const String &message, const String &topic, bool retain)
+{
+  publish_device_topic(topic.c_str(), (const uint8_t *)message.c_str(), message.length(), retain);
+}
+
+void THiNX::publish(const char *message, const char *topic, bool retain)
+{
+  publish_device_topic(topic, (const uint8_t *)message, strlen(message), retain);
+}
 
-  if (mqtt_client->connected())
+void THiNX::publish_device_topic(const char *topic, const uint8_t *payload, size_t length, bool retain)
+{
+  char channel[256];
+  if (!device_topic(channel, sizeof(channel), topic))
   {
-    mqtt_client->publish(mqtt_device_status_channel, (const uint8_t *)message, strlen(message), retain);
-    mqtt_client->loop();
+    return;
   }
-  else
-  {
 
+  publish_or_store(channel, payload, length, retain); // encoded or stored, channel may go out of scope
+}
+
+bool THiNX::device_topic(char *channel, size_t size, const char *topic)
+{
+  // Channel prefix is prepared by init_thinx_mqtt_channel(), only the topic gets appended
+  size_t topic_length = strlen(topic);
+  if (mqtt_device_channel_length + 1 + topic_length >= size)
+  {
 #ifdef DEBUG
-    // printStackHeap("thx-pre-publish-status(R2-not-connected!)");
-    // Reconnection
     if (logging)
-      Serial.println(F("*TH: reconnecting MQTT in publish_status..."));
-      // printStackHeap("thx-pre-start");
+      Serial.println(F("*TH: MQTT topic too long."));
 #endif
-    mqtt_client = nullptr;
-    start_mqtt();
-    if (mqtt_client == nullptr)
-    {
-      Serial.println(F("*TH: MQTT init failed!"));
-      return;
-    }
+    return false;
+  }
+  memcpy(channel, mqtt_device_channel, mqtt_device_channel_length);
+  channel[mqtt_device_channel_length] = '/';
+  memcpy(channel + mqtt_device_channel_length + 1, topic, topic_length + 1);
+  return true;
+}
+
+/*
+ * Publishes length bytes read from stream to the Device Channel. The payload is copied from the stream to the
+ * socket in THINX_MQTT_STREAM_CHUNK pieces while the packet is being sent, so it never has to fit in RAM.
+ * Requires a connected client (large payloads are not stored offline) and bypasses the outbound queue.
+ */
+
+bool THiNX::publishStream(Stream &stream, size_t length, const char *topic, bool retain)
+{
+  if ((mqtt_client == nullptr) || !mqtt_client->connected())
+  {
 #ifdef DEBUG
-    // printStackHeap("thx-post-start");
+    if (logging)
+      Serial.println(F("*TH: MQTT not connected, stream not published."));
 #endif
-    unsigned long reconnect_timeout = millis() + 10000;
-    while (!mqtt_client->connected())
-    {
-      delay(10);
-      if (millis() > reconnect_timeout)
-      {
-        break;
-      }
-    }
+    return false;
+  }
 
-    if (!mqtt_client->connected())
-    {
-      // enable timeout if none
-      if (mqtt_reconnect_timeout == 0)
-      {
-        mqtt_reconnect_timeout = millis() + MQTT_RECONNECT_DELAY;
-      }
-      if (millis() > mqtt_reconnect_timeout)
+  char channel[256];
+  if (!device_topic(channel, sizeof(channel), topic))
+  {
+    return false;
+  }
+
+  return mqtt_client->publish(channel, [&stream, length](Client &client)
+                              {
+      uint8_t chunk[THINX_MQTT_STREAM_CHUNK];
+      size_t remaining = length;
+      while (remaining > 0)
       {
-        if (logging)
-          Serial.println(F("*TH: NOT Rebooting, but MQTT reconnect failed..."));
-        //Serial.flush();
-        //ESP.restart();
+        size_t n = stream.readBytes(chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk));
+        if ((n == 0) || (client.write(chunk, n) != n))
+        {
+          client.stop(); // the header announced the full length, the packet cannot be completed
+          return false;
+        }
+        remaining -= n;
+        yield();
       }
-      return; // early exit: no publish/loop until reconnected
-    }
-    else
-    {
-      mqtt_reconnect_timeout = 0;
-    }
+      return true; }, length, retain);
+}
 
-    mqtt_client->publish(mqtt_device_status_channel, (const uint8_t *)message, strlen(message), retain);
-    mqtt_client->loop();
+#ifdef __USE_SPIFFS__
+bool THiNX::publishFile(const char *path, const char *topic, bool retain)
+{
+  File f = SPIFFS.open(path, "r");
+  if (!f)
+  {
+    if (logging)
+      Serial.println(F("*TH: File to publish not found."));
+    return false;
   }
+  bool success = publishStream(f, f.size(), topic, retain);
+  f.close();
+  return success;
 }
+#endif
 
 /*
- * Sends a MQTT message to the Device Channel (/owner/udid)
+ * Queues a message for MQTT, or stores it in the SPIFFS outbox while MQTT is down.
+ * Once stored messages exist, new ones are appended behind them so ordering is kept.
  */
 
-// Old version, leaks strings, deprecated.
-void THiNX::publish(const String &message, const String &topic, bool retain)
+bool THiNX::publish_or_store(const char *channel, const uint8_t *payload, size_t length, bool retain)
 {
-  String channel = String(mqtt_device_channel) + String("/") + String(topic);
-  if (mqtt_client != nullptr)
+  bool connected = (mqtt_client != nullptr) && mqtt_client->connected();
+  bool stored = false;
+#ifdef __USE_SPIFFS__
+  if (connected && mqtt_outbox.pending())
   {
-    if (retain == true)
-    {
-      mqtt_client->publish(
-          MQTT::Publish(channel.c_str(), message.c_str()).set_retain());
-    }
-    else
+    mqtt_outbox.drain(*mqtt_client, THINX_OUTBOX_HANDOFF); // live messages go out directly once the backlog is gone
+  }
+  stored = mqtt_outbox.pending();
+#endif
+
+  if (connected && !stored)
+  {
+    if (mqtt_client->queue(channel, payload, length, retain))
     {
-      mqtt_client->publish(channel.c_str(), message.c_str());
+      return true;
     }
-    mqtt_client->loop();
-    delay(10);
   }
-  else
+
+#ifdef __USE_SPIFFS__
+  if (mqtt_outbox.append(channel, payload, length, retain))
   {
+    return true;
+  }
+#endif
+
 #ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT not active while trying to publish message."));
+  if (logging)
+    Serial.println(F("*TH: MQTT not active, message dropped."));
 #endif
-  }
+  return false;
 }
 
-void THiNX::publish(char *message, char *topic, bool retain)
+#ifdef __USE_SPIFFS__
+
+/*
+ * Writes offline messages to SPIFFS in batches and replays them in small bursts once MQTT is connected,
+ * so a long backlog does not starve loop() or the outbound queue.
+ */
+
+void THiNX::outbox_loop()
 {
-  char channel[256] = {0};
-  snprintf(channel, sizeof(channel), "%s/%s", mqtt_device_channel, topic);
-  if (mqtt_client != nullptr)
+  bool connected = (mqtt_client != nullptr) && mqtt_client->connected();
+  if (!connected && (mqtt_outbox.bufferAge() > THINX_OUTBOX_FLUSH_INTERVAL))
   {
-    if (retain == true)
-    {
-      mqtt_client->publish(
-          MQTT::Publish(channel, message).set_retain());
-    }
-    else
-    {
-      mqtt_client->publish(channel, message);
-    }
-    mqtt_client->loop();
-    delay(10);
+    mqtt_outbox.flush(); // while connected the buffer is drained from RAM
   }
-  else
+
+  if (!connected || !mqtt_outbox.pending())
   {
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT not active while trying to publish message."));
-#endif
+    return;
+  }
+
+  if (millis() - mqtt_outbox_drained < THINX_OUTBOX_INTERVAL)
+  {
+    return;
   }
+  mqtt_outbox_drained = millis();
+
+  mqtt_outbox.drain(*mqtt_client, THINX_OUTBOX_BURST);
 }
 
+#endif
+
 /*
  * Starts the MQTT client and attach callback function forwarding payload to parser.
  */
@@ -1653,8 +2170,14 @@ void setLastWill(const String &nextWill)
 
 void THiNX::setLastWill(const String &nextWill)
 {
+  lastWill = nextWill;
+  if (mqtt_client == nullptr)
+  {
+    return; // used by the first connect
+  }
   mqtt_client->disconnect();
-  start_mqtt();
+  mqtt_reconnect_attempts = 0;
+  mqtt_reconnect_loop(); // same client, resubscribed
 }
 
 bool THiNX::start_mqtt()
@@ -1665,146 +2188,458 @@ bool THiNX::start_mqtt()
     //Serial.println(F("*TH: start_mqtt()"));
 #endif
 
-  if (mqtt_client != nullptr)
+  if ((mqtt_client != nullptr) && mqtt_client->connected())
   {
+    mqtt_connected = true;
+    return true;
+  }
 
+  if (strlen(thinx_udid) < 4)
+  {
 #ifdef DEBUG
     if (logging)
-      Serial.println(F("*TH: MQTT client non-null, checking connected state..."));
+      Serial.println(F("*TH: MQTT NO-UDID!"));
+    Serial.flush();
 #endif
+    return false;
+  }
 
-    mqtt_connected = mqtt_client->connected();
-    if (mqtt_connected)
+  if (strlen(thinx_api_key) < 5)
+  {
+#ifdef DEBUG
+    if (logging)
+      Serial.println(F("*TH: API Key not set, exiting."));
+#endif
+    return false;
+  }
+
+  // The client is created once and reused for every reconnect
+  if (mqtt_client == nullptr)
+  {
+#ifdef DEBUG
+    if (logging)
+      Serial.println(F("*TH: Initializing new MQTTS client."));
+#endif
+
+#ifndef __DISABLE_HTTPS__
+    mqtt_client = new PubSubClient(*mqtt_transport_client(), thinx_mqtt_url, 8883);
+    mqtt_client->set_send_buffer(mqtt_send_buffer, sizeof(mqtt_send_buffer));
+#else
+    mqtt_client = new PubSubClient(*mqtt_transport_client(), thinx_mqtt_url);
+#endif
+    mqtt_client->set_queue(mqtt_queue, sizeof(mqtt_queue), THINX_MQTT_QUEUE_POLICY);
+    if (mqtt_persistent_session)
     {
-      return true;
+      // Unacknowledged messages exist only with a window, publish() waits for the acknowledgement otherwise
+      mqtt_client->set_inflight_window(THINX_MQTT_INFLIGHT_WINDOW);
+#ifdef __USE_SPIFFS__
+      mqtt_session_restore();
+#endif
     }
-    // ignore non-working MQTT for now (EAV does not use that much)
-    finalize();
+  }
+
+  init_thinx_mqtt_channel();
+
+  /*
+  #ifdef DEBUG
+    if (logging)
+      Serial.println(F("*TH: MQTT->connect()"));
+    if (logging)
+      Serial.print(F("*TH: UDID: "));
+    if (logging)
+      Serial.println(thinx_udid);
+    if (logging)
+      Serial.print(F("*TH: AK: "));
+    if (logging)
+      Serial.println(thinx_api_key);
+  #endif
+  */
+
+  // Client id is derived from the chip id, so a persistent session is found again after reboot
+  if (mqtt_client->connect(MQTT::Connect(thinx_mac())
+                               .set_clean_session(!mqtt_persistent_session)
+                               .set_will(mqtt_device_status_channel, lastWill.c_str())
+                               .set_auth(thinx_udid, thinx_api_key)
+                               .set_keepalive(45)))
+  {
+
+    mqtt_connected = true;
+    performed_mqtt_checkin = true;
+    mqtt_reconnect_attempts = 0;
+
+    // Routes of a previous connect are replaced, the channel changes once a compact alias is assigned
+    if ((mqtt_routed_channel[0] != 0) && (strcmp(mqtt_routed_channel, mqtt_device_channel) != 0))
+    {
+      char routed_topic[256];
+      mqtt_router.remove(mqtt_routed_channel);
+#ifdef __USE_SPIFFS__
+      if (snprintf(routed_topic, sizeof(routed_topic), "%s/%s", mqtt_routed_channel, THINX_OTA_TOPIC) < (int)sizeof(routed_topic))
+      {
+        mqtt_router.remove(routed_topic);
+      }
+#endif
+    }
+    strcpy(mqtt_routed_channel, mqtt_device_channel);
+
+    // Control messages on the device channel, application topics are routed by filters added to mqtt_router
+    mqtt_router.add(mqtt_device_channel, [this](const MQTT::Publish &pub)
+                              {
+      // Stream has been never tested so far...
+      if (pub.has_stream())
+      {
+
+        //#ifdef DEBUG
+        Serial.println(F("*TH: MQTT Type: Stream..."));
+        Serial.flush();
+        //#endif
+        if (_update_callback != nullptr)
+        {
+          _update_callback();
+        }
+
+        uint32_t startTime = millis();
+        uint32_t size = pub.payload_len();
+        if (ESP.updateSketch(*pub.payload_stream(), size, true, false))
+        {
+          // Notify on reboot for update
+          mqtt_client->publish(
+              mqtt_device_status_channel,
+              "{ \"status\" : \"rebooting\" }");
+          mqtt_client->disconnect();
+          pub.payload_stream()->stop();
+          if (logging)
+            Serial.printf("Update Success: %lu\nRebooting...\n", millis() - startTime);
+          Serial.flush();
+          ESP.restart();
+        }
+        else
+        {
+          if (logging)
+            Serial.println(F("*TH: ESP MQTT Stream update failed..."));
+          mqtt_client->publish(
+              mqtt_device_status_channel,
+              "{ \"status\" : \"mqtt_update_failed\" }");
+        }
+      }
+      else
+      {
+        if (logging)
+        {
+          //Serial.print(F("Payload string: "));
+          //Serial.println(pub.payload_string());
+        }
+        parse(pub.payload_string().c_str());
+        if (_mqtt_callback)
+        {
+          _mqtt_callback((byte *)pub.payload_string().c_str());
+        }
+      } }); // end-of-route
+
+#ifdef __USE_SPIFFS__
+    char ota_channel[256];
+    if (device_topic(ota_channel, sizeof(ota_channel), THINX_OTA_TOPIC))
+    {
+      mqtt_router.add(ota_channel, [this](const MQTT::Publish &pub)
+                      { mqtt_update_handle(pub); });
+    }
+#endif
+
+    // Unrouted application topics skip the parser
+    mqtt_client->set_router(mqtt_router);
+    mqtt_client->set_callback([this](const MQTT::Publish &pub)
+                              {
+      if (_mqtt_callback && !pub.has_stream())
+      {
+        _mqtt_callback((byte *)pub.payload_string().c_str());
+      } }); // end-of-callback
+
+    return true;
+  }
+  else
+  {
+    mqtt_connected = false;
+#ifdef DEBUG
+    if (logging)
+      Serial.println(F("*TH: MQTT Not connected."));
+#endif
+    return false;
+  }
+}
+
+/*
+ * With a persistent session the broker keeps the subscription (and queues QoS 1 messages while the device is away),
+ * so the SUBSCRIBE round trip is only needed when it reports no session.
+ */
+
+bool THiNX::mqtt_subscribe()
+{
+  if (mqtt_persistent_session && mqtt_client->session_present())
+  {
     return true;
   }
+  uint8_t qos = mqtt_persistent_session ? 1 : 0;
+
+#ifdef __USE_SPIFFS__
+  char ota_channel[256];
+  if (device_topic(ota_channel, sizeof(ota_channel), THINX_OTA_TOPIC) && !mqtt_client->subscribe(ota_channel, qos))
+  {
+    return false;
+  }
+#endif
+
+  return mqtt_client->subscribe(mqtt_device_channel, qos);
+}
+
+#ifdef __USE_SPIFFS__
+
+/*
+ * Client side of a persistent session: packet id counter and encoded unacknowledged QoS 1/2 messages.
+ * Format: next packet id (2 bytes), then length (2 bytes) and packet for each message.
+ */
+
+#define MQTT_SESSION_FILE "/thinx.ms"
+
+void THiNX::mqtt_session_restore()
+{
+  File f = SPIFFS.open(MQTT_SESSION_FILE, "r");
+  if (!f)
+  {
+    return;
+  }
+
+  uint8_t word[2];
+  if (f.read(word, 2) == 2)
+  {
+    mqtt_client->set_next_packet_id((word[0] << 8) | word[1]);
+    while (f.read(word, 2) == 2)
+    {
+      uint16_t length = (word[0] << 8) | word[1];
+      if ((length > sizeof(json_buffer)) || (f.read((uint8_t *)json_buffer, length) != length))
+      {
+        break;
+      }
+      mqtt_client->restore_inflight((const uint8_t *)json_buffer, length);
+    }
+  }
+  f.close();
+
+  mqtt_session_saved_id = mqtt_client->next_packet_id();
+  mqtt_session_saved_inflight = mqtt_client->inflight();
+#ifdef DEBUG
+  if (logging)
+    Serial.printf("*TH: MQTT session restored, %u messages in flight\n", mqtt_session_saved_inflight);
+#endif
+}
+
+void THiNX::mqtt_session_save()
+{
+  File f = SPIFFS.open(MQTT_SESSION_FILE, "w");
+  if (!f)
+  {
+    return;
+  }
+
+  uint16_t id = mqtt_client->next_packet_id();
+  uint8_t word[2] = {(uint8_t)(id >> 8), (uint8_t)id};
+  f.write(word, 2);
+
+  uint32_t length;
+  const uint8_t *packet;
+  for (uint8_t i = 0; (packet = mqtt_client->inflight_packet(i, length)) != nullptr; i++)
+  {
+    if (length > sizeof(json_buffer))
+    {
+      continue; // would not fit the restore buffer
+    }
+    word[0] = length >> 8;
+    word[1] = length;
+    f.write(word, 2);
+    f.write(packet, length);
+  }
+  f.close();
+
+  mqtt_session_saved_id = id;
+  mqtt_session_saved_inflight = mqtt_client->inflight();
+}
+
+void THiNX::mqtt_session_loop()
+{
+  if (!mqtt_persistent_session || (mqtt_client == nullptr))
+  {
+    return;
+  }
+
+  // Every new message takes a packet id and every acknowledgement lowers the count
+  if ((mqtt_client->next_packet_id() != mqtt_session_saved_id) || (mqtt_client->inflight() != mqtt_session_saved_inflight))
+  {
+    mqtt_session_save();
+  }
+}
+
+#endif
+
+/*
+ * Reconnect backoff. Each failed attempt doubles the window up to MQTT_RECONNECT_DELAY and the actual wait is
+ * drawn uniformly from it (full jitter), so devices that lost the same broker do not return all at once.
+ */
+
+bool THiNX::mqtt_reconnect_due()
+{
+  return (mqtt_reconnect_attempts == 0) || (millis() - mqtt_reconnect_since >= mqtt_reconnect_wait);
+}
+
+void THiNX::mqtt_reconnect_backoff()
+{
+  unsigned long window = MQTT_RECONNECT_DELAY;
+  if (mqtt_reconnect_attempts < 16)
+  {
+    window = min((unsigned long)MQTT_RECONNECT_BASE << mqtt_reconnect_attempts, (unsigned long)MQTT_RECONNECT_DELAY);
+  }
+  if (mqtt_reconnect_attempts < 255)
+  {
+    mqtt_reconnect_attempts++;
+  }
+  mqtt_reconnect_since = millis();
+  mqtt_reconnect_wait = random(window + 1);
+
+#ifdef DEBUG
+  if (logging)
+    Serial.printf("*TH: MQTT reconnect #%u in %lu ms\n", mqtt_reconnect_attempts, mqtt_reconnect_wait);
+#endif
+}
+
+/*
+ * Called from loop() once the device is checked in; restores a dropped MQTT connection without blocking
+ * between attempts and resubscribes the device channel.
+ */
+
+void THiNX::mqtt_reconnect_loop()
+{
+  if ((mqtt_client == nullptr) || mqtt_client->connected())
+  {
+    return;
+  }
+
+  mqtt_connected = false;
+  if (!mqtt_reconnect_due())
+  {
+    return;
+  }
+
+  if (!start_mqtt())
+  {
+    mqtt_reconnect_backoff();
+    return;
+  }
+
+  if (!mqtt_subscribe())
+  {
+#ifdef DEBUG
+    if (logging)
+      Serial.println(F("*TH: MQTT resubscribe failed."));
+#endif
+    mqtt_client->disconnect();
+    mqtt_connected = false;
+    mqtt_reconnect_backoff();
+    return;
+  }
+
+#ifdef __USE_SPIFFS__
+  mqtt_update_resume();
+#endif
 
-  if (strlen(thinx_udid) < 4)
+  if (_mqtt_connect_callback != nullptr)
   {
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT NO-UDID!"));
-    Serial.flush();
-#endif
-    return false;
+    _mqtt_connect_callback(); // application resubscribes its own topics
   }
+}
 
-#ifdef DEBUG
-  if (logging)
-    Serial.println(F("*TH: Initializing new MQTTS client."));
-#endif
+#ifdef __USE_SPIFFS__
 
-#ifndef __DISABLE_HTTPS__
-  mqtt_client = new PubSubClient(https_client, thinx_mqtt_url, 8883);
-#else
-  mqtt_client = new PubSubClient(http_client, thinx_mqtt_url);
-#endif
+/*
+ * Chunked OTA over MQTT, see MQTTUpdate for the message format. Every message is acknowledged with the offset
+ * of the next expected byte, which also serves as progress report.
+ */
 
-  if (strlen(thinx_api_key) < 5)
+void THiNX::mqtt_update_handle(const MQTT::Publish &pub)
+{
+  MQTTUpdate::status result;
+  if (pub.has_stream())
   {
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: API Key not set, exiting."));
-#endif
-    return false;
+    // Chunks must fit MQTT_TOO_BIG to be checked before they are written; discard the payload
+    Client *stream = pub.payload_stream();
+    uint32_t remaining = pub.payload_len();
+    while ((remaining > 0) && stream->connected())
+    {
+      if (stream->available() > 0)
+      {
+        stream->read();
+        remaining--;
+      }
+      else
+      {
+        yield();
+      }
+    }
+    result = MQTTUpdate::ERROR_SIZE;
+  }
+  else
+  {
+    result = mqtt_update.handle(pub.payload(), pub.payload_len());
   }
 
-  generate_mqtt_status_channel();
+  if (result == MQTTUpdate::IGNORED)
+  {
+    return;
+  }
 
-  /*
-  #ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT->connect()"));
-    if (logging)
-      Serial.print(F("*TH: UDID: "));
-    if (logging)
-      Serial.println(thinx_udid);
-    if (logging)
-      Serial.print(F("*TH: AK: "));
-    if (logging)
-      Serial.println(thinx_api_key);
-  #endif
-  */
+  if ((result == MQTTUpdate::STARTED) && (_update_callback != nullptr))
+  {
+    _update_callback();
+  }
 
-  if (mqtt_client->connect(MQTT::Connect(thinx_mac())
-                               .set_will(mqtt_device_status_channel, lastWill.c_str())
-                               .set_auth(thinx_udid, thinx_api_key)
-                               .set_keepalive(45)))
+  if (logging && (result != MQTTUpdate::WRITTEN))
   {
+    Serial.printf("*TH: MQTT update %lu: %s at %lu/%lu\n", (unsigned long)mqtt_update.id(), MQTTUpdate::statusName(result),
+                  (unsigned long)mqtt_update.offset(), (unsigned long)mqtt_update.size());
+  }
 
-    mqtt_connected = true;
-    performed_mqtt_checkin = true;
+  mqtt_update_ack(MQTTUpdate::statusName(result));
 
-    mqtt_client->set_callback([this](const MQTT::Publish &pub)
-                              {
-      // Stream has been never tested so far...
-      if (pub.has_stream())
-      {
+  if (result == MQTTUpdate::COMPLETED)
+  {
+    mqtt_update_reboot = true;
+  }
+}
 
-        //#ifdef DEBUG
-        Serial.println(F("*TH: MQTT Type: Stream..."));
-        Serial.flush();
-        //#endif
-        if (_update_callback != nullptr)
-        {
-          _update_callback();
-        }
+void THiNX::mqtt_update_ack(const char *status)
+{
+  char channel[256];
+  if (!device_topic(channel, sizeof(channel), THINX_OTA_TOPIC "/ack"))
+  {
+    return;
+  }
 
-        uint32_t startTime = millis();
-        uint32_t size = pub.payload_len();
-        if (ESP.updateSketch(*pub.payload_stream(), size, true, false))
-        {
-          // Notify on reboot for update
-          mqtt_client->publish(
-              mqtt_device_status_channel,
-              "{ \"status\" : \"rebooting\" }");
-          mqtt_client->disconnect();
-          pub.payload_stream()->stop();
-          if (logging)
-            Serial.printf("Update Success: %lu\nRebooting...\n", millis() - startTime);
-          Serial.flush();
-          ESP.restart();
-        }
-        else
-        {
-          if (logging)
-            Serial.println(F("*TH: ESP MQTT Stream update failed..."));
-          mqtt_client->publish(
-              mqtt_device_status_channel,
-              "{ \"status\" : \"mqtt_update_failed\" }");
-        }
-      }
-      else
-      {
-        if (logging)
-        {
-          //Serial.print(F("Payload string: "));
-          //Serial.println(pub.payload_string());
-        }
-        parse(pub.payload_string().c_str());
-        if (_mqtt_callback)
-        {
-          _mqtt_callback((byte *)pub.payload_string().c_str());
-        }
-      } }); // end-of-callback
+  char ack[96];
+  int length = snprintf(ack, sizeof(ack), "{\"ota\":%lu,\"offset\":%lu,\"status\":\"%s\"}",
+                        (unsigned long)mqtt_update.id(), (unsigned long)mqtt_update.offset(), status);
+  mqtt_client->publish(channel, (const uint8_t *)ack, length, false); // not queued, keeps the transfer in step
+}
 
-    return true;
+void THiNX::mqtt_update_resume()
+{
+  if (mqtt_update.active())
+  {
+    mqtt_update_ack(MQTTUpdate::statusName(MQTTUpdate::RESUMED));
   }
-  else
+  else if (mqtt_update.interrupted())
   {
-    mqtt_connected = false;
-#ifdef DEBUG
-    if (logging)
-      Serial.println(F("*TH: MQTT Not connected."));
-#endif
-    return false;
+    mqtt_update_ack("restart"); // interrupted by reboot, flash updater cannot continue
   }
 }
 
+#endif
+
 /*
  * Restores Device Info. Callers (private): init_with_api_key; save_device_info()
  * Provides: alias, owner, update, udid, (apikey)
@@ -1900,8 +2735,14 @@ void THiNX::restore_device_info()
   f.readBytesUntil('\r', json_buffer, sizeof(json_buffer));
 #endif
 
-  DynamicJsonDocument config_doc(512); // tightly enough to fit ott as well
-  auto error = deserializeJson(config_doc, (char *)json_buffer);
+  // One slot per saved field in both documents, sized from the list so they grow with it
+  static const char *const config_fields[] = {"owner", "apikey", "udid", "alias", "update", "mqtt_alias"};
+  static const size_t config_field_count = sizeof(config_fields) / sizeof(config_fields[0]);
+  StaticJsonDocument<JSON_OBJECT_SIZE(config_field_count)> filter;
+  allow_fields(filter, config_fields, config_field_count);
+
+  DynamicJsonDocument config_doc(JSON_OBJECT_SIZE(config_field_count)); // strings stay in json_buffer, other keys are skipped
+  auto error = deserializeJson(config_doc, (char *)json_buffer, DeserializationOption::Filter(filter));
 
   if (error)
   {
@@ -1916,34 +2757,39 @@ void THiNX::restore_device_info()
     // JsonObject config = config_doc.as<JsonObject>();
 
     const char *owner = config_doc["owner"];
-    if (owner)
+    if (owner && identity_copy(thinx_owner, owner))
     {
-      strcpy(thinx_owner, owner);
-      Serial.print("Set strdup(owner)"); Serial.println(thinx_owner);
+      Serial.print("Set owner: "); Serial.println(thinx_owner);
     }
 
     const char *apikey = config_doc["apikey"];
     if (apikey)
     {
-      thinx_api_key = strdup(apikey);
+      identity_copy(thinx_api_key, apikey);
     }
 
     const char *udid = config_doc["udid"];
     if (udid)
     {
-      thinx_udid = strdup(udid);
+      identity_copy(thinx_udid, udid);
     }
 
     const char *alias = config_doc["alias"];
     if (alias)
     {
-      //thinx_alias = strdup(alias);
+      identity_copy(thinx_alias, alias);
+    }
+
+    const char *update = config_doc["update"]; // written by save_device_info()
+    if (update)
+    {
+      identity_copy(available_update_url, update);
     }
 
-    const char *ott = config_doc["ott"];
-    if (ott)
+    const char *mqtt_alias = config_doc["mqtt_alias"];
+    if (mqtt_alias)
     {
-      available_update_url = strdup(ott);
+      identity_copy(thinx_mqtt_alias, mqtt_alias);
     }
 
     // Serial.println(F("debugging device info:"));
@@ -1976,7 +2822,7 @@ void THiNX::save_device_info()
 
   // Mandatories
 
-  if ((thinx_owner != nullptr) && (strlen(thinx_owner) == OWNER_KEY_TLEN))
+  if (strlen(thinx_owner) == OWNER_KEY_TLEN)
   {
     root["owner"] = thinx_owner; // allow owner change
   } else {
@@ -2006,6 +2852,11 @@ void THiNX::save_device_info()
     root["update"] = available_update_url; // stores data for forced OTT update on reboot
   }
 
+  if (thinx_mqtt_alias[0] != 0)
+  {
+    root["mqtt_alias"] = thinx_mqtt_alias;
+  }
+
 #ifdef __USE_SPIFFS__
 
   File f = SPIFFS.open("/thinx.cfg", "w");
@@ -2059,6 +2910,7 @@ void THiNX::save_device_info()
 
 void THiNX::update_and_reboot(String url)
 {
+  sample_memory(telemetry_update);
 
   if (url.length() < 5)
   {
@@ -2131,6 +2983,8 @@ void THiNX::update_and_reboot(String url)
   ret = ESPhttpUpdate.update(http_client, thinx_cloud_url, 7442, url, "");
 #endif
 
+  sample_memory(telemetry_update);
+
   switch (ret)
   {
   case HTTP_UPDATE_FAILED:
@@ -2166,16 +3020,12 @@ void THiNX::import_build_time_constants()
   // Only if not overridden by user
   if (strlen(thinx_api_key) < 4)
   {
-    thinx_api_key = (char*)THINX_API_KEY;
+    identity_copy(thinx_api_key, THINX_API_KEY);
   }
 
-  if (strlen(THINX_UDID) > 2)
-  {
-    thinx_udid = (char*)THINX_UDID;
-  }
-  else
+  if ((strlen(THINX_UDID) <= 2) || !identity_copy(thinx_udid, THINX_UDID))
   {
-    thinx_udid = (char*)"\0";
+    thinx_udid[0] = 0;
   }
 
 // Use commit-id from thinx.h if not given by environment
@@ -2185,8 +3035,8 @@ void THiNX::import_build_time_constants()
   thinx_commit_id = (char*)THINX_COMMIT_ID;
 #endif
 
-  thinx_alias = (char*)THINX_ALIAS;
-  thinx_owner = (char*)THINX_OWNER;
+  identity_copy(thinx_alias, THINX_ALIAS);
+  identity_copy(thinx_owner, THINX_OWNER);
 
   thinx_mqtt_port = THINX_MQTT_PORT;
   thinx_api_port = THINX_API_PORT;
@@ -2255,12 +3105,12 @@ void THiNX::evt_save_api_key()
   {
     if (strlen(thx_api_key) > 4)
     {
-      thinx_api_key = thx_api_key;
+      identity_copy(thinx_api_key, thx_api_key);
       // if (logging) Serial.print(F("Saving thx_api_key from Captive Portal."));
     }
     if (strlen(thx_owner_key) > 4)
     {
-      thinx_owner_key = thx_owner_key;
+      identity_copy(thinx_owner, thx_owner_key);
       // if (logging) Serial.print(F("Saving thx_owner_key from Captive Portal."));
     }
     // if (logging) Serial.println(F("Saving device info for API key.")); Serial.flush();
@@ -2294,6 +3144,21 @@ void THiNX::setMQTTCallback(void (*func)(byte *))
   _mqtt_callback = func;
 }
 
+void THiNX::setMQTTConnectCallback(void (*func)(void))
+{
+  _mqtt_connect_callback = func;
+}
+
+void THiNX::setMQTTPersistentSession(bool enabled)
+{
+  mqtt_persistent_session = enabled;
+}
+
+void THiNX::setMQTTCompactTopics(bool enabled)
+{
+  mqtt_compact_topics = enabled;
+}
+
 void THiNX::setMQTTBroker(char *url, int port)
 {
   thinx_mqtt_url = url;
@@ -2301,9 +3166,18 @@ void THiNX::setMQTTBroker(char *url, int port)
     Serial.println(F("Port is ignored, defaults to 1883"));
 }
 
+void THiNX::setAPIKeepAlive(bool enabled)
+{
+  api_keep_alive = enabled;
+  if (!enabled && (thinx_checkin_state == CHECKIN_IDLE))
+  {
+    api_client()->stop(); // close connection left open by previous check-in
+  }
+}
+
 void THiNX::finalize()
 {
-  thinx_phase = COMPLETED;
+  set_phase(COMPLETED);
   if (_finalize_callback)
   {
     _finalize_callback();
@@ -2357,8 +3231,12 @@ void THiNX::setDashboardStatus(String newstatus)
     checkin();
     if (mqtt_client)
     {
-      String message = String("{ \"status\" : \"") + newstatus + String("\" }");
-      mqtt_client->publish(mqtt_device_status_channel, message.c_str());
+      char message[128]; // statuses longer than fits are not published, a truncated one would not be JSON
+      int length = snprintf(message, sizeof(message), "{ \"status\" : \"%s\" }", newstatus.c_str());
+      if ((length > 0) && ((size_t)length < sizeof(message)))
+      {
+        publish_or_store(mqtt_device_status_channel, (const uint8_t *)message, length, false);
+      }
     }
   }
 }
@@ -2448,12 +3326,144 @@ void THiNX::do_mqtt_checkin()
 {
 }
 
+/*
+ * Advances the check-in engine by one step; called from loop() until it returns to CHECKIN_IDLE.
+ */
+
 void THiNX::do_connect_api()
 {
-}
+  switch (thinx_checkin_state)
+  {
 
-void THiNX::do_deferred_update()
-{
+  case CHECKIN_IDLE:
+    break;
+
+  case CHECKIN_CONNECT:
+    // connection setup (DNS, TCP and TLS handshake) is the only step that still blocks, see checkin_connect()
+    if (!checkin_connect())
+    {
+      checkin_abort();
+      break;
+    }
+    thinx_checkin_state = CHECKIN_SEND;
+    break;
+
+  case CHECKIN_SEND:
+    if (!checkin_send())
+    {
+      checkin_abort();
+      break;
+    }
+    checkin_sent = millis();
+    checkin_started = 0;
+    api_body_length = 0;
+    api_response.begin(api_client());
+    thinx_checkin_state = CHECKIN_AWAIT_HEADERS;
+    break;
+
+  case CHECKIN_AWAIT_HEADERS:
+  case CHECKIN_READ_BODY:
+    if (millis() - checkin_sent >= THINX_CHECKIN_TIMEOUT)
+    {
+      if (logging)
+        Serial.println(F("*TH: HTTP request timeout."));
+      checkin_abort();
+      break;
+    }
+    if (thinx_checkin_state == CHECKIN_AWAIT_HEADERS)
+    {
+      if ((checkin_started == 0) && api_client()->available())
+      {
+        checkin_started = millis();
+      }
+      if (api_response.readHeaders(THINX_CHECKIN_SLICE))
+      {
+        thinx_checkin_state = CHECKIN_READ_BODY;
+      }
+      else if (checkin_reused && (api_response.bytesReceived() == 0) && !api_client()->connected())
+      {
+        // server closed the kept-alive connection meanwhile, repeat on a new one
+        api_client()->stop();
+        thinx_checkin_state = CHECKIN_CONNECT;
+      }
+      else if (api_response.failed() || (!api_client()->connected() && !api_client()->available()))
+      {
+        if (logging)
+          Serial.println(F("*TH: Invalid API response."));
+        checkin_abort(); // malformed or closed before headers completed
+      }
+    }
+    else if ((api_response.statusCode() < 200) || (api_response.statusCode() >= 300))
+    {
+      thinx_checkin_state = CHECKIN_PARSE; // body is not parsed
+    }
+    else if (api_response.bodyReady())
+    {
+      // copies what has arrived, one slice per loop(), so parse() does not wait for the network
+      int budget = THINX_CHECKIN_SLICE;
+      while ((budget-- > 0) && (api_response.available() > 0))
+      {
+        if ((api_body_length == api_body_capacity) && !checkin_body_grow())
+        {
+          if (logging)
+            Serial.println(F("*TH: API response too large."));
+          checkin_abort();
+          return;
+        }
+        api_body_data[api_body_length++] = api_response.read();
+      }
+      if (api_response.ended())
+      {
+        thinx_checkin_state = CHECKIN_PARSE;
+      }
+    }
+    break;
+
+  case CHECKIN_PARSE:
+  {
+    thinx_checkin_state = CHECKIN_IDLE;
+
+    int status_code = api_response.statusCode();
+    if ((status_code >= 200) && (status_code < 300))
+    {
+      ResponseBodyStream body(api_body_data, api_body_length);
+      parse(body);
+    }
+    else
+    {
+      if (logging)
+      {
+        Serial.print(F("*TH: API responded with status "));
+        Serial.println(status_code);
+      }
+    }
+    checkin_body_release();
+    // keep the connection only if the response has been read completely
+    if (!api_keep_alive || !api_response.keepAlive() || !api_response.drain())
+    {
+      api_client()->stop();
+    }
+
+    unsigned long checkin_bytes = api_response.bytesReceived();
+    unsigned long benchmark_time = millis() - checkin_started;
+    if (benchmark_time > 0)
+    {
+      double in_second = double(1000) / double(benchmark_time);
+      benchmark_speed = double(checkin_bytes * in_second / 1000);
+    }
+#ifdef DEBUG
+    Serial.print(F("Fetched "));
+    Serial.print(checkin_bytes);
+    Serial.print(F(" bytes in "));
+    Serial.print(benchmark_time);
+    Serial.println(" ms");
+    Serial.print(F("Benchmark speed is "));
+    Serial.print(benchmark_speed);
+    Serial.println(F(" kb/s"));
+#endif
+  }
+  break;
+  }
 }
 
 /*
@@ -2463,12 +3473,10 @@ void THiNX::do_deferred_update()
 void THiNX::loop()
 {
 
-  // printStackHeap("in");
-
   if (WiFi.status() != WL_CONNECTED)
   {
     wifi_connected = false;
-    thinx_phase = CONNECT_WIFI;
+    set_phase(CONNECT_WIFI);
   }
 
   if (thinx_phase == CONNECT_WIFI)
@@ -2513,15 +3521,16 @@ void THiNX::loop()
         // Query MDNS proxy
         // if (logging) Serial.println(F("*TH: Searching for thinx-connect on local network..."));
         int n = MDNS.queryService("thinx", "tcp"); // TODO: WARNING! may be _tcp!
-        if (n > 0)
+        // copied into one fixed slot, repeated discoveries on reconnect allocate nothing
+        if ((n > 0) && identity_copy(thinx_proxy_host, String(MDNS.hostname(0)).c_str()))
         {
-          thinx_cloud_url = strdup(String(MDNS.hostname(0)).c_str());
-          thinx_mqtt_url = strdup(String(MDNS.hostname(0)).c_str());
+          thinx_cloud_url = thinx_proxy_host;
+          thinx_mqtt_url = thinx_proxy_host;
         }
       }
 #endif
 
-      thinx_phase = CONNECT_API;
+      set_phase(CONNECT_API);
       return;
     }
   }
@@ -2532,10 +3541,13 @@ void THiNX::loop()
     init_thinx_mqtt_channel(); // initialize channel variable
     if (strlen(mqtt_device_channel) > 5)
     {
-      if (mqtt_client->subscribe(mqtt_device_channel))
+      if (mqtt_subscribe())
       {
 #ifdef DEBUG
         // Serial.println(F("*TH: MQTT subscribed to device channel."));
+#endif
+#ifdef __USE_SPIFFS__
+        mqtt_update_resume();
 #endif
         /*
         // Re-publish status on status topic?
@@ -2547,7 +3559,7 @@ void THiNX::loop()
         */
         mqtt_client->loop();
         delay(10);
-        thinx_phase = FINALIZE;
+        set_phase(FINALIZE);
         return;
       }
     }
@@ -2561,20 +3573,23 @@ void THiNX::loop()
 
       if (mqtt_connected == false)
       {
+        if (!mqtt_reconnect_due())
+        {
+          return;
+        }
         mqtt_connected = start_mqtt();
-        mqtt_client->loop();
-        delay(10);
         if (mqtt_connected)
         {
-          thinx_phase = CHECKIN_MQTT;
+          mqtt_client->loop();
+          set_phase(CHECKIN_MQTT);
 #ifdef DEBUG
           // Serial.println(F("*TH: MQTT connected immediately, changing phase to CHECKIN_MQTT..."));
 #endif
-          thinx_phase = CHECKIN_MQTT;
+          set_phase(CHECKIN_MQTT);
         }
         else
         {
-          // tries again next time
+          mqtt_reconnect_backoff(); // tries again once the backoff elapsed
         }
         return;
       }
@@ -2583,7 +3598,7 @@ void THiNX::loop()
 #ifdef DEBUG
         Serial.println(F("*TH: MQTT already connected, changing phase to FINALIZE..."));
 #endif
-        thinx_phase = FINALIZE;
+        set_phase(FINALIZE);
         return;
       }
     }
@@ -2592,7 +3607,7 @@ void THiNX::loop()
 #ifdef DEBUG
       Serial.println(F("*TH: No UDID available for MQTT, skipping phase to FINALIZE..."));
 #endif
-      thinx_phase = FINALIZE;
+      set_phase(FINALIZE);
       return;
     }
   }
@@ -2605,7 +3620,7 @@ void THiNX::loop()
       if (logging) Serial.println(F("*TH: MQTT RECONNECT ON CONNECTION CHECK..."));
       mqtt_connected = start_mqtt();
       if (mqtt_connected) {
-          thinx_phase = CHECKIN_MQTT;
+          set_phase(CHECKIN_MQTT);
       } else {
         // tries again next time
       }
@@ -2617,17 +3632,13 @@ void THiNX::loop()
   // Force re-checkin after specified interval
   if (thinx_phase > FINALIZE)
   {
-    if (millis() > checkin_time)
+    if ((checkin_interval > 0) && (millis() - checkin_time >= checkin_interval))
     {
-      if (checkin_interval > 0)
-      {
 #ifdef DEBUG
-        if (logging)
-          Serial.println(F("*TH: LOOP » Checkin interval arrived..."));
+      if (logging)
+        Serial.println(F("*TH: LOOP » Checkin interval arrived..."));
 #endif
-        thinx_phase = CONNECT_API;
-        checkin_interval = millis() + checkin_time;
-      }
+      set_phase(CONNECT_API); // checkin() starts the next interval
     }
   }
 
@@ -2646,22 +3657,33 @@ void THiNX::loop()
       }
       if (strlen(thinx_api_key) > 4)
       {
-        checkin(); // warning, this blocking and takes time, thus return...
-        if (mqtt_connected == false)
+        if (thinx_checkin_state == CHECKIN_IDLE)
         {
-          thinx_phase = CONNECT_MQTT;
+          checkin(); // only starts the request, response is processed in following loops
         }
-        else
+        do_connect_api();
+        if (thinx_checkin_state == CHECKIN_IDLE)
         {
-#ifdef DEBUG
-          if (logging)
-            Serial.println(F("*TH: LOOP » FINALIZE (mqtt connected)"));
-#endif
-          thinx_phase = FINALIZE;
+          if (mqtt_connected == false)
+          {
+            set_phase(CONNECT_MQTT);
+          }
+          else
+          {
+#ifdef DEBUG
+            if (logging)
+              Serial.println(F("*TH: LOOP » FINALIZE (mqtt connected)"));
+#endif
+            set_phase(FINALIZE);
+          }
         }
       }
     }
   }
+  else if (thinx_checkin_state != CHECKIN_IDLE)
+  {
+    do_connect_api(); // checkin requested by setLocation() or setDashboardStatus()
+  }
 
   if (thinx_phase == FINALIZE)
   {
@@ -2670,13 +3692,26 @@ void THiNX::loop()
 
   if (thinx_phase >= FINALIZE)
   {
+    mqtt_reconnect_loop();
     if (mqtt_client)
     {
       mqtt_client->loop();
-      delay(10);
     }
   }
 
+#ifdef __USE_SPIFFS__
+  outbox_loop();
+  mqtt_session_loop();
+
+  if (mqtt_update_reboot)
+  {
+    if (logging)
+      Serial.println(F("*TH: MQTT update complete, rebooting..."));
+    Serial.flush();
+    ESP.restart();
+  }
+#endif
+
   // deferred_update_url is set by response parser
   if (deferred_update_url.length() > 4)
   {
@@ -2707,7 +3742,6 @@ void THiNX::loop()
   }
 #endif
 
-  // printStackHeap("out");
 }
 
 // ESP8266/ESP32 Specific Implementations
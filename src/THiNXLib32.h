@@ -3,7 +3,7 @@
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 
 //#define DEBUG                     // takes 8k of sketch and 1+1k of stack/heap size (when measured last time)
-#define __DISABLE_HTTPS__         // to save memory if needed
+//#define __DISABLE_HTTPS__         // to save memory if needed
 //#define __ENABLE_WIFI_MIGRATION__ // enable automatic WiFi disconnect/reconnect on Configuration Push (THINX_ENV_SSID and THINX_ENV_PASS)
 //#define __USE_WIFI_MANAGER__ // if disabled, you need to `WiFi.begin(ssid, pass)` on your own; saves about 3% of sketch space, excludes DNSServer and WebServer
 #define __USE_SPIFFS__    // if disabled, uses EEPROM instead
@@ -46,6 +46,95 @@
 
 //#include "sha256.h"
 #include "ESPCompatibility.h"
+#include "HTTPResponseReader.h"
+#ifdef __USE_SPIFFS__
+#include "MQTTOutbox.h"
+#include "MQTTUpdate.h"
+#endif
+
+// Number of phase latency histogram buckets, limits are in THiNX::phase_bucket_limits
+#define THINX_PHASE_BUCKETS 8
+
+// Capacity of device identity slots (without terminating zero)
+#ifndef THINX_OWNER_SIZE
+#define THINX_OWNER_SIZE 64
+#endif
+
+#ifndef THINX_API_KEY_SIZE
+#define THINX_API_KEY_SIZE 64
+#endif
+
+#ifndef THINX_UDID_SIZE
+#define THINX_UDID_SIZE 36
+#endif
+
+#ifndef THINX_ALIAS_SIZE
+#define THINX_ALIAS_SIZE 32
+#endif
+
+#ifndef THINX_MQTT_ALIAS_SIZE
+#define THINX_MQTT_ALIAS_SIZE 16 // server-assigned short channel id, see setMQTTCompactTopics()
+#endif
+
+#ifndef THINX_UPDATE_URL_SIZE
+#define THINX_UPDATE_URL_SIZE 128 // "/device/firmware?ott=" and 64 bytes of OTT fit well
+#endif
+
+// Check-in response bodies are read in loop() slices and parsed from RAM; up to this size without allocating
+#ifndef THINX_RESPONSE_BUFFER
+#define THINX_RESPONSE_BUFFER 1024
+#endif
+
+// Larger bodies move to a heap buffer until the check-in is parsed; the check-in fails beyond this size
+#ifndef THINX_RESPONSE_LIMIT
+#define THINX_RESPONSE_LIMIT 8192
+#endif
+
+// MQTT packets up to this size go out as a single TLS record
+#ifndef THINX_MQTT_SEND_BUFFER
+#define THINX_MQTT_SEND_BUFFER 256
+#endif
+
+// Outbound MQTT messages are queued here and sent from loop()
+#ifndef THINX_MQTT_QUEUE_SIZE
+#define THINX_MQTT_QUEUE_SIZE 1024
+#endif
+
+#ifndef THINX_MQTT_QUEUE_POLICY
+#define THINX_MQTT_QUEUE_POLICY PubSubClient::QUEUE_BLOCK // or QUEUE_DROP_OLDEST, QUEUE_DROP_NEWEST
+#endif
+
+// QoS 1/2 messages awaiting acknowledgement with a persistent MQTT session; only those are saved with the session
+#ifndef THINX_MQTT_INFLIGHT_WINDOW
+#define THINX_MQTT_INFLIGHT_WINDOW 4
+#endif
+
+// Stack buffer used to stream publishStream()/publishFile() payloads, RAM use does not depend on payload size
+#ifndef THINX_MQTT_STREAM_CHUNK
+#define THINX_MQTT_STREAM_CHUNK 256
+#endif
+
+// Chunked firmware updates arrive on <device channel>/ota, acknowledgements go to <device channel>/ota/ack
+#ifndef THINX_OTA_TOPIC
+#define THINX_OTA_TOPIC "ota"
+#endif
+
+// Messages published while offline are stored on SPIFFS and replayed in bursts once MQTT is back
+#ifndef THINX_OUTBOX_BURST
+#define THINX_OUTBOX_BURST 4 // messages per burst
+#endif
+
+#ifndef THINX_OUTBOX_INTERVAL
+#define THINX_OUTBOX_INTERVAL 250 // ms between bursts
+#endif
+
+#ifndef THINX_OUTBOX_HANDOFF
+#define THINX_OUTBOX_HANDOFF 2 // stored messages sent ahead of each live one, until the backlog is gone
+#endif
+
+#ifndef THINX_OUTBOX_FLUSH_INTERVAL
+#define THINX_OUTBOX_FLUSH_INTERVAL 2000 // ms an offline message may wait in RAM before it is written
+#endif
 
 class THiNX
 {
@@ -59,6 +148,7 @@ public:
 
     static char *thinx_mqtt_url;
     static char *thinx_cloud_url; // up to 1k but generally something where FQDN fits
+    static char thinx_proxy_host[64]; // thinx-connect found by mDNS, both URLs point here once found
 
     static String lastWill;
 
@@ -98,6 +188,19 @@ public:
 
     phase thinx_phase;
 
+    // Check-in engine, advanced by loop() one bounded slice at a time
+    enum checkin_state
+    {
+        CHECKIN_IDLE = 0,
+        CHECKIN_CONNECT = 1,       // open connection to API
+        CHECKIN_SEND = 2,          // write request
+        CHECKIN_AWAIT_HEADERS = 3, // read status line and headers
+        CHECKIN_READ_BODY = 4,     // copy body into api_body as it arrives
+        CHECKIN_PARSE = 5          // parse buffered body
+    };
+
+    checkin_state thinx_checkin_state = CHECKIN_IDLE;
+
     // Public API
     void init_with_api_key(const char *);
     void loop();
@@ -107,17 +210,19 @@ public:
 
     // MQTT
     PubSubClient *mqtt_client = nullptr;
+    MQTT::TopicRouter mqtt_router; // add handlers for application topics here, device channel is routed to parse()
     char mqtt_device_channel[128];
+    size_t mqtt_device_channel_length = 0; // prefix of all device topics, see publish_device_topic()
     char mqtt_device_channels[128];
     char mqtt_device_status_channel[128];
-    void init_thinx_mqtt_channel();
+    void init_thinx_mqtt_channel(); // builds device and status channel once per connection
     String thinx_mqtt_channels();
     String thinx_mqtt_channel();
     char *generate_mqtt_status_channel(); // generate
 
     // Values imported on from thinx.h
     const char *app_version;                  // max 80 bytes
-    const char *available_update_url;         // up to 1k
+    char available_update_url[THINX_UPDATE_URL_SIZE + 1]; // OTT or direct URL of pending update
     const char *thinx_commit_id;              // 40 bytes + 1
     const char *thinx_firmware_version_short; // 14 bytes
     const char *thinx_firmware_version;       // max 80 bytes
@@ -131,9 +236,10 @@ public:
     long thinx_mqtt_port;
     long thinx_api_port;
 
-    // dynamic variables
-    char *thinx_alias;
-    char *thinx_owner;
+    // dynamic variables (fixed-size slots, see identity_copy())
+    char thinx_alias[THINX_ALIAS_SIZE + 1];
+    char thinx_owner[THINX_OWNER_SIZE + 1];
+    char thinx_mqtt_alias[THINX_MQTT_ALIAS_SIZE + 1]; // replaces /owner/udid in MQTT topics in compact mode
 
     char *get_udid();
 
@@ -141,7 +247,11 @@ public:
     void setFinalizeCallback(void (*func)(void));
     void setFirmwareUpdateCallback(void (*func)(void));
     void setMQTTCallback(void (*func)(byte *));
+    void setMQTTConnectCallback(void (*func)(void)); // called after MQTT reconnected, e.g. to resubscribe application topics
+    void setMQTTPersistentSession(bool enabled);     // keep broker session and unacknowledged QoS 1 messages across reconnects and reboots; off by default
+    void setMQTTCompactTopics(bool enabled);         // use server-assigned short channel alias instead of /owner/udid once registered; off by default
     void setMQTTBroker(char *url, int port);
+    void setAPIKeepAlive(bool enabled); // keep API connection open between check-ins (and cache TLS session); off by default
     void setLastWill(const String &nextWill); // disconnect MQTT and reconnect with different lastWill than default
 
     bool wifi_connection_in_progress;
@@ -156,7 +266,11 @@ public:
 
     // publish to specified topic
     void publish(const String &, const String &, bool); // send String to any channel, optinally with retain
-    void publish(char *message, char *topic, bool retain);
+    void publish(const char *message, const char *topic, bool retain); // same without String copies or heap
+    bool publishStream(Stream &stream, size_t length, const char *topic, bool retain = false); // length bytes of stream, sent in THINX_MQTT_STREAM_CHUNK pieces
+#ifdef __USE_SPIFFS__
+    bool publishFile(const char *path, const char *topic, bool retain = false); // whole file, streamed
+#endif
 
     static const char time_format[];
     static const char date_format[];
@@ -166,26 +280,64 @@ public:
     void setRebootInterval(long interval);
 
     // checkins
-    void checkin();                   // happens on registration
+    void checkin();                   // happens on registration; non-blocking, progress is driven by loop()
     void setDashboardStatus(String);  // performs checkin while updating Status on Dashboard
     void setStatus(String);           // deprecated 2.2 (3)
     void setLocation(double, double); // performs checkin while updating Location
 
+    // API connection statistics
+    unsigned long api_handshakes_full = 0;    // new connections without a cached TLS session (every connection on HTTP)
+    unsigned long api_handshakes_offered = 0; // new TLS connections offering the cached session (BearSSL does not tell if it was resumed)
+    unsigned long api_connections_reused = 0; // check-ins sent over a kept-alive connection, no handshake at all
+
+    // Memory telemetry, low-water marks kept since boot
+    struct memory_marks
+    {
+        uint32_t free_heap = UINT32_MAX;  // lowest free heap
+        uint32_t max_block = UINT32_MAX;  // lowest largest allocatable block
+        uint32_t free_stack = UINT32_MAX; // lowest stack headroom
+    };
+    memory_marks telemetry_phases[COMPLETED + 1]; // sampled when entering each phase
+    memory_marks telemetry_parse;                 // around parse()
+    memory_marks telemetry_checkin;               // around checkin()
+    memory_marks telemetry_update;                // around update_and_reboot()
+    void publishTelemetry();                      // sends marks as compact JSON to device status topic
+
+    // Phase latency, recorded on every thinx_phase transition
+    struct phase_timing
+    {
+        uint32_t count = 0;           // completed visits of the phase
+        uint32_t min_ms = UINT32_MAX; // shortest visit
+        uint32_t max_ms = 0;          // longest visit
+        uint32_t total_ms = 0;        // for mean()
+        uint16_t buckets[THINX_PHASE_BUCKETS] = {0};
+        uint32_t mean() const { return count ? total_ms / count : 0; }
+    };
+    static const uint32_t phase_bucket_limits[THINX_PHASE_BUCKETS - 1]; // upper bounds in ms, last bucket is open
+    const phase_timing &getPhaseTiming(phase p) { return phase_timings[p]; }
+    unsigned long boot_duration = 0; // ms since boot when COMPLETED was first reached, 0 until then
+    void publishPhaseMetrics();      // sends timings as compact JSON to device status topic
+
     bool wifi_connected; // WiFi connected in station mode
     bool mqtt_connected; // success or failure on subscription
-    unsigned long mqtt_reconnect_timeout;
+    uint8_t mqtt_reconnect_attempts;     // failed attempts since the last successful connect
+    unsigned long mqtt_reconnect_since;  // millis() of the last failed attempt
+    unsigned long mqtt_reconnect_wait;   // ms to wait after it, jittered
 
 private:
-    // Memory allocation debugging
-    static uint32_t last_free_heap_size;
-    void printStackHeap(const String &tag);
+    // Memory telemetry
+    void sample_memory(memory_marks &marks);
+    void set_phase(phase next); // samples telemetry, records phase timing and switches thinx_phase
+
+    phase_timing phase_timings[COMPLETED + 1];
+    unsigned long phase_started = 0; // millis() when thinx_phase was entered
+    bool phase_timing_started = false;
 
     unsigned long bytes_sent = 0;
 
     bool info_loaded = false;
-    static char *thinx_api_key;
-    static char *thinx_owner_key;
-    char *thinx_udid;
+    static char thinx_api_key[THINX_API_KEY_SIZE + 1];
+    char thinx_udid[THINX_UDID_SIZE + 1];
 
     //
     // Build-specific constants (override for Arduino IDE which does not set any Environments like PlatformIO)
@@ -214,7 +366,27 @@ private:
 
 #ifndef __DISABLE_HTTPS__
     BearSSL::WiFiClientSecure https_client;
+    BearSSL::Session api_tls_session;    // reused for abbreviated handshakes
+    bool api_tls_session_cached = false; // api_tls_session holds parameters of a successful handshake
+
+    // Max fragment length probe result for thinx_cloud_url, probed once per host and firmware
+    char mfln_host[64] = {0}; // host the cached result belongs to
+    uint16_t mfln_size = 0;   // buffer size to use, 0 if MFLN is not supported
+    bool mfln_cached = false;
+    uint16_t mfln_buffer_size(); // cached, restored from SPIFFS or probed
+    bool mfln_restore();         // loads /thinx.mfl if valid for current host and firmware
+    void mfln_save();
+    void mfln_invalidate();      // forces new probe, e.g. after failed handshake
+#endif
+
+    // MQTT has its own connection so a check-in does not tear it down. The client is created when MQTT
+    // starts, with MFLN buffer sizes if the broker supports it, and reused for every reconnect.
+    WiFiClient *mqtt_transport = nullptr;
+    WiFiClient *mqtt_transport_client(); // creates mqtt_transport on first use
+#ifndef __DISABLE_HTTPS__
+    uint8_t mqtt_send_buffer[THINX_MQTT_SEND_BUFFER];
 #endif
+    uint8_t mqtt_queue[THINX_MQTT_QUEUE_SIZE];
 
     int status; // global WiFi status
     bool once;  // once token for initialization
@@ -232,20 +404,42 @@ private:
     void connect();      // start the connect loop
     void connect_wifi(); // start connecting
 
-#ifdef __DISABLE_HTTPS__
-    void fetch_data(WiFiClient *client); // fetch and parse; max return char[] later
-    void send_data(const String &);        // HTTP
-#else
-    void send_data_secure(const String &); // HTTPS
-    void fetch_data_secure(BearSSL::WiFiClientSecure *client);
-#endif
-
-    void parse(const char *); // needs to be refactored to char[] from String
+    // Check-in engine steps (see checkin_state)
+    WiFiClient *api_client();     // HTTP or HTTPS client, based on __DISABLE_HTTPS__
+    bool checkin_connect();       // opens connection to thinx_cloud_url
+    bool checkin_send();          // writes request with json_buffer as body, false if the headers can't be built
+    void checkin_abort();         // closes connection and resets the engine
+    bool checkin_body_grow();     // moves the body to a larger heap buffer, false beyond THINX_RESPONSE_LIMIT
+    void checkin_body_release();  // returns to api_body
+
+    HTTPResponseReader api_response;   // decodes the check-in response
+    static char api_body[THINX_RESPONSE_BUFFER]; // body received so far, see CHECKIN_READ_BODY
+    char *api_body_data = api_body;              // api_body or a heap buffer for a larger body
+    size_t api_body_capacity = THINX_RESPONSE_BUFFER;
+    size_t api_body_length = 0;
+    bool api_keep_alive = false;       // see setAPIKeepAlive()
+    bool checkin_reused = false;       // current check-in uses a kept-alive connection
+    unsigned long checkin_sent = 0;    // millis() when the request was sent, response times out THINX_CHECKIN_TIMEOUT later
+    unsigned long checkin_started = 0; // millis() when response started arriving (benchmark)
+
+    // Static part of the check-in request, built once and reused while host, key and keep-alive stay the same
+    char *api_request_head = nullptr;    // headers up to Content-Length, with room for it at the end
+    size_t api_request_head_length = 0; // without the Content-Length slot
+    size_t api_request_head_host = 0;   // offset of Host value, used to detect changes
+    size_t api_request_head_key = 0;    // offset of Authentication value
+    bool api_request_head_keep_alive = false;
+    bool request_head_valid();
+    bool build_request_head();
+
+    void parse(const char *);            // parses MQTT or stored payload
+    void parse(Stream &);                // parses response body directly from network
+    void parse_stream(Stream &);         // parse() without telemetry sampling
+    void parse_envelope(payload_type, JsonObject); // handles deserialized envelope by type
     void update_and_reboot(String);
 
     int timezone_offset = 0;                       // should use simpleDSTadjust
-    unsigned long checkin_interval = 86400 * 1000; // next timeout millis()
-    unsigned long checkin_time = 86400 * 1000;     // can be set externaly, defaults to 1h (3600 * 1000)
+    unsigned long checkin_interval = 86400 * 1000; // ms between check-ins, see setCheckinInterval()
+    unsigned long checkin_time = 0;                // millis() when the current interval started
 
     unsigned long last_checkin_millis;
     unsigned long last_checkin_timestamp;
@@ -261,6 +455,7 @@ private:
 
     void (*_config_callback)(char *) = NULL; // Called when server pushes new environment vars using MQTT
     void (*_mqtt_callback)(byte *) = NULL;
+    void (*_mqtt_connect_callback)(void) = NULL;
     void (*_update_callback)(void) = NULL;
 
     // Data Storage
@@ -270,6 +465,36 @@ private:
 
     // Updates
     void notify_on_successful_update(); // send a MQTT notification back to Web UI
+    void publish_device_topic(const char *topic, const uint8_t *payload, size_t length, bool retain); // /owner/udid/topic
+    bool device_topic(char *channel, size_t size, const char *topic); // builds /owner/udid/topic
+    bool mqtt_persistent_session = false; // see setMQTTPersistentSession()
+    char mqtt_routed_channel[128] = {0};  // device channel routed by the last connect
+    bool mqtt_compact_topics = false;     // see setMQTTCompactTopics()
+    int mqtt_channel_prefix(char *buffer, size_t size); // /owner/udid or /a/alias, returns snprintf() result
+    bool mqtt_subscribe();                // device channel, skipped when the broker kept the session
+#ifdef __USE_SPIFFS__
+    uint16_t mqtt_session_saved_id = 0;   // packet id counter and in-flight count of the saved session
+    uint8_t mqtt_session_saved_inflight = 0;
+    void mqtt_session_restore();
+    void mqtt_session_save();
+    void mqtt_session_loop(); // saves the session when it changed
+
+    MQTTUpdate mqtt_update;           // chunked OTA over MQTT
+    bool mqtt_update_reboot = false;  // image committed, restart from loop()
+    void mqtt_update_handle(const MQTT::Publish &pub);
+    void mqtt_update_ack(const char *status); // reports id and offset to THINX_OTA_TOPIC/ack
+    void mqtt_update_resume();               // after (re)subscribing, tells the sender where to continue
+#endif
+    bool mqtt_reconnect_due();     // backoff elapsed
+    void mqtt_reconnect_backoff(); // schedules next attempt after a failure
+    void mqtt_reconnect_loop();    // non-blocking reconnect, see loop()
+    bool publish_or_store(const char *channel, const uint8_t *payload, size_t length, bool retain);
+
+#ifdef __USE_SPIFFS__
+    MQTTOutbox mqtt_outbox;                // offline store-and-forward log
+    unsigned long mqtt_outbox_drained = 0; // millis() of the last burst
+    void outbox_loop();
+#endif
 
     // Event Queue / States
     int mqtt_started;
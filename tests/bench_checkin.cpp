@@ -0,0 +1,57 @@
+/*
+ Check-in round trip: request, response and parse through the mock TLS client
+*/
+
+#include <string>
+#include <vector>
+
+#include "Test.h"
+#include "Device.h"
+
+int main()
+{
+    device_reset();
+    MockBroker broker;
+    broker.listen(DEVICE_MQTT_PORT);
+    std::string response = http_response(registration_payload());
+
+    Network.expect(DEVICE_API_PORT, response)->server_close = true;
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    device_run(thx, [&] { return thx.thinx_phase == THiNX::COMPLETED; });
+    if (strcmp(thx.thinx_udid, DEVICE_UDID) != 0)
+    {
+        printf("registration failed\n");
+        return 1;
+    }
+
+    const unsigned checkins = 200;
+    std::vector<std::shared_ptr<MockSocket>> sockets;
+    for (unsigned i = 0; i < checkins; i++)
+    {
+        sockets.push_back(Network.expect(DEVICE_API_PORT, response));
+        sockets.back()->server_close = true;
+    }
+    Network.connections.reserve(Network.connections.size() + checkins);
+
+    unsigned long loops = 0;
+    Benchmark bench("checkin_round_trip");
+    for (unsigned i = 0; i < checkins; i++)
+    {
+        thx.checkin();
+        loops += device_run(thx, [&] { return thx.thinx_checkin_state == THiNX::CHECKIN_IDLE; });
+    }
+
+    // Each write() of the TLS client is one record; the request should be one for the headers, one for the body
+    size_t records = 0, segments = 0;
+    for (auto &socket : sockets)
+    {
+        records += socket->writes.size();
+        segments += socket->segments();
+    }
+    char extra[96];
+    snprintf(extra, sizeof(extra), "%.1f loops %.1f records %.1f segments /checkin", (double)loops / checkins,
+             (double)records / checkins, (double)segments / checkins);
+    bench.report(checkins, extra);
+
+    return ((Network.connections.size() == checkins + 2) && (records <= 2 * checkins)) ? 0 : 1;
+}
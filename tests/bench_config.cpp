@@ -0,0 +1,36 @@
+/*
+ Device info save/restore on the mock SPIFFS
+*/
+
+#include "Test.h"
+#include "Device.h"
+
+int main()
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    thx.parse(registration_payload().c_str()); // identity to save
+
+    const unsigned iterations = 2000;
+    {
+        Benchmark bench("config_save");
+        for (unsigned i = 0; i < iterations; i++)
+            thx.save_device_info();
+        bench.report(iterations);
+    }
+
+    thx.thinx_udid[0] = 0;
+    thx.thinx_mqtt_alias[0] = 0;
+    thx.thinx_alias[0] = 0;
+    {
+        Benchmark bench("config_restore");
+        for (unsigned i = 0; i < iterations; i++)
+            thx.restore_device_info();
+        bench.report(iterations);
+    }
+
+    return (strcmp(thx.thinx_udid, DEVICE_UDID) == 0) && (strcmp(thx.thinx_mqtt_alias, "k3") == 0) &&
+                   (strcmp(thx.thinx_alias, "host-device") == 0)
+               ? 0
+               : 1;
+}
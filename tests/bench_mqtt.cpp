@@ -0,0 +1,98 @@
+/*
+ PubSubClient publish and receive throughput against the mock broker
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "ESP8266WiFi.h"
+#include "MockBroker.h"
+#include "PubSubClient.h"
+
+static const char topic[] = "/cedc16bb6bb06daaa3ff6d30666d91aacd6e3efbf9abbc151b4dcade59af7c12/d6ff2bb0-df34-11e7-b351-eb37822aa172";
+static const char payload[] = "{\"temperature\":21.5,\"humidity\":48}";
+
+struct Connection
+{
+    MockBroker broker;
+    WiFiClient transport;
+    PubSubClient client;
+    uint8_t send_buffer[256];
+    uint8_t queue[1024];
+
+    Connection() : client(transport, String("broker"), 1883)
+    {
+        Network.reset();
+        broker.listen(1883);
+        client.set_send_buffer(send_buffer, sizeof(send_buffer));
+        client.set_queue(queue, sizeof(queue));
+        client.connect(String("bench"));
+        broker.socket->tx.reserve(1 << 20);
+        broker.socket->rx.reserve(1 << 20);
+        broker.socket->writes.reserve(1 << 16);
+        broker.record = false;
+    }
+};
+
+int main()
+{
+    const unsigned messages = 5000;
+    const size_t length = strlen(payload);
+    int failures = 0;
+
+    {
+        Connection c;
+        Benchmark bench("mqtt_publish_qos0");
+        for (unsigned i = 0; i < messages; i++)
+            c.client.publish(topic, (const uint8_t *)payload, length);
+        char extra[48];
+        snprintf(extra, sizeof(extra), "%zu writes", c.broker.socket->writes.size());
+        bench.report(messages, extra);
+        failures += c.broker.publishes != messages;
+    }
+
+    {
+        Connection c;
+        Benchmark bench("mqtt_publish_qos1");
+        for (unsigned i = 0; i < messages; i++)
+        {
+            MQTT::Publish pub(topic, strlen(topic), (const uint8_t *)payload, length);
+            pub.set_qos(1);
+            c.client.publish(pub);
+        }
+        bench.report(messages);
+        failures += c.broker.publishes != messages;
+    }
+
+    {
+        Connection c;
+        Benchmark bench("mqtt_queue_and_loop");
+        for (unsigned i = 0; i < messages; i++)
+        {
+            c.client.queue(topic, (const uint8_t *)payload, length);
+            if (i % 10 == 9)
+                c.client.loop();
+        }
+        c.client.loop();
+        char extra[48];
+        snprintf(extra, sizeof(extra), "%zu writes", c.broker.socket->writes.size());
+        bench.report(messages, extra);
+        failures += c.broker.publishes != messages;
+    }
+
+    {
+        Connection c;
+        unsigned received = 0;
+        c.client.set_callback([&](const MQTT::Publish &) { received++; });
+        for (unsigned i = 0; i < messages; i++)
+            c.broker.publish(topic, payload);
+        Benchmark bench("mqtt_receive");
+        while (received < messages && c.client.loop())
+        {
+        }
+        bench.report(messages);
+        failures += received != messages;
+    }
+
+    return failures ? 1 : 0;
+}
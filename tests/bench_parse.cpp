@@ -0,0 +1,40 @@
+/*
+ parse() per payload type, as received over MQTT (zero-terminated payload)
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "Device.h"
+
+static unsigned configurations = 0;
+
+static void bench_payload(THiNX &thx, const char *name, const std::string &payload, unsigned iterations)
+{
+    thx.parse(payload.c_str()); // first call may allocate lazily
+    Benchmark bench(name);
+    for (unsigned i = 0; i < iterations; i++)
+        thx.parse(payload.c_str());
+    bench.report(iterations);
+}
+
+int main()
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    thx.setPushConfigCallback([](char *) { configurations++; });
+
+    const unsigned iterations = 2000;
+    bench_payload(thx, "parse_registration", registration_payload(), iterations);
+    bench_payload(thx, "parse_update", update_payload(), iterations);
+    bench_payload(thx, "parse_notification", notification_payload(), iterations);
+    bench_payload(thx, "parse_configuration", configuration_payload(), iterations);
+    bench_payload(thx, "parse_unknown", "{\"status\":\"ok\",\"unknown\":{\"a\":[1,2,3]}}", iterations);
+
+    if ((strcmp(thx.thinx_udid, DEVICE_UDID) != 0) || (configurations != iterations + 1))
+    {
+        printf("payloads not applied\n");
+        return 1;
+    }
+    return 0;
+}
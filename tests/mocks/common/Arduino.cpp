@@ -0,0 +1,93 @@
+/*
+ Arduino.cpp - globals of the host mocks
+*/
+
+#include <chrono>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "FS.h"
+#include "HeapCounter.h"
+#include "MockNetwork.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+EEPROMClass EEPROM;
+fs::FS SPIFFS;
+MockNetwork Network;
+
+static unsigned long millis_offset = 0;
+
+static uint64_t steady_us(void)
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)(uint32_t)(steady_us() / 1000 + millis_offset);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)(uint32_t)(steady_us() + (uint64_t)millis_offset * 1000);
+}
+
+void mock_advance_millis(unsigned long ms)
+{
+    millis_offset += ms;
+}
+
+void delay(unsigned long ms)
+{
+    millis_offset += ms;
+}
+
+// Busy waits poll with yield(), let them see time pass without sleeping
+void yield(void)
+{
+    millis_offset += 1;
+}
+
+long random(long max)
+{
+    return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+    return max > min ? min + rand() % (max - min) : min;
+}
+
+void randomSeed(unsigned long seed)
+{
+    srand(seed);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (getenv("MOCK_SERIAL"))
+        return ::write(1, buffer, size);
+    return size;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+    size_t used = heap_stats().in_use;
+    return used < heap_size ? heap_size - used : 0;
+}
+
+bool EspClass::updateSketch(Stream &in, uint32_t size, bool, bool)
+{
+    while (size-- && in.read() >= 0)
+    {
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ Arduino.h - host mock of the Arduino core used by the unit tests and benchmarks
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#define ARDUINO 10805
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HEX 16
+#define DEC 10
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper *>(p))
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(p))
+
+using std::min;
+using std::max;
+
+class __FlashStringHelper;
+
+// Time runs on the host clock plus an offset, so tests can jump ahead (e.g. across the millis() wrap)
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);   // advances the offset instead of sleeping
+void yield(void);
+void mock_advance_millis(unsigned long ms);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+#include "Esp.h"
+
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    void setDebugOutput(bool) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
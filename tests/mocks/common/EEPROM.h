@@ -0,0 +1,38 @@
+/*
+ EEPROM.h - host mock of the emulated EEPROM
+*/
+
+#pragma once
+
+#include "Arduino.h"
+
+class EEPROMClass
+{
+public:
+    void begin(size_t size) { if (size > sizeof(data)) size = sizeof(data); _size = size; }
+    uint8_t read(int address) { return (address >= 0 && (size_t)address < _size) ? data[address] : 0; }
+    void write(int address, uint8_t value) { if (address >= 0 && (size_t)address < _size) data[address] = value; }
+    template <typename T> T &get(int address, T &t)
+    {
+        memcpy(&t, data + address, sizeof(T));
+        return t;
+    }
+    template <typename T> const T &put(int address, const T &t)
+    {
+        if (address >= 0 && address + sizeof(T) <= _size)
+            memcpy(data + address, &t, sizeof(T));
+        return t;
+    }
+    bool commit() { commits++; return true; }
+    void end() {}
+    size_t length() { return _size; }
+
+    // test access
+    uint8_t data[4096] = {0};
+    unsigned commits = 0;
+
+private:
+    size_t _size = 0;
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,40 @@
+/*
+ Esp.h - host mock of the ESP class, heap figures come from the allocation counter
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "WString.h"
+
+class Stream;
+
+class EspClass
+{
+public:
+    uint32_t getFreeHeap();
+    uint32_t getMaxFreeBlockSize() { return getFreeHeap(); }
+    uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+    uint8_t getHeapFragmentation() { return 0; }
+    uint32_t getFreeContStack() { return 2048; }
+    uint32_t getChipId() { return 0x00ABCDEF; }
+    uint64_t getEfuseMac() { return 0x0000EFCDAB7FCF5CULL; }
+    uint32_t getFlashChipId() { return 0x001640EF; }
+    uint32_t getFlashChipSize() { return 4 * 1024 * 1024; }
+    uint32_t getFlashChipRealSize() { return 4 * 1024 * 1024; }
+    uint32_t getSketchSize() { return sketch_size; }
+    String getSketchMD5() { return String(sketch_md5); }
+    uint32_t magicFlashChipSize(uint8_t) { return getFlashChipSize(); }
+    uint32_t getFreeSketchSpace() { return 1000000; }
+    const char *getSdkVersion() { return "host"; }
+    bool updateSketch(Stream &in, uint32_t size, bool restartOnFail = false, bool restartOnSuccess = true);
+    void restart() { restarts++; }
+
+    // test access
+    unsigned restarts = 0;
+    uint32_t sketch_size = 400000;
+    const char *sketch_md5 = "00000000000000000000000000000000";
+    uint32_t heap_size = 1024 * 1024; // reported free heap = heap_size - bytes in use
+};
+
+extern EspClass ESP;
@@ -0,0 +1,133 @@
+/*
+ FS.h - host mock of the flash file system, files live in memory
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include "Arduino.h"
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+namespace fs
+{
+
+typedef std::shared_ptr<std::string> FileData;
+
+class File : public Stream
+{
+public:
+    File() : _position(0), _writable(false) {}
+    File(FileData data, size_t position, bool writable) : _data(data), _position(position), _writable(writable) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (!_data || !_writable)
+            return 0;
+        if (_position + size > _data->size())
+            _data->resize(_position + size);
+        memcpy(&(*_data)[_position], buffer, size);
+        _position += size;
+        return size;
+    }
+    using Print::write;
+
+    int available() override { return _data ? _data->size() - _position : 0; }
+    int read() override { return available() > 0 ? (uint8_t)(*_data)[_position++] : -1; }
+    int peek() override { return available() > 0 ? (uint8_t)(*_data)[_position] : -1; }
+    size_t read(uint8_t *buffer, size_t size)
+    {
+        size_t n = std::min<size_t>(size, available());
+        if (n)
+            memcpy(buffer, _data->data() + _position, n);
+        _position += n;
+        return n;
+    }
+    size_t readBytes(char *buffer, size_t length) override { return read((uint8_t *)buffer, length); }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet)
+    {
+        if (!_data)
+            return false;
+        long target = (mode == SeekSet) ? (long)pos : (mode == SeekCur) ? (long)(_position + pos) : (long)(_data->size() + pos);
+        if (target < 0 || (size_t)target > _data->size())
+            return false;
+        _position = target;
+        return true;
+    }
+    size_t position() const { return _position; }
+    size_t size() const { return _data ? _data->size() : 0; }
+    void close() { _data.reset(); }
+    operator bool() const { return (bool)_data; }
+
+private:
+    FileData _data;
+    size_t _position;
+    bool _writable;
+};
+
+class FS
+{
+public:
+    bool begin(bool formatOnFail = false) { (void)formatOnFail; return true; }
+    void end() {}
+    bool format() { files.clear(); return true; }
+    bool exists(const char *path) { return files.count(path) > 0; }
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path) { return files.erase(path) > 0; }
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *from, const char *to)
+    {
+        auto it = files.find(from);
+        if (it == files.end())
+            return false;
+        files[to] = it->second;
+        files.erase(it);
+        return true;
+    }
+
+    size_t totalBytes() { return 1024 * 1024; }
+    size_t usedBytes()
+    {
+        size_t used = 0;
+        for (auto &file : files)
+            used += file.second->size();
+        return used;
+    }
+
+    File open(const char *path, const char *mode = "r")
+    {
+        auto it = files.find(path);
+        if (mode[0] == 'r')
+        {
+            return (it == files.end()) ? File() : File(it->second, 0, mode[1] == '+');
+        }
+        write_opens++;
+        if ((mode[0] == 'w') || (it == files.end()))
+        {
+            files[path] = std::make_shared<std::string>();
+            it = files.find(path);
+        }
+        return File(it->second, mode[0] == 'a' ? it->second->size() : 0, true);
+    }
+    File open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+
+    // test access
+    std::map<std::string, FileData> files;
+    size_t write_opens = 0; // files opened for writing or appending
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+extern fs::FS SPIFFS;
@@ -0,0 +1,27 @@
+/*
+ IPAddress.h - host mock
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "WString.h"
+
+class IPAddress
+{
+public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+    IPAddress(uint32_t address) : _address(address) {}
+    operator uint32_t() const { return _address; }
+    uint8_t operator[](int i) const { return _address >> (8 * i); }
+    String toString() const
+    {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+        return String(buffer);
+    }
+
+private:
+    uint32_t _address;
+};
@@ -0,0 +1,91 @@
+/*
+ MockNetwork.h - scripted sockets behind the WiFiClient mock
+
+ A test queues a socket per expected connection, fills in what the server sends (rx) and how it arrives
+ (released, record), then inspects what the client wrote (tx, writes).
+*/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct MockSocket
+{
+    uint16_t port = 0;
+    std::string host;
+    bool open = true;
+
+    // server -> client
+    std::string rx;
+    size_t rx_pos = 0;
+    size_t released = (size_t)-1; // bytes of rx the server has sent so far
+    size_t record = 0;            // > 0: available() only reports the rest of the current TLS record of this size
+    bool server_close = false;    // server closes once rx is delivered
+
+    // client -> server
+    std::string tx;
+    std::vector<size_t> writes;      // bytes accepted per write() call, one TLS record or segment burst each
+    std::deque<size_t> write_limits; // caps the next write() calls to simulate short writes
+    std::function<void(MockSocket &)> on_write; // lets a scripted server answer requests
+
+    size_t received() const { return std::min(released, rx.size()); }
+    size_t segments(size_t mss = 1460) const
+    {
+        size_t n = 0;
+        for (size_t w : writes)
+            n += (w + mss - 1) / mss;
+        return n;
+    }
+};
+
+class MockNetwork
+{
+public:
+    // Accept the next connection to port (0 = any) and answer with response
+    std::shared_ptr<MockSocket> expect(uint16_t port, const std::string &response = std::string())
+    {
+        auto socket = std::make_shared<MockSocket>();
+        socket->port = port;
+        socket->rx = response;
+        socket->tx.reserve(2048); // keeps the mock's own allocations out of measured sections
+        socket->writes.reserve(32);
+        pending.push_back(socket);
+        return socket;
+    }
+
+    std::shared_ptr<MockSocket> accept(const char *host, uint16_t port)
+    {
+        for (auto it = pending.begin(); it != pending.end(); ++it)
+        {
+            if ((*it)->port == 0 || (*it)->port == port)
+            {
+                auto socket = *it;
+                pending.erase(it);
+                socket->host = host ? host : "";
+                socket->port = port;
+                connections.push_back(socket);
+                return socket;
+            }
+        }
+        refused++;
+        return nullptr;
+    }
+
+    void reset()
+    {
+        pending.clear();
+        connections.clear();
+        refused = 0;
+    }
+
+    std::deque<std::shared_ptr<MockSocket>> pending;
+    std::vector<std::shared_ptr<MockSocket>> connections;
+    unsigned refused = 0;
+};
+
+extern MockNetwork Network;
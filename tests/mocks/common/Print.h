@@ -0,0 +1,62 @@
+/*
+ Print.h - host mock of the Arduino Print class
+*/
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+#include "WString.h"
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size-- && write(*buffer++))
+            n++;
+        return n;
+    }
+    size_t write(const char *s) { return s ? write((const uint8_t *)s, strlen(s)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper *s) { return write(reinterpret_cast<const char *>(s)); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int base = DEC_BASE) { return print((unsigned long)v, base); }
+    size_t print(int v, int base = DEC_BASE) { return print((long)v, base); }
+    size_t print(unsigned int v, int base = DEC_BASE) { return print((unsigned long)v, base); }
+    size_t print(long v, int base = DEC_BASE) { return _number(base == 16 ? "%lx" : "%ld", v); }
+    size_t print(unsigned long v, int base = DEC_BASE) { return _number(base == 16 ? "%lx" : "%lu", v); }
+    size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+    size_t println(void) { return write("\r\n"); }
+    template <typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(const T &v, int base) { size_t n = print(v, base); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (n < 0) return 0;
+        return write((const uint8_t *)buffer, (size_t)n < sizeof(buffer) ? n : sizeof(buffer) - 1);
+    }
+
+private:
+    enum { DEC_BASE = 10 };
+    template <typename T> size_t _number(const char *format, T v)
+    {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), format, v);
+        return write(buffer);
+    }
+};
@@ -0,0 +1,7 @@
+/*
+ SPIFFS.h - host mock, SPIFFS is declared in FS.h
+*/
+
+#pragma once
+
+#include "FS.h"
@@ -0,0 +1,85 @@
+/*
+ Stream.h - host mock of the Arduino Stream class
+*/
+
+#pragma once
+
+#include "Print.h"
+
+unsigned long millis(void);
+void yield(void);
+
+class Stream : public Print
+{
+public:
+    Stream() : _timeout(1000) {}
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout(void) { return _timeout; }
+
+    // Blocks like the Arduino core: waits up to the timeout for every byte
+    virtual size_t readBytes(char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length)
+        {
+            int c = timedRead();
+            if (c < 0)
+                break;
+            buffer[count++] = (char)c;
+        }
+        return count;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+    size_t readBytesUntil(char terminator, char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length)
+        {
+            int c = timedRead();
+            if (c < 0 || c == terminator)
+                break;
+            buffer[count++] = (char)c;
+        }
+        return count;
+    }
+
+    String readString()
+    {
+        String s;
+        int c;
+        while ((c = timedRead()) >= 0)
+            s += (char)c;
+        return s;
+    }
+
+    String readStringUntil(char terminator)
+    {
+        String s;
+        int c;
+        while ((c = timedRead()) >= 0 && c != terminator)
+            s += (char)c;
+        return s;
+    }
+
+protected:
+    unsigned long _timeout;
+
+    int timedRead()
+    {
+        unsigned long start = millis();
+        do
+        {
+            int c = read();
+            if (c >= 0)
+                return c;
+            yield();
+        } while (millis() - start < _timeout);
+        return -1;
+    }
+};
@@ -0,0 +1,145 @@
+/*
+ WString.h - host mock of the Arduino String, backed by std::string
+*/
+
+#pragma once
+
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+
+class __FlashStringHelper;
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) { if (s) _s = s; }
+    String(const __FlashStringHelper *s) { if (s) _s = reinterpret_cast<const char *>(s); }
+    String(const String &s) : _s(s._s) {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(int v, unsigned char base = 10) { _s = _format(v, base); }
+    explicit String(unsigned int v, unsigned char base = 10) { _s = _format(v, base); }
+    explicit String(long v, unsigned char base = 10) { _s = _format(v, base); }
+    explicit String(unsigned long v, unsigned char base = 10) { _s = _format(v, base); }
+    explicit String(float v, unsigned char decimals = 2) { _s = _format(v, decimals); }
+    explicit String(double v, unsigned char decimals = 2) { _s = _format(v, decimals); }
+
+    String &operator=(const String &s) { _s = s._s; return *this; }
+    String &operator=(const char *s) { _s = s ? s : ""; return *this; }
+
+    const char *c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.size(); }
+    bool reserve(unsigned int size) { _s.reserve(size); return true; }
+    operator bool() const { return true; }
+
+    bool concat(const String &s) { _s += s._s; return true; }
+    bool concat(const char *s) { if (s) _s += s; return true; }
+    bool concat(const char *s, unsigned int n) { _s.append(s, n); return true; }
+    bool concat(char c) { _s += c; return true; }
+    bool concat(int v) { _s += _format(v, 10); return true; }
+    bool concat(unsigned int v) { _s += _format(v, 10); return true; }
+    bool concat(long v) { _s += _format(v, 10); return true; }
+    bool concat(unsigned long v) { _s += _format(v, 10); return true; }
+    bool concat(double v) { _s += _format(v, 2); return true; }
+    template <typename T> String &operator+=(const T &v) { concat(v); return *this; }
+
+    friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+    friend String operator+(const String &a, const char *b) { return String(a._s + (b ? b : "")); }
+    friend String operator+(const char *a, const String &b) { return String((a ? a : "") + b._s); }
+    friend String operator+(const String &a, char b) { return String(a._s + b); }
+    friend String operator+(const String &a, int b) { return String(a._s + _format(b, 10)); }
+    friend String operator+(const String &a, unsigned int b) { return String(a._s + _format(b, 10)); }
+    friend String operator+(const String &a, long b) { return String(a._s + _format(b, 10)); }
+    friend String operator+(const String &a, unsigned long b) { return String(a._s + _format(b, 10)); }
+    friend String operator+(const String &a, double b) { return String(a._s + _format(b, 2)); }
+    friend String operator+(const String &a, const __FlashStringHelper *b) { return a + String(b); }
+
+    bool operator==(const String &s) const { return _s == s._s; }
+    bool operator==(const char *s) const { return _s == (s ? s : ""); }
+    bool operator!=(const String &s) const { return _s != s._s; }
+    bool operator!=(const char *s) const { return !(*this == s); }
+    bool operator<(const String &s) const { return _s < s._s; }
+    bool equals(const String &s) const { return _s == s._s; }
+    bool equals(const char *s) const { return *this == s; }
+    bool equalsIgnoreCase(const String &s) const { return strcasecmp(c_str(), s.c_str()) == 0; }
+    int compareTo(const String &s) const { return _s.compare(s._s); }
+    bool startsWith(const String &s) const { return _s.compare(0, s._s.size(), s._s) == 0; }
+    bool endsWith(const String &s) const { return (_s.size() >= s._s.size()) && (_s.compare(_s.size() - s._s.size(), s._s.size(), s._s) == 0); }
+
+    char charAt(unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char &operator[](unsigned int i) { return _s[i]; }
+    void setCharAt(unsigned int i, char c) { if (i < _s.size()) _s[i] = c; }
+    void getBytes(unsigned char *buf, unsigned int size, unsigned int index = 0) const { toCharArray((char *)buf, size, index); }
+    void toCharArray(char *buf, unsigned int size, unsigned int index = 0) const
+    {
+        if (size == 0) return;
+        size_t n = index < _s.size() ? std::min<size_t>(size - 1, _s.size() - index) : 0;
+        memcpy(buf, _s.data() + std::min<size_t>(index, _s.size()), n);
+        buf[n] = 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return _pos(_s.find(c, from)); }
+    int indexOf(const String &s, unsigned int from = 0) const { return _pos(_s.find(s._s, from)); }
+    int lastIndexOf(char c) const { return _pos(_s.rfind(c)); }
+    int lastIndexOf(const String &s) const { return _pos(_s.rfind(s._s)); }
+    String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to) std::swap(from, to);
+        return from < _s.size() ? String(_s.substr(from, to - from)) : String();
+    }
+
+    void replace(char a, char b) { for (auto &c : _s) if (c == a) c = b; }
+    void replace(const String &a, const String &b)
+    {
+        if (a._s.empty()) return;
+        size_t p = 0;
+        while ((p = _s.find(a._s, p)) != std::string::npos)
+        {
+            _s.replace(p, a._s.size(), b._s);
+            p += b._s.size();
+        }
+    }
+    void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+    void toLowerCase() { for (auto &c : _s) c = tolower(c); }
+    void toUpperCase() { for (auto &c : _s) c = toupper(c); }
+    void trim()
+    {
+        size_t b = _s.find_first_not_of(" \t\r\n");
+        size_t e = _s.find_last_not_of(" \t\r\n");
+        _s = (b == std::string::npos) ? std::string() : _s.substr(b, e - b + 1);
+    }
+
+    long toInt() const { return atol(_s.c_str()); }
+    float toFloat() const { return atof(_s.c_str()); }
+    double toDouble() const { return atof(_s.c_str()); }
+
+private:
+    std::string _s;
+
+    static int _pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+    template <typename T> static std::string _format(T v, unsigned char base)
+    {
+        char buf[72];
+        if (base == 16) snprintf(buf, sizeof(buf), "%lx", (unsigned long)v);
+        else snprintf(buf, sizeof(buf), "%lld", (long long)v);
+        return buf;
+    }
+    static std::string _format(double v, unsigned char decimals)
+    {
+        char buf[72];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        return buf;
+    }
+    static std::string _format(float v, unsigned char decimals) { return _format((double)v, decimals); }
+};
+
+class StringSumHelper : public String
+{
+public:
+    using String::String;
+};
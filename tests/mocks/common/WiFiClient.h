@@ -0,0 +1,115 @@
+/*
+ WiFiClient.h - host mock of the TCP client, backed by MockNetwork
+*/
+
+#pragma once
+
+#include "Arduino.h"
+#include "Client.h"
+#include "MockNetwork.h"
+
+class WiFiClient : public Client
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<MockSocket> socket) : _socket(socket) {}
+    virtual ~WiFiClient() {}
+
+    int connect(IPAddress ip, uint16_t port) override { return connect(ip.toString().c_str(), port); }
+    int connect(const char *host, uint16_t port) override
+    {
+        _socket = Network.accept(host, port);
+        return _socket ? 1 : 0;
+    }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (!_socket || !_socket->open || size == 0)
+            return 0;
+        if (!_socket->write_limits.empty())
+        {
+            size = std::min(size, _socket->write_limits.front());
+            _socket->write_limits.pop_front();
+            if (size == 0)
+                return 0;
+        }
+        _socket->tx.append((const char *)buffer, size);
+        _socket->writes.push_back(size);
+        if (_socket->on_write)
+            _socket->on_write(*_socket);
+        return size;
+    }
+    using Print::write;
+
+    int available() override
+    {
+        if (!_socket)
+            return 0;
+        size_t end = _socket->received();
+        if (_socket->record > 0)
+            end = std::min(end, (_socket->rx_pos / _socket->record + 1) * _socket->record);
+        return end > _socket->rx_pos ? end - _socket->rx_pos : 0;
+    }
+    int read() override
+    {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    int read(uint8_t *buffer, size_t size) override
+    {
+        size_t n = std::min<size_t>(size, available());
+        if (n == 0)
+            return -1;
+        memcpy(buffer, _socket->rx.data() + _socket->rx_pos, n);
+        _socket->rx_pos += n;
+        return n;
+    }
+    int peek() override { return available() > 0 ? (uint8_t)_socket->rx[_socket->rx_pos] : -1; }
+    size_t readBytes(char *buffer, size_t length) override
+    {
+        size_t count = 0;
+        unsigned long start = millis();
+        while (count < length)
+        {
+            int n = read((uint8_t *)buffer + count, length - count);
+            if (n > 0)
+            {
+                count += n;
+                continue;
+            }
+            if (!connected() || millis() - start >= _timeout)
+                break;
+            yield();
+        }
+        return count;
+    }
+    using Stream::readBytes;
+
+    void flush() override {}
+    void stop() override
+    {
+        if (_socket)
+            _socket->open = false;
+        _socket.reset();
+    }
+    uint8_t connected() override
+    {
+        if (!_socket || !_socket->open)
+            return 0;
+        if (_socket->server_close && (_socket->rx_pos >= _socket->rx.size()) && (_socket->received() >= _socket->rx.size()))
+            return 0;
+        return 1;
+    }
+    operator bool() override { return connected(); }
+
+    void setNoDelay(bool) {}
+    void setSync(bool) {}
+    int availableForWrite() override { return 1460; }
+    IPAddress remoteIP() { return IPAddress(127, 0, 0, 1); }
+
+    std::shared_ptr<MockSocket> socket() { return _socket; }
+
+protected:
+    std::shared_ptr<MockSocket> _socket;
+};
@@ -0,0 +1,28 @@
+/*
+ ESP32.cpp - globals of the ESP32 mocks
+*/
+
+#include <stdio.h>
+
+#include "HTTPClient.h"
+#include "Update.h"
+#include "WiFi.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+WiFiClass WiFi;
+UpdateClass Update;
+MockHTTPServer HTTPServer;
+const esp_partition_t *mock_running_partition = nullptr;
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (partition == nullptr || src_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    FILE *f = fopen(partition->path, "rb");
+    if (f == nullptr)
+        return ESP_FAIL;
+    bool ok = (fseek(f, src_offset, SEEK_SET) == 0) && (fread(dst, 1, size, f) == size);
+    fclose(f);
+    return ok ? ESP_OK : ESP_FAIL;
+}
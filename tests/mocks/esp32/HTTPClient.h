@@ -0,0 +1,79 @@
+/*
+ HTTPClient.h - host mock of the ESP32 HTTP client, answers every GET with HTTPServer's scripted response
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_NOT_MODIFIED 304
+#define HTTP_CODE_FORBIDDEN 403
+#define HTTP_CODE_NOT_FOUND 404
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+struct MockHTTPServer
+{
+    int code = HTTP_CODE_OK;
+    std::map<std::string, std::string> headers; // response headers
+    std::string body;
+    size_t record = 0; // body delivered in pieces of this size per available(), see MockSocket
+
+    std::map<std::string, std::string> request_headers; // of the last GET
+    std::string url;
+};
+
+extern MockHTTPServer HTTPServer;
+
+class HTTPClient
+{
+public:
+    bool begin(const String &url) { HTTPServer.url = url.c_str(); return true; }
+    bool begin(const String &url, const char *) { return begin(url); }
+    bool begin(const String &host, uint16_t port, const String &uri) { return begin(host + ":" + String((int)port) + uri); }
+    bool begin(const String &host, uint16_t port, const String &uri, const char *) { return begin(host, port, uri); }
+    void end() { _stream.stop(); }
+
+    void useHTTP10(bool) {}
+    void setTimeout(uint16_t) {}
+    void setUserAgent(const String &) {}
+    void addHeader(const String &name, const String &value) { HTTPServer.request_headers[name.c_str()] = value.c_str(); }
+    void collectHeaders(const char *keys[], size_t count) { _collect.assign(keys, keys + count); }
+
+    int GET()
+    {
+        if (HTTPServer.code <= 0)
+            return HTTPServer.code;
+        auto socket = std::make_shared<MockSocket>();
+        socket->rx = HTTPServer.body;
+        socket->record = HTTPServer.record;
+        socket->server_close = true;
+        _stream = WiFiClient(socket);
+        return HTTPServer.code;
+    }
+    int getSize()
+    {
+        auto length = HTTPServer.headers.find("Content-Length");
+        return length == HTTPServer.headers.end() ? (int)HTTPServer.body.size() : atoi(length->second.c_str());
+    }
+    bool hasHeader(const char *name) { return _collected(name) && HTTPServer.headers.count(name) > 0; }
+    String header(const char *name) { return hasHeader(name) ? String(HTTPServer.headers[name].c_str()) : String(); }
+    WiFiClient *getStreamPtr() { return &_stream; }
+    int writeToStream(Stream *) { return 0; }
+    static String errorToString(int error) { return String("HTTP error ") + String(error); }
+
+private:
+    WiFiClient _stream;
+    std::vector<std::string> _collect;
+
+    bool _collected(const char *name)
+    {
+        for (auto &key : _collect)
+            if (key == name)
+                return true;
+        return false;
+    }
+};
@@ -0,0 +1,25 @@
+/*
+ StreamString.h - host mock, a String that can be printed to
+*/
+
+#pragma once
+
+#include "Arduino.h"
+
+class StreamString : public String, public Stream
+{
+public:
+    size_t write(uint8_t c) override { concat((char)c); return 1; }
+    size_t write(const uint8_t *buffer, size_t size) override { concat((const char *)buffer, size); return size; }
+    using Print::write;
+    int available() override { return length(); }
+    int read() override
+    {
+        if (length() == 0)
+            return -1;
+        int c = (uint8_t)charAt(0);
+        remove(0, 1);
+        return c;
+    }
+    int peek() override { return length() ? (uint8_t)charAt(0) : -1; }
+};
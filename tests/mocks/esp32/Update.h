@@ -0,0 +1,98 @@
+/*
+ Update.h - host mock of the ESP32 flash updater, keeps the written image in memory
+*/
+
+#pragma once
+
+#include <string>
+#include "Arduino.h"
+
+#define U_FLASH 0
+#define U_SPIFFS 100
+
+#define UPDATE_ERROR_OK 0
+#define UPDATE_ERROR_WRITE 1
+#define UPDATE_ERROR_SIZE 4
+#define UPDATE_ERROR_STREAM 5
+#define UPDATE_ERROR_MD5 6
+#define UPDATE_ERROR_ABORT 8
+
+class UpdateClass
+{
+public:
+    bool begin(size_t size, int command = U_FLASH)
+    {
+        image.clear();
+        md5 = String();
+        expected = size;
+        this->command = command;
+        error = fail_begin ? UPDATE_ERROR_SIZE : UPDATE_ERROR_OK;
+        running = !fail_begin;
+        return running;
+    }
+    bool setMD5(const char *value)
+    {
+        if (strlen(value) != 32)
+            return false;
+        md5 = value;
+        return true;
+    }
+    size_t write(uint8_t *data, size_t len)
+    {
+        if (!running || image.size() + len > expected)
+        {
+            error = UPDATE_ERROR_WRITE;
+            return 0;
+        }
+        image.append((const char *)data, len);
+        return len;
+    }
+    size_t writeStream(Stream &data)
+    {
+        uint8_t buffer[256];
+        size_t written = 0;
+        while (running && image.size() < expected)
+        {
+            size_t n = data.readBytes(buffer, std::min<size_t>(sizeof(buffer), expected - image.size()));
+            if (n == 0)
+            {
+                error = UPDATE_ERROR_STREAM;
+                break;
+            }
+            written += write(buffer, n);
+        }
+        return written;
+    }
+    bool end(bool evenIfRemaining = false)
+    {
+        bool ok = running && (evenIfRemaining || image.size() == expected);
+        running = false;
+        if (!ok && !error)
+            error = UPDATE_ERROR_SIZE;
+        ended += ok;
+        return ok;
+    }
+    void abort()
+    {
+        running = false;
+        error = UPDATE_ERROR_ABORT;
+        aborted++;
+    }
+    bool isRunning() { return running; }
+    uint8_t getError() { return error; }
+    bool hasError() { return error != UPDATE_ERROR_OK; }
+    void printError(Print &out) { out.printf("Update error %u\n", error); }
+
+    // test access
+    std::string image;
+    String md5;
+    size_t expected = 0;
+    int command = U_FLASH;
+    bool running = false;
+    bool fail_begin = false;
+    uint8_t error = UPDATE_ERROR_OK;
+    unsigned ended = 0;
+    unsigned aborted = 0;
+};
+
+extern UpdateClass Update;
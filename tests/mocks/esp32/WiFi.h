@@ -0,0 +1,18 @@
+/*
+ WiFi.h - host mock of the ESP32 WiFi station
+*/
+
+#pragma once
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+class WiFiClass
+{
+public:
+    String macAddress() { return String("24:0A:C4:AB:CD:EF"); }
+    String softAPmacAddress() { return String("24:0A:C4:AB:CD:F0"); }
+    bool isConnected() { return true; }
+};
+
+extern WiFiClass WiFi;
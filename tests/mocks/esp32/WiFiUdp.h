@@ -0,0 +1,5 @@
+/*
+ WiFiUdp.h - host mock, not used
+*/
+
+#pragma once
@@ -0,0 +1,14 @@
+/*
+ esp_ota_ops.h - host mock, the running partition is set by the test
+*/
+
+#pragma once
+
+#include "esp_partition.h"
+
+extern const esp_partition_t *mock_running_partition;
+
+inline const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return mock_running_partition;
+}
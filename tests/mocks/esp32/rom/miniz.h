@@ -0,0 +1,87 @@
+/*
+ rom/miniz.h - host mock of the tinfl inflater in the ESP32 ROM, implemented with zlib
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+enum
+{
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum
+{
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+typedef struct
+{
+    int m_state; // 0 before the first call, 1 while inflating, 2 after the end of the stream or an error
+    z_stream z;
+} tinfl_decompressor;
+
+#define tinfl_init(r)      \
+    do                     \
+    {                      \
+        (r)->m_state = 0;  \
+    } while (0)
+
+// Same contract as tinfl: output goes to next within the circular dictionary starting at start
+inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in, size_t *in_size, uint8_t *start, uint8_t *next, size_t *out_size, uint32_t flags)
+{
+    (void)start;
+    if (r->m_state == 2)
+    {
+        *in_size = 0;
+        *out_size = 0;
+        return TINFL_STATUS_FAILED;
+    }
+    if (r->m_state == 0)
+    {
+        memset(&r->z, 0, sizeof(r->z));
+        if (inflateInit2(&r->z, (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15) != Z_OK)
+            return TINFL_STATUS_FAILED;
+        r->m_state = 1;
+    }
+    r->z.next_in = (Bytef *)in;
+    r->z.avail_in = *in_size;
+    r->z.next_out = next;
+    r->z.avail_out = *out_size;
+    int result = inflate(&r->z, Z_NO_FLUSH);
+    *in_size -= r->z.avail_in;
+    *out_size -= r->z.avail_out;
+
+    tinfl_status status;
+    if (result == Z_STREAM_END)
+        status = TINFL_STATUS_DONE;
+    else if (result == Z_DATA_ERROR && r->z.msg && strstr(r->z.msg, "check"))
+        status = TINFL_STATUS_ADLER32_MISMATCH;
+    else if (result != Z_OK && result != Z_BUF_ERROR)
+        status = TINFL_STATUS_FAILED;
+    else if (r->z.avail_out == 0)
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    else if (!(flags & TINFL_FLAG_HAS_MORE_INPUT))
+        status = TINFL_STATUS_FAILED;
+    else
+        return TINFL_STATUS_NEEDS_MORE_INPUT;
+
+    // the ROM inflater needs no cleanup, zlib does
+    inflateEnd(&r->z);
+    r->m_state = 2;
+    return status;
+}
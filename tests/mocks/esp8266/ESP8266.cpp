@@ -0,0 +1,17 @@
+/*
+ ESP8266.cpp - globals of the ESP8266 mocks
+*/
+
+#include "ESP8266WiFi.h"
+#include "ESP8266httpUpdate.h"
+#include "ESP8266mDNS.h"
+#include "Updater.h"
+
+ESP8266WiFiClass WiFi;
+ESP8266HTTPUpdate ESPhttpUpdate;
+MDNSResponder MDNS;
+UpdaterClass Update;
+
+bool BearSSL::WiFiClientSecure::mfln_supported = true;
+bool BearSSL::WiFiClientSecure::handshake_fails = false;
+unsigned BearSSL::WiFiClientSecure::probes = 0;
@@ -0,0 +1,9 @@
+/*
+ ESP8266HTTPClient.h - host mock, the library only needs the type definitions
+*/
+
+#pragma once
+
+#include "ESP8266WiFi.h"
+
+#define HTTP_CODE_OK 200
@@ -0,0 +1,71 @@
+/*
+ ESP8266WiFi.h - host mock of the ESP8266 WiFi station
+*/
+
+#pragma once
+
+#include <time.h>
+#include "Arduino.h"
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum
+{
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+class ESP8266WiFiClass
+{
+public:
+    wl_status_t status() { return connected_ ? WL_CONNECTED : WL_DISCONNECTED; }
+    bool isConnected() { return connected_; }
+    WiFiMode_t getMode() { return mode_; }
+    bool mode(WiFiMode_t m) { mode_ = m; return true; }
+    wl_status_t begin(const char *ssid = nullptr, const char *pass = nullptr)
+    {
+        (void)pass;
+        if (ssid)
+            ssid_ = ssid;
+        connected_ = true;
+        return status();
+    }
+    wl_status_t begin(const String &ssid, const String &pass) { return begin(ssid.c_str(), pass.c_str()); }
+    bool disconnect(bool off = false) { (void)off; connected_ = false; return true; }
+    bool softAP(const char *, const char * = nullptr) { return true; }
+    String SSID() { return String(ssid_.c_str()); }
+    int32_t RSSI() { return -60; }
+    String macAddress() { return String("5C:CF:7F:AB:CD:EF"); }
+    String softAPmacAddress() { return macAddress(); }
+    IPAddress localIP() { return IPAddress(192, 168, 1, 2); }
+    int hostByName(const char *host, IPAddress &address)
+    {
+        if (!resolve || !host || !*host)
+            return 0;
+        address = IPAddress(127, 0, 0, 1);
+        return 1;
+    }
+
+    // test access
+    bool connected_ = true;
+    bool resolve = true;
+    WiFiMode_t mode_ = WIFI_STA;
+    std::string ssid_ = "host";
+};
+
+extern ESP8266WiFiClass WiFi;
+
+inline void configTime(int, int, const char *, const char * = nullptr, const char * = nullptr) {}
@@ -0,0 +1,42 @@
+/*
+ ESP8266httpUpdate.h - host mock of the HTTP firmware updater
+*/
+
+#pragma once
+
+#include "ESP8266WiFi.h"
+
+enum HTTPUpdateResult
+{
+    HTTP_UPDATE_FAILED,
+    HTTP_UPDATE_NO_UPDATES,
+    HTTP_UPDATE_OK
+};
+typedef HTTPUpdateResult t_httpUpdate_return;
+
+class ESP8266HTTPUpdate
+{
+public:
+    t_httpUpdate_return update(WiFiClient &, const String &host, uint16_t port, const String &uri, const String & = "")
+    {
+        updates++;
+        last_url = host + ":" + String((int)port) + uri;
+        return result;
+    }
+    t_httpUpdate_return update(WiFiClient &, const String &url, const String & = "")
+    {
+        updates++;
+        last_url = url;
+        return result;
+    }
+    void rebootOnUpdate(bool) {}
+    int getLastError() { return result == HTTP_UPDATE_FAILED ? -1 : 0; }
+    String getLastErrorString() { return String(result == HTTP_UPDATE_FAILED ? "mock failure" : ""); }
+
+    // test access
+    t_httpUpdate_return result = HTTP_UPDATE_NO_UPDATES;
+    unsigned updates = 0;
+    String last_url;
+};
+
+extern ESP8266HTTPUpdate ESPhttpUpdate;
@@ -0,0 +1,19 @@
+/*
+ ESP8266mDNS.h - host mock, no services are ever found
+*/
+
+#pragma once
+
+#include "Arduino.h"
+
+class MDNSResponder
+{
+public:
+    bool begin(const char *) { return true; }
+    int queryService(const char *, const char *) { return 0; }
+    String hostname(int) { return String(); }
+    IPAddress IP(int) { return IPAddress(); }
+    uint16_t port(int) { return 0; }
+};
+
+extern MDNSResponder MDNS;
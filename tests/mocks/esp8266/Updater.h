@@ -0,0 +1,59 @@
+/*
+ Updater.h - host mock of the flash updater, keeps the written image in memory
+*/
+
+#pragma once
+
+#include <string>
+#include "Arduino.h"
+
+#define U_FLASH 0
+
+class UpdaterClass
+{
+public:
+    bool begin(size_t size, int command = U_FLASH)
+    {
+        (void)command;
+        image.clear();
+        target_md5.clear();
+        expected = size;
+        running = true;
+        return !fail_begin;
+    }
+    size_t write(uint8_t *data, size_t len)
+    {
+        if (!running)
+            return 0;
+        image.append((const char *)data, len);
+        return len;
+    }
+    // The image is not hashed, an expected MD5 always fails the check as a wrong one would
+    bool setMD5(const char *md5)
+    {
+        target_md5 = md5;
+        return true;
+    }
+    bool end(bool evenIfRemaining = false)
+    {
+        bool ok = running && (evenIfRemaining || image.size() == expected) && target_md5.empty();
+        running = false;
+        ended++;
+        committed += ok;
+        return ok;
+    }
+    bool isRunning() { return running; }
+    uint8_t getError() { return 0; }
+    bool hasError() { return false; }
+
+    // test access
+    std::string image;
+    size_t expected = 0;
+    bool running = false;
+    bool fail_begin = false;
+    unsigned ended = 0;
+    unsigned committed = 0; // end() calls that accepted the image
+    std::string target_md5;
+};
+
+extern UpdaterClass Update;
@@ -0,0 +1,69 @@
+/*
+ WiFiClientSecure.h - host mock of the BearSSL client, TLS is only simulated
+*/
+
+#pragma once
+
+#include "WiFiClient.h"
+
+namespace BearSSL
+{
+
+class Session
+{
+public:
+    bool valid = false;
+};
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+    void setInsecure() {}
+    void setSession(Session *session) { _session = session; }
+    void setBufferSizes(int recv, int xmit) { _recv = recv; _xmit = xmit; }
+    bool probeMaxFragmentLength(const char *, uint16_t, uint16_t length) { probes++; return mfln_supported && length >= 512; }
+    bool getMFLNStatus() { return connected() && mfln_supported && (_recv < 16384); }
+    int getLastSSLError(char *dest = nullptr, size_t len = 0)
+    {
+        if (dest && len)
+            dest[0] = 0;
+        return _ssl_error;
+    }
+
+    int connect(const char *host, uint16_t port) override
+    {
+        _ssl_error = 0;
+        int result = WiFiClient::connect(host, port);
+        if (!result)
+            return 0;
+        if (handshake_fails)
+        {
+            _ssl_error = -1;
+            WiFiClient::stop();
+            return 0;
+        }
+        resumed = _session && _session->valid;
+        if (_session)
+            _session->valid = true;
+        if (_socket && (_socket->record == 0))
+            _socket->record = _recv;
+        return 1;
+    }
+    using WiFiClient::connect;
+
+    // test access
+    static bool mfln_supported;
+    static bool handshake_fails;
+    static unsigned probes;
+    bool resumed = false;
+
+private:
+    Session *_session = nullptr;
+    int _recv = 16384;
+    int _xmit = 512;
+    int _ssl_error = 0;
+};
+
+} // namespace BearSSL
+
+using BearSSL::WiFiClientSecure;
@@ -0,0 +1,303 @@
+/*
+ BSDiff.h - patch generator for delta update tests
+
+ Port of bsdiff_internal() from github.com/mendsley/bsdiff, writing the uncompressed ENDSLEY/BSDIFF43
+ stream that ESP32DeltaPatch applies: 16 bytes magic, 8 bytes new size, then per record three 8-byte
+ sign-magnitude integers (diff length, extra length, old seek), the diff bytes and the extra bytes.
+ The bsdiff tool would compress the records with bzip2 after the header; servers send them raw.
+
+ Copyright 2003-2005 Colin Percival, Copyright 2012 Matthew Endsley. All rights reserved.
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ providing that the following conditions are met: 1. Redistributions of source code must retain the
+ above copyright notice, this list of conditions and the following disclaimer. 2. Redistributions in
+ binary form must reproduce the above copyright notice, this list of conditions and the following
+ disclaimer in the documentation and/or other materials provided with the distribution.
+ THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES ARE DISCLAIMED.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace bsdiff
+{
+
+inline void split(int64_t *I, int64_t *V, int64_t start, int64_t len, int64_t h)
+{
+    int64_t i, j, k, x, jj, kk;
+
+    if (len < 16)
+    {
+        for (k = start; k < start + len; k += j)
+        {
+            j = 1;
+            x = V[I[k] + h];
+            for (i = 1; k + i < start + len; i++)
+            {
+                if (V[I[k + i] + h] < x)
+                {
+                    x = V[I[k + i] + h];
+                    j = 0;
+                }
+                if (V[I[k + i] + h] == x)
+                {
+                    std::swap(I[k + j], I[k + i]);
+                    j++;
+                }
+            }
+            for (i = 0; i < j; i++)
+                V[I[k + i]] = k + j - 1;
+            if (j == 1)
+                I[k] = -1;
+        }
+        return;
+    }
+
+    x = V[I[start + len / 2] + h];
+    jj = 0;
+    kk = 0;
+    for (i = start; i < start + len; i++)
+    {
+        if (V[I[i] + h] < x)
+            jj++;
+        if (V[I[i] + h] == x)
+            kk++;
+    }
+    jj += start;
+    kk += jj;
+
+    i = start;
+    j = 0;
+    k = 0;
+    while (i < jj)
+    {
+        if (V[I[i] + h] < x)
+            i++;
+        else if (V[I[i] + h] == x)
+            std::swap(I[i], I[jj + j++]);
+        else
+            std::swap(I[i], I[kk + k++]);
+    }
+
+    while (jj + j < kk)
+    {
+        if (V[I[jj + j] + h] == x)
+            j++;
+        else
+            std::swap(I[jj + j], I[kk + k++]);
+    }
+
+    if (jj > start)
+        split(I, V, start, jj - start, h);
+
+    for (i = 0; i < kk - jj; i++)
+        V[I[jj + i]] = kk - 1;
+    if (jj == kk - 1)
+        I[jj] = -1;
+
+    if (start + len > kk)
+        split(I, V, kk, start + len - kk, h);
+}
+
+// Suffix array of old in I (Larsson-Sadakane)
+inline void qsufsort(int64_t *I, int64_t *V, const uint8_t *old, int64_t oldsize)
+{
+    int64_t buckets[256] = {0};
+    int64_t i, h, len;
+
+    for (i = 0; i < oldsize; i++)
+        buckets[old[i]]++;
+    for (i = 1; i < 256; i++)
+        buckets[i] += buckets[i - 1];
+    for (i = 255; i > 0; i--)
+        buckets[i] = buckets[i - 1];
+    buckets[0] = 0;
+
+    for (i = 0; i < oldsize; i++)
+        I[++buckets[old[i]]] = i;
+    I[0] = oldsize;
+    for (i = 0; i < oldsize; i++)
+        V[i] = buckets[old[i]];
+    V[oldsize] = 0;
+    for (i = 1; i < 256; i++)
+        if (buckets[i] == buckets[i - 1] + 1)
+            I[buckets[i]] = -1;
+    I[0] = -1;
+
+    for (h = 1; I[0] != -(oldsize + 1); h += h)
+    {
+        len = 0;
+        for (i = 0; i < oldsize + 1;)
+        {
+            if (I[i] < 0)
+            {
+                len -= I[i];
+                i -= I[i];
+            }
+            else
+            {
+                if (len)
+                    I[i - len] = -len;
+                len = V[I[i]] + 1 - i;
+                split(I, V, i, len, h);
+                i += len;
+                len = 0;
+            }
+        }
+        if (len)
+            I[i - len] = -len;
+    }
+
+    for (i = 0; i < oldsize + 1; i++)
+        I[V[i]] = i;
+}
+
+inline int64_t matchlen(const uint8_t *old, int64_t oldsize, const uint8_t *now, int64_t newsize)
+{
+    int64_t i;
+    for (i = 0; (i < oldsize) && (i < newsize); i++)
+        if (old[i] != now[i])
+            break;
+    return i;
+}
+
+inline int64_t search(const int64_t *I, const uint8_t *old, int64_t oldsize, const uint8_t *now, int64_t newsize,
+                      int64_t st, int64_t en, int64_t *pos)
+{
+    while (en - st >= 2)
+    {
+        int64_t x = st + (en - st) / 2;
+        if (memcmp(old + I[x], now, std::min(oldsize - I[x], newsize)) < 0)
+            st = x;
+        else
+            en = x;
+    }
+
+    int64_t x = matchlen(old + I[st], oldsize - I[st], now, newsize);
+    int64_t y = matchlen(old + I[en], oldsize - I[en], now, newsize);
+    *pos = (x > y) ? I[st] : I[en];
+    return std::max(x, y);
+}
+
+inline void offtout(int64_t x, std::string &out)
+{
+    uint64_t y = (x < 0) ? -x : x;
+    for (int i = 0; i < 8; i++)
+    {
+        uint8_t b = y & 0xff;
+        if ((i == 7) && (x < 0))
+            b |= 0x80;
+        out += (char)b;
+        y >>= 8;
+    }
+}
+
+// Patch turning old into now
+inline std::string diff(const std::string &old_image, const std::string &new_image)
+{
+    const uint8_t *old = (const uint8_t *)old_image.data();
+    const uint8_t *now = (const uint8_t *)new_image.data();
+    int64_t oldsize = old_image.size(), newsize = new_image.size();
+
+    std::vector<int64_t> I(oldsize + 1), V(oldsize + 1);
+    qsufsort(I.data(), V.data(), old, oldsize);
+
+    std::string patch = "ENDSLEY/BSDIFF43";
+    offtout(newsize, patch);
+
+    int64_t scan = 0, len = 0, pos = 0;
+    int64_t lastscan = 0, lastpos = 0, lastoffset = 0;
+    while (scan < newsize)
+    {
+        int64_t oldscore = 0, scsc;
+
+        for (scsc = scan += len; scan < newsize; scan++)
+        {
+            len = search(I.data(), old, oldsize, now + scan, newsize - scan, 0, oldsize, &pos);
+
+            for (; scsc < scan + len; scsc++)
+                if ((scsc + lastoffset < oldsize) && (old[scsc + lastoffset] == now[scsc]))
+                    oldscore++;
+
+            if (((len == oldscore) && (len != 0)) || (len > oldscore + 8))
+                break;
+
+            if ((scan + lastoffset < oldsize) && (old[scan + lastoffset] == now[scan]))
+                oldscore--;
+        }
+
+        if ((len != oldscore) || (scan == newsize))
+        {
+            int64_t s = 0, Sf = 0, lenf = 0, i;
+            for (i = 0; (lastscan + i < scan) && (lastpos + i < oldsize);)
+            {
+                if (old[lastpos + i] == now[lastscan + i])
+                    s++;
+                i++;
+                if (s * 2 - i > Sf * 2 - lenf)
+                {
+                    Sf = s;
+                    lenf = i;
+                }
+            }
+
+            int64_t lenb = 0;
+            if (scan < newsize)
+            {
+                int64_t Sb = 0;
+                s = 0;
+                for (i = 1; (scan >= lastscan + i) && (pos >= i); i++)
+                {
+                    if (old[pos - i] == now[scan - i])
+                        s++;
+                    if (s * 2 - i > Sb * 2 - lenb)
+                    {
+                        Sb = s;
+                        lenb = i;
+                    }
+                }
+            }
+
+            if (lastscan + lenf > scan - lenb)
+            {
+                int64_t overlap = (lastscan + lenf) - (scan - lenb);
+                int64_t Ss = 0, lens = 0;
+                s = 0;
+                for (i = 0; i < overlap; i++)
+                {
+                    if (now[lastscan + lenf - overlap + i] == old[lastpos + lenf - overlap + i])
+                        s++;
+                    if (now[scan - lenb + i] == old[pos - lenb + i])
+                        s--;
+                    if (s > Ss)
+                    {
+                        Ss = s;
+                        lens = i + 1;
+                    }
+                }
+                lenf += lens - overlap;
+                lenb -= lens;
+            }
+
+            offtout(lenf, patch);
+            offtout((scan - lenb) - (lastscan + lenf), patch);
+            offtout((pos - lenb) - (lastpos + lenf), patch);
+
+            for (i = 0; i < lenf; i++)
+                patch += (char)(now[lastscan + i] - old[lastpos + i]);
+            patch.append(new_image, lastscan + lenf, (scan - lenb) - (lastscan + lenf));
+
+            lastscan = scan - lenb;
+            lastpos = pos - lenb;
+            lastoffset = pos - scan;
+        }
+    }
+
+    return patch;
+}
+
+} // namespace bsdiff
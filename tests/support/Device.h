@@ -0,0 +1,100 @@
+/*
+ Device.h - a THiNX instance on the mocks, with scripted API and broker
+
+ Private members are opened up so tests can drive parse() and inspect the check-in engine directly.
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "FS.h"
+#include "MockBroker.h"
+#include "MockNetwork.h"
+
+#define private public
+#include "THiNXLib32.h"
+#undef private
+
+#define DEVICE_API_KEY "4f1a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c5d6e7f8"
+#define DEVICE_OWNER "cedc16bb6bb06daaa3ff6d30666d91aacd6e3efbf9abbc151b4dcade59af7c12"
+#define DEVICE_UDID "d6ff2bb0-df34-11e7-b351-eb37822aa172"
+#define DEVICE_API_PORT 7443
+#define DEVICE_MQTT_PORT 8883
+
+// Fresh flash, EEPROM and network, as after a power cycle
+inline void device_reset()
+{
+    SPIFFS.format();
+    memset(EEPROM.data, 0, sizeof(EEPROM.data));
+    Network.reset();
+    WiFi.connected_ = true;
+    WiFi.resolve = true;
+    BearSSL::WiFiClientSecure::handshake_fails = false;
+    ESPhttpUpdate.result = HTTP_UPDATE_NO_UPDATES;
+}
+
+// HTTP response around a JSON body, framed by Content-Length or as chunks of chunk bytes
+inline std::string http_response(const std::string &body, size_t chunk = 0, bool keep_alive = false)
+{
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n";
+    response += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if (chunk == 0)
+        return response + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    response += "Transfer-Encoding: chunked\r\n\r\n";
+    char size[16];
+    for (size_t pos = 0; pos < body.size(); pos += chunk)
+    {
+        std::string piece = body.substr(pos, chunk);
+        snprintf(size, sizeof(size), "%zx\r\n", piece.size());
+        response += size + piece + "\r\n";
+    }
+    return response + "0\r\n\r\n";
+}
+
+inline std::string registration_payload(const char *alias = "host-device")
+{
+    return std::string("{\"registration\":{\"success\":true,\"status\":\"OK\",\"alias\":\"") + alias +
+           "\",\"owner\":\"" DEVICE_OWNER "\",\"udid\":\"" DEVICE_UDID "\",\"auto_update\":false,"
+           "\"forced_update\":false,\"timestamp\":1600000000,\"mqtt_alias\":\"k3\"}}";
+}
+
+inline std::string update_payload()
+{
+    return "{\"registration\":{\"status\":\"FIRMWARE_UPDATE\",\"success\":true,\"udid\":\"" DEVICE_UDID "\","
+           "\"version\":\"2.9.451\",\"mac\":\"5CCF7FABCDEF\",\"commit\":\"4f7a8c1\",\"ott\":\"\",\"url\":\"\"}}";
+}
+
+inline std::string notification_payload()
+{
+    return "{\"notification\":{\"response_type\":\"bool\",\"response\":false,\"nid\":\"nid-1\"}}";
+}
+
+inline std::string configuration_payload()
+{
+    return "{\"configuration\":{\"THINX_ENV_SSID\":\"office\",\"THINX_ENV_PASS\":\"secret\",\"interval\":60,"
+           "\"sensors\":[{\"id\":1,\"unit\":\"C\"},{\"id\":2,\"unit\":\"%\"}]}}";
+}
+
+// Calls loop() until done() or max_loops, returns the number of calls
+inline unsigned device_run(THiNX &thx, std::function<bool()> done, unsigned max_loops = 10000)
+{
+    unsigned loops = 0;
+    while (!done() && loops < max_loops)
+    {
+        thx.loop();
+        loops++;
+    }
+    return loops;
+}
+
+inline bool device_checkin_idle(THiNX &thx)
+{
+    return (thx.thinx_checkin_state == THiNX::CHECKIN_IDLE) && (thx.thinx_phase != THiNX::CONNECT_API) &&
+           (thx.thinx_phase != THiNX::CONNECT_WIFI);
+}
@@ -0,0 +1,83 @@
+/*
+ HeapCounter.cpp - malloc() replacement on top of glibc's own allocator
+*/
+
+#include "HeapCounter.h"
+
+#include <malloc.h>
+#include <string.h>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static HeapStats stats;
+
+static void count_alloc(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+    stats.allocations++;
+    stats.in_use += malloc_usable_size(ptr);
+    if (stats.in_use > stats.peak)
+        stats.peak = stats.in_use;
+}
+
+static void count_free(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+    stats.frees++;
+    stats.in_use -= malloc_usable_size(ptr);
+}
+
+extern "C" {
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    count_alloc(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_free(ptr);
+    void *result = __libc_realloc(ptr, size);
+    if (result == nullptr && ptr != nullptr && size != 0)
+    {
+        stats.frees--; // the old block is still allocated
+        stats.in_use += malloc_usable_size(ptr);
+        return nullptr;
+    }
+    count_alloc(result);
+    return result;
+}
+
+void free(void *ptr)
+{
+    count_free(ptr);
+    __libc_free(ptr);
+}
+
+}
+
+HeapStats heap_stats(void)
+{
+    return stats;
+}
+
+void heap_reset_peak(void)
+{
+    stats.peak = stats.in_use;
+}
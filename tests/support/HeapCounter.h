@@ -0,0 +1,39 @@
+/*
+ HeapCounter.h - counts heap allocations of the test process
+
+ malloc() and friends are replaced for the whole executable, operator new ends up here too.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct HeapStats
+{
+    uint64_t allocations;   // successful malloc/calloc/realloc calls
+    uint64_t frees;
+    size_t in_use;          // bytes currently allocated
+    size_t peak;            // high-water mark of in_use since the last reset_peak()
+};
+
+HeapStats heap_stats(void);
+void heap_reset_peak(void);
+
+// Heap use of one measured section
+class HeapProbe
+{
+public:
+    HeapProbe() { start(); }
+    void start()
+    {
+        heap_reset_peak();
+        _start = heap_stats();
+    }
+    uint64_t allocations() const { return heap_stats().allocations - _start.allocations; }
+    long growth() const { return (long)heap_stats().in_use - (long)_start.in_use; }
+    size_t peak() const { return heap_stats().peak - _start.in_use; } // above the level at start()
+
+private:
+    HeapStats _start;
+};
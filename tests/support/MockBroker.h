@@ -0,0 +1,165 @@
+/*
+ MockBroker.h - answers MQTT packets written to a MockSocket like a broker would
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MockNetwork.h"
+
+class MockBroker
+{
+public:
+    struct Message
+    {
+        std::string topic;
+        std::string payload;
+        uint8_t qos;
+        bool retain;
+    };
+
+    // Serve the next connection to port
+    std::shared_ptr<MockSocket> listen(uint16_t port = 0)
+    {
+        socket = Network.expect(port);
+        socket->on_write = [this](MockSocket &s) { receive(s); };
+        parsed = 0;
+        return socket;
+    }
+
+    // Deliver a PUBLISH to the client
+    void publish(const std::string &topic, const std::string &payload, uint8_t qos = 0, uint16_t pid = 1)
+    {
+        std::string body;
+        body += (char)(topic.size() >> 8);
+        body += (char)(topic.size() & 0xff);
+        body += topic;
+        if (qos)
+        {
+            body += (char)(pid >> 8);
+            body += (char)(pid & 0xff);
+        }
+        body += payload;
+        send(0x30 | (qos << 1), body);
+    }
+
+    void send(uint8_t header, const std::string &body)
+    {
+        std::string packet(1, (char)header);
+        size_t length = body.size();
+        do
+        {
+            uint8_t digit = length & 0x7f;
+            length >>= 7;
+            packet += (char)(digit | (length ? 0x80 : 0));
+        } while (length);
+        packet += body;
+        socket->rx += packet;
+    }
+
+    std::shared_ptr<MockSocket> socket;
+    std::vector<Message> published; // PUBLISH packets received from the client, kept if record is set
+    unsigned publishes = 0;
+    std::vector<std::string> subscribed;
+    unsigned connects = 0;
+    unsigned pings = 0;
+    bool session_present = false;
+    bool acknowledge = true; // PUBACK/PUBREC/PUBCOMP for QoS 1/2
+    bool record = true;      // off in benchmarks, keeps the broker's allocations out of the figures
+
+private:
+    size_t parsed = 0;
+
+    void receive(MockSocket &s)
+    {
+        while (true)
+        {
+            // fixed header: type, remaining length
+            size_t pos = parsed + 1, length = 0;
+            int shift = 0;
+            while (true)
+            {
+                if (pos >= s.tx.size())
+                    return;
+                uint8_t digit = s.tx[pos++];
+                length |= (size_t)(digit & 0x7f) << shift;
+                shift += 7;
+                if (!(digit & 0x80))
+                    break;
+            }
+            if (pos + length > s.tx.size())
+                return; // incomplete
+            handle((uint8_t)s.tx[parsed], s.tx.data() + pos, length);
+            parsed = pos + length;
+        }
+    }
+
+    static uint16_t word(const char *data, size_t pos)
+    {
+        return ((uint8_t)data[pos] << 8) | (uint8_t)data[pos + 1];
+    }
+
+    void reply(uint8_t header, uint16_t pid)
+    {
+        send(header, std::string{(char)(pid >> 8), (char)(pid & 0xff)});
+    }
+
+    void handle(uint8_t header, const char *body, size_t length)
+    {
+        switch (header >> 4)
+        {
+        case 1: // CONNECT
+            connects++;
+            send(0x20, std::string{(char)(session_present ? 1 : 0), 0});
+            break;
+        case 3: // PUBLISH
+        {
+            uint8_t qos = (header >> 1) & 3;
+            uint16_t topic_length = word(body, 0);
+            size_t pos = 2 + topic_length;
+            uint16_t pid = 0;
+            if (qos)
+            {
+                pid = word(body, pos);
+                pos += 2;
+            }
+            publishes++;
+            if (record)
+                published.push_back({std::string(body + 2, topic_length), std::string(body + pos, length - pos), qos, (header & 1) != 0});
+            if (acknowledge && qos == 1)
+                reply(0x40, pid);
+            if (acknowledge && qos == 2)
+                reply(0x50, pid);
+            break;
+        }
+        case 6: // PUBREL
+            reply(0x70, word(body, 0));
+            break;
+        case 8: // SUBSCRIBE
+        {
+            std::string granted;
+            for (size_t pos = 2; pos + 2 < length;)
+            {
+                uint16_t topic_length = word(body, pos);
+                subscribed.push_back(std::string(body + pos + 2, topic_length));
+                pos += 2 + topic_length;
+                granted += body[pos++];
+            }
+            send(0x90, std::string(body, 2) + granted);
+            break;
+        }
+        case 10: // UNSUBSCRIBE
+            reply(0xb0, word(body, 0));
+            break;
+        case 12: // PINGREQ
+            pings++;
+            send(0xd0, std::string());
+            break;
+        default:
+            break;
+        }
+    }
+};
@@ -0,0 +1,26 @@
+/*
+ Test.cpp - test runner
+*/
+
+#include "Test.h"
+
+int test_failures = 0;
+const char *test_current = "";
+
+std::vector<TestCase> &test_cases(void)
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+int run_tests(void)
+{
+    for (auto &test : test_cases())
+    {
+        int failures = test_failures;
+        test_current = test.name;
+        test.run();
+        printf("%s %s\n", test_failures == failures ? "PASS" : "FAIL", test.name);
+    }
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+/*
+ Test.h - minimal assertions and benchmark reporting for the host tests
+
+ A test executable defines its cases with TEST() and returns run_tests() from main(), ctest treats a
+ non-zero exit code as failure.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <vector>
+
+#include "HeapCounter.h"
+
+struct TestCase
+{
+    const char *name;
+    std::function<void()> run;
+};
+
+std::vector<TestCase> &test_cases(void);
+extern int test_failures;
+extern const char *test_current;
+
+int run_tests(void);
+
+struct TestRegistration
+{
+    TestRegistration(const char *name, std::function<void()> run) { test_cases().push_back({name, run}); }
+};
+
+#define TEST(name)                                              \
+    static void test_##name(void);                              \
+    static TestRegistration registration_##name(#name, test_##name); \
+    static void test_##name(void)
+
+#define CHECK(condition)                                                                        \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(condition))                                                                       \
+        {                                                                                       \
+            printf("  %s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, test_current, #condition); \
+            test_failures++;                                                                    \
+        }                                                                                       \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                          \
+    do                                                                                         \
+    {                                                                                          \
+        long long e_ = (long long)(expected), a_ = (long long)(actual);                        \
+        if (e_ != a_)                                                                          \
+        {                                                                                      \
+            printf("  %s:%d: %s: expected %s == %lld, got %lld\n", __FILE__, __LINE__, test_current, #actual, e_, a_); \
+            test_failures++;                                                                   \
+        }                                                                                      \
+    } while (0)
+
+#define REQUIRE(condition)                                                                      \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(condition))                                                                       \
+        {                                                                                       \
+            printf("  %s:%d: %s: REQUIRE(%s) failed\n", __FILE__, __LINE__, test_current, #condition); \
+            test_failures++;                                                                    \
+            return;                                                                             \
+        }                                                                                       \
+    } while (0)
+
+// Wall time and heap use of a benchmark section, printed as one line
+class Benchmark
+{
+public:
+    explicit Benchmark(const char *name) : _name(name), _start(std::chrono::steady_clock::now()) {}
+
+    // iterations: number of operations measured, for the per-operation figures
+    void report(unsigned long iterations, const char *extra = nullptr)
+    {
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _start).count();
+        printf("BENCH %-34s %8lu ops %12.1f us %10.3f us/op %10.0f ops/s %8.2f allocs/op %8zu B peak%s%s\n",
+               _name, iterations, us, us / iterations, iterations * 1e6 / us,
+               (double)_heap.allocations() / iterations, _heap.peak(), extra ? "  " : "", extra ? extra : "");
+    }
+
+    uint64_t allocations() const { return _heap.allocations(); }
+    size_t peak() const { return _heap.peak(); }
+
+private:
+    const char *_name;
+    std::chrono::steady_clock::time_point _start;
+    HeapProbe _heap;
+};
@@ -0,0 +1,209 @@
+/*
+ Check-in engine driven by THiNX::loop() against a scripted API server
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "Device.h"
+
+static const unsigned long checkin_timeout = 30000; // THINX_CHECKIN_TIMEOUT in THiNXLib32.cpp
+
+// Response trickles in a few bytes per loop() in small TLS records
+TEST(body_in_small_reads)
+{
+    device_reset();
+    std::string body = registration_payload();
+    auto socket = Network.expect(DEVICE_API_PORT, http_response(body));
+    socket->released = 0;
+    socket->record = 32;
+    socket->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    unsigned loops = device_run(thx, [&] {
+        socket->released += 5;
+        return device_checkin_idle(thx);
+    });
+
+    CHECK(loops > socket->rx.size() / 5);
+    CHECK(strcmp(thx.thinx_udid, DEVICE_UDID) == 0);
+    CHECK(strcmp(thx.thinx_alias, "host-device") == 0);
+    CHECK(!socket->open);
+}
+
+static std::string padded_payload(size_t padding)
+{
+    std::string body = registration_payload();
+    body.insert(body.size() - 2, ",\"padding\":\"" + std::string(padding, 'p') + "\"");
+    return body;
+}
+
+// Chunked body larger than api_body: collected in a heap buffer, which is freed after parsing
+TEST(body_larger_than_buffer)
+{
+    device_reset();
+    auto socket = Network.expect(DEVICE_API_PORT, http_response(padded_payload(THINX_RESPONSE_BUFFER), 100));
+    socket->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    device_run(thx, [&] { return device_checkin_idle(thx); });
+
+    CHECK(strcmp(thx.thinx_udid, DEVICE_UDID) == 0);
+    CHECK(thx.api_body_data == THiNX::api_body);
+    CHECK(!socket->open);
+}
+
+TEST(body_over_limit_fails)
+{
+    device_reset();
+    auto socket = Network.expect(DEVICE_API_PORT, http_response(padded_payload(THINX_RESPONSE_LIMIT)));
+    socket->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    device_run(thx, [&] { return device_checkin_idle(thx); });
+
+    CHECK(thx.thinx_udid[0] == 0);
+    CHECK(thx.api_body_data == THiNX::api_body);
+    CHECK(!socket->open);
+}
+
+TEST(error_status_is_not_parsed)
+{
+    device_reset();
+    auto socket = Network.expect(DEVICE_API_PORT, "HTTP/1.1 401 Unauthorized\r\nContent-Length: 25\r\n\r\n" + registration_payload().substr(0, 25));
+    socket->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    device_run(thx, [&] { return device_checkin_idle(thx); });
+
+    CHECK(thx.thinx_udid[0] == 0);
+    CHECK(!socket->open);
+}
+
+// Longest loop() call while the response trickles in, in mock ms (blocking reads and delays advance the mock
+// clock) and in host us
+struct LoopBudget
+{
+    unsigned long max_ms = 0;
+    unsigned long max_us = 0;
+
+    void run(THiNX &thx)
+    {
+        unsigned long ms = millis();
+        unsigned long us = micros();
+        thx.loop();
+        max_ms = std::max(max_ms, millis() - ms);
+        max_us = std::max(max_us, micros() - us);
+    }
+};
+
+TEST(loop_stays_within_budget)
+{
+    device_reset();
+    auto socket = Network.expect(DEVICE_API_PORT, http_response(registration_payload(), 64));
+    socket->released = 0;
+    socket->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    LoopBudget budget;
+    unsigned loops = device_run(thx, [&] {
+        socket->released += 3;
+        budget.run(thx);
+        return device_checkin_idle(thx);
+    });
+
+    CHECK(loops < 10000);
+    CHECK(strcmp(thx.thinx_udid, DEVICE_UDID) == 0);
+    CHECK(budget.max_ms <= 5);
+    CHECK(budget.max_us <= 20000);
+}
+
+// A body larger than api_body trickles in the same way, parse() does not wait for the rest of it
+TEST(large_body_stays_within_budget)
+{
+    device_reset();
+    auto socket = Network.expect(DEVICE_API_PORT, http_response(padded_payload(3 * THINX_RESPONSE_BUFFER)));
+    socket->released = 0;
+    socket->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    LoopBudget budget;
+    device_run(thx, [&] {
+        socket->released += 3;
+        budget.run(thx);
+        return device_checkin_idle(thx);
+    });
+
+    CHECK(strcmp(thx.thinx_udid, DEVICE_UDID) == 0);
+    CHECK(budget.max_ms <= 5);
+}
+
+// Server stops halfway through the body: the check-in times out, no single loop() waits for it
+TEST(stalled_response_times_out)
+{
+    device_reset();
+    std::string response = http_response(registration_payload());
+    auto socket = Network.expect(DEVICE_API_PORT, response);
+    socket->released = response.size() / 2;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    LoopBudget budget;
+    unsigned long start = millis();
+    device_run(thx, [&] {
+        mock_advance_millis(100);
+        budget.run(thx);
+        return device_checkin_idle(thx);
+    });
+
+    CHECK(budget.max_ms <= 5);
+    CHECK(millis() - start >= checkin_timeout);
+    CHECK(millis() - start < checkin_timeout + 1000);
+    CHECK(thx.thinx_udid[0] == 0);
+    CHECK(!socket->open);
+}
+
+// MQTT gets its own client only once it starts, with MFLN buffers when the broker supports it
+TEST(mqtt_transport_created_on_start)
+{
+    device_reset();
+    MockBroker broker;
+    broker.listen(DEVICE_MQTT_PORT);
+    Network.expect(DEVICE_API_PORT, http_response(registration_payload()))->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    device_run(thx, [&] { return thx.thinx_phase >= THiNX::CONNECT_MQTT; });
+    CHECK(thx.mqtt_transport == nullptr);
+
+    device_run(thx, [&] { return thx.thinx_phase == THiNX::COMPLETED; });
+    REQUIRE(thx.mqtt_transport != nullptr);
+    CHECK(thx.mqtt_transport != thx.api_client());
+    CHECK_EQUAL((size_t)512, broker.socket->record);
+    thx.mqtt_transport->stop();
+}
+
+// BearSSL does not report resumption, a reconnect only counts as offering the cached session
+TEST(keep_alive_handshake_counters)
+{
+    device_reset();
+    MockBroker broker;
+    broker.listen(DEVICE_MQTT_PORT);
+    auto kept = Network.expect(DEVICE_API_PORT, http_response(registration_payload(), 0, true));
+    Network.expect(DEVICE_API_PORT, http_response(registration_payload()))->server_close = true;
+
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    thx.setAPIKeepAlive(true);
+    device_run(thx, [&] { return thx.thinx_phase == THiNX::COMPLETED; });
+    kept->open = false; // server closed the kept connection
+    thx.checkin();
+    device_run(thx, [&] { return thx.thinx_checkin_state == THiNX::CHECKIN_IDLE; });
+
+    CHECK_EQUAL(1ul, thx.api_handshakes_full);
+    CHECK_EQUAL(1ul, thx.api_handshakes_offered);
+    CHECK_EQUAL(0ul, thx.api_connections_reused);
+    thx.mqtt_transport->stop();
+}
+
+int main()
+{
+    return run_tests();
+}
@@ -0,0 +1,201 @@
+/*
+ Delta update: a bsdiff patch turns image A in a file-backed running partition into B
+*/
+
+#include <stdio.h>
+#include <string>
+
+#include "Test.h"
+#include "BSDiff.h"
+#include "ESP32httpUpdate.h"
+#include "esp_ota_ops.h"
+
+static const char partition_file[] = "test_delta_update.partition";
+static const uint32_t partition_size = 0x20000;
+static const char image_md5[] = "0123456789abcdef0123456789abcdef"; // not checked by the Update mock
+
+static uint32_t seed = 1;
+
+static std::string random_bytes(size_t length)
+{
+    std::string data(length, 0);
+    for (auto &c : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        c = (char)(seed >> 16);
+    }
+    return data;
+}
+
+// Sketch A in the running partition, followed by bytes the patch must never read
+static std::string install(const std::string &image)
+{
+    std::string flash = image + std::string(partition_size - image.size(), '\xff');
+    FILE *f = fopen(partition_file, "wb");
+    fwrite(flash.data(), 1, flash.size(), f);
+    fclose(f);
+
+    static esp_partition_t running = {0x10000, partition_size, "app0", partition_file};
+    mock_running_partition = &running;
+    ESP.sketch_size = image.size();
+    return image;
+}
+
+// Build B from A with edits bsdiff has to express with every kind of record
+static std::string edited(const std::string &a)
+{
+    std::string b = a;
+    for (size_t pos = 777; pos < b.size(); pos += 4099)
+        b[pos] ^= 0x5a;                     // changed bytes: non-zero diff bytes
+    b.insert(1000, random_bytes(700));      // inserted code: extra bytes
+    b.erase(20000, 3000);                   // removed code: forward seek
+    b.insert(40000, a.substr(5000, 4000));  // block copied from before: backward seek
+    return b + random_bytes(3000);          // grown image
+}
+
+struct Record
+{
+    int64_t diff, extra, seek;
+};
+
+static int64_t offtin(const std::string &patch, size_t pos)
+{
+    int64_t value = patch[pos + 7] & 0x7f;
+    for (int i = 6; i >= 0; i--)
+        value = value * 256 + (uint8_t)patch[pos + i];
+    return (patch[pos + 7] & 0x80) ? -value : value;
+}
+
+static std::vector<Record> records(const std::string &patch)
+{
+    std::vector<Record> r;
+    for (size_t pos = DELTA_PATCH_HEADER_SIZE; pos + 24 <= patch.size();)
+    {
+        r.push_back({offtin(patch, pos), offtin(patch, pos + 8), offtin(patch, pos + 16)});
+        pos += 24 + r.back().diff + r.back().extra;
+    }
+    return r;
+}
+
+static std::string record(int64_t diff, int64_t extra, int64_t seek)
+{
+    std::string r;
+    bsdiff::offtout(diff, r);
+    bsdiff::offtout(extra, r);
+    bsdiff::offtout(seek, r);
+    return r;
+}
+
+static std::string header(int64_t size)
+{
+    std::string h = DELTA_PATCH_MAGIC;
+    bsdiff::offtout(size, h);
+    return h;
+}
+
+static HTTPUpdateResult serve(const std::string &patch)
+{
+    HTTPServer = MockHTTPServer();
+    HTTPServer.body = patch;
+    HTTPServer.record = 1024;
+    HTTPServer.headers["x-Delta"] = "bsdiff43";
+    HTTPServer.headers["x-MD5"] = image_md5;
+    Update = UpdateClass();
+
+    ESP32HTTPUpdate updater;
+    updater.rebootOnUpdate(false);
+    HTTPUpdateResult result = updater.update("http://thinx.cloud/device/firmware");
+    CHECK((result == HTTP_UPDATE_OK) || (updater.getLastError() == HTTP_UE_DELTA_FAILED));
+    return result;
+}
+
+TEST(bsdiff_patch)
+{
+    std::string a = install(random_bytes(60000));
+    std::string b = edited(a);
+    std::string patch = bsdiff::diff(a, b);
+
+    // most of B comes out of A, only inserted bytes travel as extra
+    bool backward = false;
+    int64_t extra = 0;
+    for (auto &r : records(patch))
+    {
+        backward |= r.seek < 0;
+        extra += r.extra;
+    }
+    CHECK(backward);
+    CHECK(extra < 4000);
+
+    CHECK(serve(patch) == HTTP_UPDATE_OK);
+    CHECK(HTTPServer.request_headers["x-ESP32-delta"] == "bsdiff43");
+    CHECK_EQUAL(1u, Update.ended);
+    CHECK(Update.md5 == image_md5);
+    CHECK(Update.image == b);
+}
+
+// Old bytes before the start or past the end of the sketch count as 0, like in bspatch
+TEST(old_position_outside_image)
+{
+    std::string a = install(random_bytes(1000));
+    std::string diff = random_bytes(300);
+
+    // empty record seeking to old position -100
+    CHECK(serve(header(300) + record(0, 0, -100) + record(300, 0, 0) + diff) == HTTP_UPDATE_OK);
+    std::string b = diff;
+    for (size_t i = 100; i < 300; i++)
+        b[i] += a[i - 100];
+    CHECK(Update.image == b);
+
+    // old position 900, the last 200 bytes lie past A in erased flash
+    CHECK(serve(header(300) + record(0, 0, 900) + record(300, 0, 0) + diff) == HTTP_UPDATE_OK);
+    b = diff;
+    for (size_t i = 0; i < 100; i++)
+        b[i] += a[900 + i];
+    CHECK(Update.image == b);
+}
+
+TEST(truncated_patch)
+{
+    std::string a = install(random_bytes(60000));
+    std::string patch = bsdiff::diff(a, edited(a));
+
+    for (size_t length : {patch.size() - 1, patch.size() / 2, (size_t)DELTA_PATCH_HEADER_SIZE + 10})
+    {
+        CHECK(serve(patch.substr(0, length)) == HTTP_UPDATE_FAILED);
+        CHECK_EQUAL(0u, Update.ended);
+        CHECK_EQUAL(1u, Update.aborted);
+    }
+
+    CHECK(serve(patch.substr(0, DELTA_PATCH_HEADER_SIZE - 1)) == HTTP_UPDATE_FAILED);
+    CHECK_EQUAL(0u, Update.ended);
+}
+
+TEST(corrupt_patch)
+{
+    std::string a = install(random_bytes(60000));
+    std::string patch = bsdiff::diff(a, edited(a));
+
+    std::string magic = patch;
+    magic[0] = 'X';
+    CHECK(serve(magic) == HTTP_UPDATE_FAILED);
+    CHECK(!Update.running && Update.image.empty());
+
+    std::string size = patch;
+    size[DELTA_PATCH_HEADER_SIZE - 1] = '\x80'; // negative new size
+    CHECK(serve(size) == HTTP_UPDATE_FAILED);
+
+    std::string control = patch;
+    control[DELTA_PATCH_HEADER_SIZE + 4] = '\x10'; // diff length beyond the new image
+    CHECK(serve(control) == HTTP_UPDATE_FAILED);
+    CHECK_EQUAL(1u, Update.aborted);
+
+    CHECK(serve(header(100) + record(-1, 0, 0)) == HTTP_UPDATE_FAILED);
+    CHECK(serve(header(100) + record(50, -50, 0) + random_bytes(50)) == HTTP_UPDATE_FAILED);
+}
+
+int main()
+{
+    int failures = run_tests();
+    remove(partition_file);
+    return failures;
+}
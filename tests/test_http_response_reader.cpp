@@ -0,0 +1,164 @@
+/*
+ HTTPResponseReader: framing, and bodyReady()/ended() while the body arrives in pieces
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "ESP8266WiFi.h"
+#include "HTTPResponseReader.h"
+
+static std::shared_ptr<MockSocket> socket_for(WiFiClient &client, const std::string &response, size_t record = 0)
+{
+    Network.reset();
+    auto socket = Network.expect(80, response);
+    socket->record = record;
+    socket->server_close = true;
+    client.connect("api", 80);
+    return socket;
+}
+
+static std::string read_all(HTTPResponseReader &reader)
+{
+    std::string body;
+    int c;
+    while ((c = reader.read()) >= 0)
+        body += (char)c;
+    return body;
+}
+
+TEST(content_length)
+{
+    WiFiClient client;
+    socket_for(client, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello");
+    HTTPResponseReader reader;
+    reader.begin(&client);
+    CHECK(reader.readHeaders(1000));
+    CHECK_EQUAL(200, reader.statusCode());
+    CHECK_EQUAL(5, reader.contentLength());
+    CHECK(reader.keepAlive());
+    CHECK(read_all(reader) == "hello");
+    CHECK(reader.done());
+    CHECK(reader.ended());
+}
+
+TEST(chunked)
+{
+    WiFiClient client;
+    socket_for(client, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n"
+                       "4;ext=1\r\nWiki\r\n5\r\npedia\r\n0\r\nX-Trailer: 1\r\n\r\n");
+    HTTPResponseReader reader;
+    reader.begin(&client);
+    CHECK(reader.readHeaders(1000));
+    CHECK(reader.chunked());
+    CHECK(!reader.keepAlive());
+    CHECK(read_all(reader) == "Wikipedia");
+    CHECK(reader.done());
+}
+
+TEST(headers_are_read_within_budget)
+{
+    WiFiClient client;
+    socket_for(client, "HTTP/1.1 204 No Content\r\nServer: x\r\n\r\n");
+    HTTPResponseReader reader;
+    reader.begin(&client);
+    int calls = 0;
+    while (!reader.readHeaders(8) && calls < 100)
+        calls++;
+    CHECK_EQUAL(4, calls); // 37 bytes, 8 per call
+    CHECK(reader.done());
+    CHECK(reader.bodyReady());
+}
+
+// Only the current TLS record is available, a body larger than it must not stall until more arrives
+TEST(body_ready_with_one_record_buffered)
+{
+    std::string body(2000, 'x');
+    WiFiClient client;
+    auto socket = socket_for(client, "HTTP/1.1 200 OK\r\nContent-Length: 2000\r\n\r\n" + body, 256);
+    HTTPResponseReader reader;
+    reader.begin(&client);
+    while (!reader.readHeaders(1000))
+    {
+    }
+    socket->released = socket->rx_pos + 100; // part of the first body record has arrived
+    CHECK(reader.bodyReady());
+    CHECK(!reader.ended());
+    CHECK(reader.available() <= 100);
+
+    std::string received;
+    size_t calls = 0;
+    while (!reader.ended() && calls < 1000)
+    {
+        socket->released += 50; // server keeps sending
+        while (reader.bodyReady() && reader.available() > 0)
+            received += (char)reader.read();
+        calls++;
+    }
+    CHECK(received == body);
+    CHECK(reader.done());
+}
+
+TEST(chunked_body_in_small_reads)
+{
+    std::string body;
+    for (int i = 0; i < 300; i++)
+        body += (char)('a' + i % 26);
+    std::string framed = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    for (size_t pos = 0; pos < body.size(); pos += 70)
+    {
+        char size[8];
+        snprintf(size, sizeof(size), "%zx\r\n", std::min<size_t>(70, body.size() - pos));
+        framed += size + body.substr(pos, 70) + "\r\n";
+    }
+    framed += "0\r\n\r\n";
+
+    WiFiClient client;
+    auto socket = socket_for(client, framed, 16);
+    socket->server_close = false; // kept alive, only the framing ends the body
+    socket->released = 0;
+    HTTPResponseReader reader;
+    reader.begin(&client);
+
+    std::string received;
+    for (int step = 0; step < 1000 && !reader.ended(); step++)
+    {
+        socket->released += 3;
+        if (!reader.readHeaders(16))
+        {
+            CHECK(!reader.bodyReady());
+            continue;
+        }
+        while (reader.available() > 0)
+            received += (char)reader.read();
+    }
+    CHECK(received == body);
+    CHECK(reader.done());
+    CHECK(client.connected());
+}
+
+// Without Content-Length the body ends when the server closes
+TEST(close_delimited_body)
+{
+    WiFiClient client;
+    auto socket = socket_for(client, "HTTP/1.0 200 OK\r\n\r\n{\"a\":1}");
+    socket->released = 19 + 3;
+    HTTPResponseReader reader;
+    reader.begin(&client);
+    CHECK(reader.readHeaders(1000));
+    CHECK(!reader.keepAlive());
+    CHECK(reader.bodyReady());
+    std::string received = read_all(reader);
+    CHECK(!reader.bodyReady()); // nothing buffered, not closed yet
+    CHECK(!reader.ended());
+    socket->released = (size_t)-1;
+    received += read_all(reader);
+    CHECK(received == "{\"a\":1}");
+    CHECK(reader.ended());
+    CHECK(reader.bodyReady());
+}
+
+int main()
+{
+    return run_tests();
+}
@@ -0,0 +1,199 @@
+/*
+ Compressed updates: images deflated with zlib come out of ESP32InflateStream and Update unchanged
+*/
+
+#include <string>
+#include <zlib.h>
+
+#include "Test.h"
+#include "ESP32InflateStream.h"
+#include "ESP32httpUpdate.h"
+
+static const char image_md5[] = "0123456789abcdef0123456789abcdef"; // not checked by the Update mock
+
+// Firmware-like content: repeated strings and tables (back-references across the 32 kB window), some noise
+static std::string image(size_t length)
+{
+    std::string data;
+    uint32_t seed = 7;
+    while (data.size() < length)
+    {
+        seed = seed * 1103515245 + 12345;
+        if (seed & 0x10000)
+            data += "THiNX device " + std::to_string(seed % 97) + "/";
+        else
+            data += (char)(seed >> 20);
+    }
+    data.resize(length);
+    return data;
+}
+
+// windowBits 15 writes zlib, 31 gzip; a named gzip member has optional header fields to skip
+static std::string deflated(const std::string &data, int window_bits, bool named = false)
+{
+    z_stream z = {};
+    deflateInit2(&z, 9, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+    gz_header header = {};
+    char name[] = "firmware.bin";
+    char comment[] = "build 1";
+    if (named)
+    {
+        header.name = (Bytef *)name;
+        header.comment = (Bytef *)comment;
+        header.hcrc = 1;
+        deflateSetHeader(&z, &header);
+    }
+    std::string out(deflateBound(&z, data.size()) + 64, 0);
+    z.next_in = (Bytef *)data.data();
+    z.avail_in = data.size();
+    z.next_out = (Bytef *)&out[0];
+    z.avail_out = out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+// Body arrives in records of 100 bytes and is followed by bytes the inflater must leave unread
+static std::string inflate_all(const std::string &body, ESP32InflateStream::format_t format, bool bytewise, bool *error)
+{
+    auto socket = std::make_shared<MockSocket>();
+    socket->rx = body + "next";
+    socket->record = 100;
+    WiFiClient client(socket);
+
+    ESP32InflateStream inflater(client, body.size(), format);
+    std::string out;
+    if (inflater.begin())
+    {
+        if (bytewise)
+        {
+            int c;
+            while ((c = static_cast<Stream &>(inflater).read()) >= 0)
+                out += (char)c;
+        }
+        else
+        {
+            char buffer[1000];
+            size_t n;
+            while ((n = inflater.readBytes(buffer, sizeof(buffer))) > 0)
+                out.append(buffer, n);
+        }
+        CHECK_EQUAL(out.size(), (size_t)inflater.totalOut());
+    }
+    *error = inflater.hasError();
+    CHECK(socket->rx_pos <= body.size());
+    return out;
+}
+
+TEST(round_trip)
+{
+    std::string data = image(200000);
+    struct
+    {
+        std::string body;
+        ESP32InflateStream::format_t format;
+    } cases[] = {
+        {deflated(data, 15), ESP32InflateStream::INFLATE_ZLIB},
+        {deflated(data, 31), ESP32InflateStream::INFLATE_GZIP},
+        {deflated(data, 31, true), ESP32InflateStream::INFLATE_GZIP},
+    };
+    for (auto &c : cases)
+    {
+        CHECK(c.body.size() < data.size() / 2);
+        for (bool bytewise : {false, true})
+        {
+            bool error;
+            CHECK(inflate_all(c.body, c.format, bytewise, &error) == data);
+            CHECK(!error);
+        }
+    }
+}
+
+TEST(empty_image)
+{
+    bool error;
+    CHECK(inflate_all(deflated("", 15), ESP32InflateStream::INFLATE_ZLIB, false, &error).empty());
+    CHECK(!error);
+}
+
+TEST(broken_streams)
+{
+    std::string data = image(50000);
+    std::string zlib = deflated(data, 15);
+    bool error;
+
+    inflate_all(zlib.substr(0, zlib.size() / 2), ESP32InflateStream::INFLATE_ZLIB, false, &error);
+    CHECK(error);
+
+    std::string corrupt = zlib;
+    corrupt[zlib.size() / 3] ^= 0xff;
+    CHECK(inflate_all(corrupt, ESP32InflateStream::INFLATE_ZLIB, false, &error) != data);
+    CHECK(error);
+
+    inflate_all(zlib, ESP32InflateStream::INFLATE_GZIP, false, &error); // no gzip magic
+    CHECK(error);
+}
+
+static int last_error = 0;
+
+static HTTPUpdateResult serve(const std::string &body, const char *encoding, size_t size, bool md5 = true)
+{
+    HTTPServer = MockHTTPServer();
+    HTTPServer.body = body;
+    HTTPServer.record = 1024;
+    HTTPServer.headers["x-Encoding"] = encoding;
+    HTTPServer.headers["x-Size"] = std::to_string(size);
+    if (md5)
+        HTTPServer.headers["x-MD5"] = image_md5;
+    Update = UpdateClass();
+
+    ESP32HTTPUpdate updater;
+    updater.rebootOnUpdate(false);
+    HTTPUpdateResult result = updater.update("http://thinx.cloud/device/firmware");
+    if (result != HTTP_UPDATE_OK)
+        last_error = updater.getLastError();
+    return result;
+}
+
+TEST(compressed_update)
+{
+    std::string data = image(100000);
+
+    CHECK(serve(deflated(data, 31), "gzip", data.size()) == HTTP_UPDATE_OK);
+    CHECK(HTTPServer.request_headers["x-ESP32-encoding"] == "gzip, deflate");
+    CHECK(Update.image == data);
+    CHECK(Update.md5 == image_md5);
+    CHECK_EQUAL(1u, Update.ended);
+
+    CHECK(serve(deflated(data, 15), "deflate", data.size()) == HTTP_UPDATE_OK);
+    CHECK(Update.image == data);
+}
+
+TEST(compressed_update_refused)
+{
+    std::string data = image(20000);
+    std::string body = deflated(data, 31);
+
+    // gzip trailer is not checked, the image MD5 is what verifies it
+    CHECK(serve(body, "gzip", data.size(), false) == HTTP_UPDATE_FAILED);
+    CHECK_EQUAL(HTTP_UE_SERVER_FAULTY_MD5, last_error);
+    CHECK(!Update.running && Update.image.empty());
+
+    CHECK(serve(body, "br", data.size()) == HTTP_UPDATE_FAILED);
+    CHECK_EQUAL(HTTP_UE_DECOMPRESS_FAILED, last_error);
+
+    std::string corrupt = body;
+    corrupt[body.size() / 2] ^= 0xff;
+    CHECK(serve(corrupt, "gzip", data.size()) == HTTP_UPDATE_FAILED);
+    CHECK_EQUAL(HTTP_UE_DECOMPRESS_FAILED, last_error);
+    CHECK_EQUAL(0u, Update.ended);
+
+    CHECK(serve(body.substr(0, body.size() / 2), "gzip", data.size()) == HTTP_UPDATE_FAILED);
+    CHECK_EQUAL(0u, Update.ended);
+}
+
+int main()
+{
+    return run_tests();
+}
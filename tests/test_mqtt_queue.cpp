@@ -0,0 +1,154 @@
+/*
+ PubSubClient outbound queue: wrap-around and short writes; in-flight window
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "ESP8266WiFi.h"
+#include "MockBroker.h"
+#include "PubSubClient.h"
+
+// PUBLISH to "t/N" with this payload is 30 bytes, the 100 byte queue holds three
+static const std::string payload(23, 'p');
+
+struct Connection
+{
+    MockBroker broker;
+    WiFiClient transport;
+    PubSubClient client;
+    uint8_t queue[100];
+
+    Connection() : client(transport, String("broker"), 1883)
+    {
+        Network.reset();
+        broker.listen(1883);
+        client.set_queue(queue, sizeof(queue), PubSubClient::QUEUE_DROP_OLDEST);
+        client.connect(String("test"));
+    }
+
+    void queue_message(char n)
+    {
+        std::string topic = std::string("t/") + n;
+        client.queue(topic.c_str(), (const uint8_t *)payload.data(), payload.size());
+    }
+
+    // B, C and D are queued after A was dropped, D wraps around the end of the ring
+    void queue_wrapped()
+    {
+        for (char n = 'A'; n <= 'D'; n++)
+            queue_message(n);
+        CHECK_EQUAL(1u, client.queue_dropped());
+        CHECK_EQUAL(90u, client.queued());
+    }
+
+    std::string topics()
+    {
+        std::string t;
+        for (auto &m : broker.published)
+        {
+            t += m.topic.substr(2);
+            CHECK(m.payload == payload);
+        }
+        return t;
+    }
+
+    void reconnect()
+    {
+        CHECK(!client.connected());
+        broker.listen(1883);
+        CHECK(client.connect(String("test")));
+    }
+};
+
+TEST(flush_across_wrap)
+{
+    Connection c;
+    c.queue_wrapped();
+    CHECK(c.client.loop());
+    CHECK(c.topics() == "BCD");
+    CHECK_EQUAL(2u, c.broker.socket->writes.size() - 1); // CONNECT, then both sides of the ring
+    CHECK_EQUAL(0u, c.client.queued());
+}
+
+// The first run is written completely, D is cut where it wraps back to the start of the ring
+TEST(short_write_after_wrap)
+{
+    Connection c;
+    c.queue_wrapped();
+    c.broker.socket->write_limits = {70, 5};
+    CHECK(!c.client.loop());
+    CHECK(c.topics() == "BC");
+    CHECK_EQUAL(0u, c.client.queued());
+    CHECK_EQUAL(2u, c.client.queue_dropped());
+
+    c.reconnect();
+    c.queue_message('E');
+    CHECK(c.client.loop());
+    CHECK(c.topics() == "BCE");
+}
+
+// C is cut in the first run, D still wraps and goes out intact after reconnecting
+TEST(short_write_before_wrap)
+{
+    Connection c;
+    c.queue_wrapped();
+    c.broker.socket->write_limits = {45};
+    CHECK(!c.client.loop());
+    CHECK(c.topics() == "B");
+    CHECK_EQUAL(30u, c.client.queued());
+    CHECK_EQUAL(2u, c.client.queue_dropped());
+
+    c.reconnect();
+    CHECK_EQUAL(2u, c.broker.connects);
+    CHECK(c.client.loop());
+    CHECK(c.topics() == "BD");
+    CHECK_EQUAL(0u, c.client.queued());
+}
+
+// Nothing written: no packet is lost
+TEST(refused_write)
+{
+    Connection c;
+    c.queue_wrapped();
+    c.broker.socket->write_limits = {0};
+    CHECK(!c.client.loop());
+    CHECK_EQUAL(90u, c.client.queued());
+    CHECK_EQUAL(1u, c.client.queue_dropped());
+
+    c.reconnect();
+    CHECK(c.client.loop());
+    CHECK(c.topics() == "BCD");
+}
+
+// A full in-flight window makes publish() fail at once, it succeeds again after loop() took an acknowledgement
+TEST(full_inflight_window_does_not_block)
+{
+    Connection c;
+    c.client.set_inflight_window(2);
+    c.broker.acknowledge = false;
+
+    MQTT::Publish first(String("t/1"), String("x"));
+    first.set_qos(1);
+    CHECK(c.client.publish(first));
+    MQTT::Publish second(String("t/2"), String("x"));
+    second.set_qos(1);
+    CHECK(c.client.publish(second));
+
+    MQTT::Publish third(String("t/3"), String("x"));
+    third.set_qos(1);
+    unsigned long start = millis();
+    CHECK(!c.client.publish(third));
+    CHECK(millis() - start < 10);
+    CHECK_EQUAL(2, (int)c.client.inflight());
+
+    c.broker.send(0x40, std::string{(char)(first.packet_id() >> 8), (char)(first.packet_id() & 0xff)});
+    CHECK(c.client.publish(third));
+    CHECK_EQUAL(2, (int)c.client.inflight());
+    CHECK_EQUAL(3u, c.broker.publishes);
+}
+
+int main()
+{
+    return run_tests();
+}
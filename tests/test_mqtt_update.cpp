@@ -0,0 +1,139 @@
+/*
+ MQTTUpdate: chunked images are verified after the last chunk, interrupted ones restart
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "FS.h"
+#include "MQTTUpdate.h"
+#include "Updater.h"
+
+static const uint32_t image_id = 7;
+static const uint32_t chunk_size = 1000;
+
+static void put32(std::string &s, uint32_t value)
+{
+    s += (char)(value >> 24);
+    s += (char)(value >> 16);
+    s += (char)(value >> 8);
+    s += (char)value;
+}
+
+static std::string image(size_t size)
+{
+    std::string data(size, 0);
+    for (size_t i = 0; i < size; i++)
+        data[i] = (char)(i * 31 + (i >> 8));
+    return data;
+}
+
+static std::string begin_message(const std::string &data)
+{
+    uint8_t hash[SHA256_BLOCK_SIZE];
+    Sha256 sha;
+    sha.update((const uint8_t *)data.data(), data.size());
+    sha.final(hash);
+
+    std::string m = "B";
+    put32(m, image_id);
+    put32(m, data.size());
+    m.append((const char *)hash, sizeof(hash));
+    return m;
+}
+
+static uint32_t crc32(const std::string &data)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (unsigned char c : data)
+    {
+        crc ^= c;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static MQTTUpdate::status send_chunk(MQTTUpdate &update, const std::string &data, uint32_t offset)
+{
+    std::string chunk = data.substr(offset, chunk_size);
+    std::string m = "C";
+    put32(m, image_id);
+    put32(m, offset);
+    put32(m, crc32(chunk));
+    m += chunk;
+    return update.handle((const uint8_t *)m.data(), m.size());
+}
+
+static MQTTUpdate::status start(MQTTUpdate &update, const std::string &begin)
+{
+    return update.handle((const uint8_t *)begin.data(), begin.size());
+}
+
+TEST(image_committed)
+{
+    SPIFFS.format();
+    Update = UpdaterClass();
+    std::string data = image(10500);
+    MQTTUpdate update;
+    CHECK_EQUAL((int)MQTTUpdate::STARTED, (int)start(update, begin_message(data)));
+
+    MQTTUpdate::status result = MQTTUpdate::WRITTEN;
+    for (uint32_t offset = 0; offset < data.size(); offset += chunk_size)
+        result = send_chunk(update, data, offset);
+    CHECK_EQUAL((int)MQTTUpdate::COMPLETED, (int)result);
+    CHECK(Update.image == data);
+    CHECK_EQUAL(1u, Update.committed);
+    CHECK(!SPIFFS.exists("/thinx.ota"));
+}
+
+// The last chunk is written, then the hash check fails and the updater is reset without committing
+TEST(wrong_hash_discarded)
+{
+    SPIFFS.format();
+    Update = UpdaterClass();
+    std::string data = image(5000);
+    std::string begin = begin_message(data);
+    begin[9] ^= 1;
+    MQTTUpdate update;
+    CHECK_EQUAL((int)MQTTUpdate::STARTED, (int)start(update, begin));
+
+    MQTTUpdate::status result = MQTTUpdate::WRITTEN;
+    for (uint32_t offset = 0; offset < data.size(); offset += chunk_size)
+        result = send_chunk(update, data, offset);
+    CHECK_EQUAL((int)MQTTUpdate::ERROR_SHA, (int)result);
+    CHECK_EQUAL(data.size(), Update.image.size());
+    CHECK_EQUAL(0u, Update.committed);
+    CHECK(!Update.isRunning());
+    CHECK(!update.active());
+    CHECK(!SPIFFS.exists("/thinx.ota"));
+}
+
+// Only the start of an image is saved, a reboot restarts it from offset 0
+TEST(interrupted_restarts)
+{
+    SPIFFS.format();
+    Update = UpdaterClass();
+    std::string data = image(100000);
+    {
+        MQTTUpdate update;
+        start(update, begin_message(data));
+        size_t writes = SPIFFS.write_opens;
+        for (uint32_t offset = 0; offset < 50000; offset += chunk_size)
+            CHECK_EQUAL((int)MQTTUpdate::WRITTEN, (int)send_chunk(update, data, offset));
+        CHECK_EQUAL(writes, SPIFFS.write_opens);
+    }
+
+    MQTTUpdate update;
+    update.restore();
+    CHECK(update.interrupted());
+    CHECK_EQUAL(image_id, update.id());
+    CHECK_EQUAL((uint32_t)data.size(), update.size());
+    CHECK_EQUAL(0u, update.offset());
+    CHECK(!update.active());
+}
+
+int main()
+{
+    return run_tests();
+}
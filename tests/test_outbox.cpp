@@ -0,0 +1,161 @@
+/*
+ MQTTOutbox: stored messages are replayed in order, live ones bypass flash once the backlog is gone
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "ESP8266WiFi.h"
+#include "FS.h"
+#include "MockBroker.h"
+#include "MQTTOutbox.h"
+#include "PubSubClient.h"
+
+struct Connection
+{
+    MockBroker broker;
+    WiFiClient transport;
+    PubSubClient client;
+    uint8_t queue[4096];
+
+    Connection() : client(transport, String("broker"), 1883)
+    {
+        Network.reset();
+        broker.listen(1883);
+        client.set_queue(queue, sizeof(queue), PubSubClient::QUEUE_DROP_OLDEST);
+        client.connect(String("test"));
+    }
+
+    std::string payloads()
+    {
+        client.loop();
+        std::string p;
+        for (auto &m : broker.published)
+            p += m.payload + " ";
+        return p;
+    }
+};
+
+static void append(MQTTOutbox &outbox, int n)
+{
+    std::string payload = std::to_string(n);
+    CHECK(outbox.append("t", (const uint8_t *)payload.data(), payload.size(), false));
+}
+
+static std::string sequence(int from, int to)
+{
+    std::string s;
+    for (int n = from; n < to; n++)
+        s += std::to_string(n) + " ";
+    return s;
+}
+
+// Messages appended while the backlog drains keep their place behind it
+TEST(backlog_before_live)
+{
+    SPIFFS.format();
+    MQTTOutbox outbox;
+    outbox.begin();
+    for (int n = 0; n < 40; n++)
+        append(outbox, n);
+    outbox.flush();
+
+    Connection c;
+    for (int n = 40; n < 60; n++)
+    {
+        outbox.drain(c.client, 2);
+        append(outbox, n);
+    }
+    while (outbox.pending())
+        outbox.drain(c.client, 4);
+    CHECK(c.payloads() == sequence(0, 60));
+    CHECK(!SPIFFS.exists("/thinx.q0"));
+}
+
+// Once SPIFFS is empty, buffered messages go to the client without a flash write
+TEST(live_after_backlog_skips_flash)
+{
+    SPIFFS.format();
+    MQTTOutbox outbox;
+    outbox.begin();
+    for (int n = 0; n < 10; n++)
+        append(outbox, n);
+    outbox.flush();
+
+    Connection c;
+    CHECK_EQUAL(10, (int)outbox.drain(c.client, 10));
+    CHECK(!outbox.pending());
+
+    size_t writes = SPIFFS.write_opens;
+    for (int n = 10; n < 100; n++)
+    {
+        append(outbox, n);
+        CHECK_EQUAL(1, (int)outbox.drain(c.client, 1));
+    }
+    CHECK_EQUAL(writes, SPIFFS.write_opens);
+    CHECK(c.payloads() == sequence(0, 100));
+}
+
+// The read position is written when a segment is done, not after every drain
+TEST(cursor_saved_per_segment)
+{
+    SPIFFS.format();
+    MQTTOutbox outbox;
+    outbox.begin();
+    for (int n = 0; n < 100; n++)
+        append(outbox, n);
+    outbox.flush();
+
+    Connection c;
+    size_t writes = SPIFFS.write_opens;
+    unsigned drains = 0;
+    while (outbox.pending())
+    {
+        outbox.drain(c.client, 1);
+        drains++;
+    }
+    CHECK_EQUAL(100u, drains);
+    CHECK_EQUAL(writes + 1, SPIFFS.write_opens);
+    CHECK(c.payloads() == sequence(0, 100));
+}
+
+// Unflushed progress is lost on reboot, the segment is sent again rather than skipped
+TEST(reboot_resends_partial_segment)
+{
+    SPIFFS.format();
+    {
+        MQTTOutbox outbox;
+        outbox.begin();
+        for (int n = 0; n < 10; n++)
+            append(outbox, n);
+        outbox.flush();
+        Connection c;
+        outbox.drain(c.client, 4);
+    }
+
+    MQTTOutbox outbox;
+    outbox.begin();
+    Connection c;
+    while (outbox.pending())
+        outbox.drain(c.client, 4);
+    CHECK(c.payloads() == sequence(0, 10));
+}
+
+// Record lengths are 16 bits, longer messages are refused instead of stored truncated
+TEST(oversize_rejected)
+{
+    SPIFFS.format();
+    MQTTOutbox outbox;
+    outbox.begin();
+    std::string large(0x10001, 'x');
+    CHECK(!outbox.append("t", (const uint8_t *)large.data(), large.size(), false));
+    large.resize(MQTT_OUTBOX_RECORD);
+    CHECK(!outbox.append("t", (const uint8_t *)large.data(), large.size(), false));
+    CHECK(!outbox.pending());
+    CHECK_EQUAL(0u, SPIFFS.usedBytes());
+}
+
+int main()
+{
+    return run_tests();
+}
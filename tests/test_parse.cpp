@@ -0,0 +1,75 @@
+/*
+ parse() keeps device identity in fixed slots: repeated payloads leave the heap where it was
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "Device.h"
+
+static const unsigned cycles = 10000;
+
+static void check_flat(THiNX &thx, const std::string &payload)
+{
+    thx.parse(payload.c_str()); // first call may allocate lazily
+    uint32_t free_heap = ESP.getFreeHeap();
+    HeapProbe probe;
+    for (unsigned i = 0; i < cycles; i++)
+        thx.parse(payload.c_str());
+    CHECK_EQUAL(0l, probe.growth());
+    CHECK(probe.peak() < 8192);
+    CHECK_EQUAL(free_heap, ESP.getFreeHeap());
+}
+
+TEST(registration)
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    check_flat(thx, registration_payload());
+    CHECK(strcmp(thx.thinx_udid, DEVICE_UDID) == 0);
+}
+
+// Alias changes on every cycle, each replacing the previous value in place
+TEST(registration_changing_alias)
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    std::string payloads[] = {registration_payload("a"), registration_payload("a longer alias of this device")};
+    thx.parse(payloads[1].c_str());
+    HeapProbe probe;
+    for (unsigned i = 0; i < cycles; i++)
+        thx.parse(payloads[i % 2].c_str());
+    CHECK_EQUAL(0l, probe.growth());
+    CHECK(strcmp(thx.thinx_alias, "a longer alias of this device") == 0);
+
+    // Too long for the slot: rejected, the last alias stays
+    thx.parse(registration_payload("an alias longer than THINX_ALIAS_SIZE").c_str());
+    CHECK(strcmp(thx.thinx_alias, "a longer alias of this device") == 0);
+}
+
+TEST(update)
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    check_flat(thx, update_payload());
+}
+
+TEST(notification)
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    check_flat(thx, notification_payload());
+}
+
+TEST(configuration)
+{
+    device_reset();
+    THiNX thx(DEVICE_API_KEY, DEVICE_OWNER);
+    thx.setPushConfigCallback([](char *) {});
+    check_flat(thx, configuration_payload());
+}
+
+int main()
+{
+    return run_tests();
+}
@@ -0,0 +1,141 @@
+/*
+ Publishing does not touch the heap
+*/
+
+#include <string>
+
+#include "Test.h"
+#include "Device.h"
+#include "MockBroker.h"
+
+static const unsigned messages = 1000;
+static const char payload[] = "{\"temperature\":21.5,\"humidity\":48}";
+
+// Registered device with an MQTT connection, broker bookkeeping kept out of the counts
+struct OnlineDevice
+{
+    struct Reset
+    {
+        Reset() { device_reset(); }
+    } reset; // before THiNX is constructed
+    MockBroker broker;
+    THiNX thx;
+
+    OnlineDevice() : thx(DEVICE_API_KEY, DEVICE_OWNER)
+    {
+        broker.listen(DEVICE_MQTT_PORT);
+        Network.expect(DEVICE_API_PORT, http_response(registration_payload()))->server_close = true;
+        device_run(thx, [&] { return thx.thinx_phase == THiNX::COMPLETED; });
+        broker.record = false;
+        broker.socket->tx.reserve(1 << 20);
+        broker.socket->writes.reserve(1 << 14);
+        thx.loop(); // flushes what the connection queued
+    }
+
+    // THiNX keeps its MQTT client for the life of the device, which holds the broker's large buffers
+    ~OnlineDevice()
+    {
+        if (thx.mqtt_transport)
+            thx.mqtt_transport->stop();
+    }
+};
+
+TEST(device_publish)
+{
+    OnlineDevice d;
+    REQUIRE(d.thx.thinx_phase == THiNX::COMPLETED);
+    unsigned before = d.broker.publishes;
+
+    HeapProbe probe;
+    for (unsigned i = 0; i < messages; i++)
+    {
+        d.thx.publish(payload, "telemetry", false);
+        if (i % 10 == 9)
+            d.thx.loop();
+    }
+    d.thx.loop();
+    CHECK_EQUAL(0ull, (unsigned long long)probe.allocations());
+    CHECK_EQUAL(messages, d.broker.publishes - before);
+}
+
+TEST(status_publish)
+{
+    OnlineDevice d;
+    REQUIRE(d.thx.thinx_phase == THiNX::COMPLETED);
+    unsigned before = d.broker.publishes;
+
+    HeapProbe probe;
+    for (unsigned i = 0; i < messages; i++)
+    {
+        d.thx.publish_status_unretained(payload);
+        d.thx.loop();
+    }
+    CHECK_EQUAL(0ull, (unsigned long long)probe.allocations());
+    CHECK_EQUAL(messages, d.broker.publishes - before);
+}
+
+TEST(client_publish_and_queue)
+{
+    OnlineDevice d;
+    REQUIRE(d.thx.mqtt_client != nullptr);
+    PubSubClient &client = *d.thx.mqtt_client;
+    unsigned before = d.broker.publishes;
+
+    HeapProbe probe;
+    for (unsigned i = 0; i < messages; i++)
+    {
+        client.publish("/owner/device/a", (const uint8_t *)payload, sizeof(payload) - 1);
+        client.queue("/owner/device/b", (const uint8_t *)payload, sizeof(payload) - 1);
+    }
+    client.loop();
+    CHECK_EQUAL(0ull, (unsigned long long)probe.allocations());
+    CHECK_EQUAL(2 * messages, d.broker.publishes - before);
+}
+
+// A stored backlog is handed off ahead of live messages, which then skip the outbox
+TEST(publish_after_backlog)
+{
+    OnlineDevice d;
+    REQUIRE(d.thx.thinx_phase == THiNX::COMPLETED);
+    for (unsigned i = 0; i < 20; i++)
+        d.thx.mqtt_outbox.append("/owner/device/stored", (const uint8_t *)payload, sizeof(payload) - 1, false);
+    d.thx.mqtt_outbox.flush();
+    unsigned before = d.broker.publishes;
+
+    for (unsigned i = 0; i < 20; i++)
+    {
+        d.thx.publish(payload, "telemetry", false); // hands off two stored messages, then queues or stores this one
+        d.thx.loop();
+    }
+    CHECK(!d.thx.mqtt_outbox.pending());
+
+    size_t writes = SPIFFS.write_opens;
+    for (unsigned i = 0; i < 10; i++)
+        d.thx.publish(payload, "telemetry", false);
+    d.thx.loop();
+    CHECK_EQUAL(writes, SPIFFS.write_opens);
+    CHECK_EQUAL(50u, d.broker.publishes - before);
+}
+
+// Goes through the outbound queue, so it is stored like any other status while MQTT is down
+TEST(dashboard_status)
+{
+    OnlineDevice d;
+    REQUIRE(d.thx.thinx_phase == THiNX::COMPLETED);
+    d.broker.record = true;
+    d.broker.published.clear();
+
+    d.thx.setDashboardStatus("ready");
+    d.thx.loop();
+    REQUIRE(!d.broker.published.empty());
+    CHECK(d.broker.published.back().payload == "{ \"status\" : \"ready\" }");
+
+    d.thx.mqtt_client->disconnect();
+    d.thx.setDashboardStatus(String("offline"));
+    CHECK(d.thx.mqtt_outbox.pending());
+}
+
+int main()
+{
+    return run_tests();
+}